@@ -116,20 +116,65 @@ enum m65816_flags : uint8_t {
 	Negative = 0x80
 };
 
+inline uint8_t get_op_size(M addrMode, uint8_t flags) {
+	if (addrMode == M::Imx) {
+		return (flags & m65816_flags::IndexMode8) ? 2 : 3;
+	}
+	else if (addrMode == M::Imm) {
+		return (flags & m65816_flags::MemoryMode8) ? 2 : 3;
+	}
+
+	return m65816_OpSize[static_cast<int>(addrMode)];
+}
+
+// operand address uses DB, so a bank override applies
+inline bool is_data_bank_mode(uint8_t opCode) {
+	switch (m65816_OpMode[opCode]) {
+	case M::Absd:
+	case M::Abx:
+	case M::Aby:
+		return opCode != 0xF4; // PEA pushes a value
+	default:
+		return false;
+	}
+}
+
 static const char  switch_bitmode_action_name[] = "65816:switch_bitmode";
 static const char set_cur_offset_bank_action_name[] = "65816:set_cur_offset_bank";
 static const char set_sel_offset_bank_action_name[] = "65816:set_sel_offset_bank";
 static const char set_wram_offset_bank_action_name[] = "65816:set_wram_offset_bank";
 static const char set_zero_offset_bank_action_name[] = "65816:set_zero_offset_bank";
 static const char set_cust_offset_bank_action_name[] = "65816:set_cust_offset_bank";
+static const char func_cycles_action_name[] = "65816:func_cycles";
+static const char block_cycles_action_name[] = "65816:block_cycles";
+static const char import_trace_action_name[] = "65816:import_trace";
+static const char import_cdl_action_name[] = "65816:import_cdl";
+static const char import_symbols_action_name[] = "65816:import_symbols";
+static const char hwreg_accesses_action_name[] = "65816:hwreg_accesses";
+static const char decode_cache_stats_action_name[] = "65816:decode_cache_stats";
+static const char infer_background_action_name[] = "65816:infer_background";
+static const char save_analysis_cache_action_name[] = "65816:save_analysis_cache";
+static const char bank_view_action_name[] = "65816:bank_view";
+static const char import_savestate_action_name[] = "65816:import_savestate";
+static const char run_init_code_action_name[] = "65816:run_init_code";
+static const char run_decompressor_action_name[] = "65816:run_decompressor";
+static const char code_score_action_name[] = "65816:code_score";
+static const char region_map_action_name[] = "65816:region_map";
+static const char dup_funcs_action_name[] = "65816:dup_funcs";
+static const char apply_sigs_action_name[] = "65816:apply_sigs";
+static const char create_sigs_action_name[] = "65816:create_sigs";
+static const char export_diff_action_name[] = "65816:export_diff";
+static const char rom_diff_action_name[] = "65816:rom_diff";
 
 extern netnode helper;
+extern const m65816_opcode itype2opcode[256];
 extern bool can_change_mem_mode(ea_t ea);
 extern bool can_change_idx_mode(ea_t ea);
 
 #define FLAGS_BITMODE_TAG ('P')
 #define MANUAL_BITMODE_TAG ('O')
 #define MANUAL_BASE_TAG ('R')
+#define OBSERVED_BITMODE_TAG ('Q')
 
 inline void ea_set_flags(ea_t ea, uint8_t flags) {
 	helper.charset_ea(ea, flags, FLAGS_BITMODE_TAG);
@@ -149,6 +194,20 @@ inline bool ea_is_manual_bitmode(ea_t ea) {
 	return res == 1;
 }
 
+// M/X the CPU ran with (trace log, CDL, savestate), not a user override
+inline void ea_set_observed_bitmode(ea_t ea, bool observed) {
+	helper.charset_ea(ea, observed ? 1 : 0, OBSERVED_BITMODE_TAG);
+}
+
+inline bool ea_is_observed_bitmode(ea_t ea) {
+	return helper.charval_ea(ea, OBSERVED_BITMODE_TAG) == 1;
+}
+
+// the flow propagation in ana doesn't override these
+inline bool ea_is_fixed_bitmode(ea_t ea) {
+	return ea_is_manual_bitmode(ea) || ea_is_observed_bitmode(ea);
+}
+
 inline uint8_t ea_get_flags(ea_t ea) {
 	uint8_t res = helper.charval_ea(ea, FLAGS_BITMODE_TAG);
 
@@ -235,6 +294,77 @@ inline void ea_clr_bank(ea_t ea) {
 	helper.easet(ea, BADADDR, BANK_TAG);
 }
 
+#define DPAGE_TAG ('D')
+
+// Direct Page Reg value known at ea, BADADDR if unknown
+inline ea_t ea_get_dpage(ea_t ea) {
+	return helper.eaget(ea, DPAGE_TAG);
+}
+
+inline void ea_set_dpage(ea_t ea, uint16_t dpage) {
+	helper.easet(ea, dpage, DPAGE_TAG);
+}
+
+// cart flags (CartFlags::*) stored by the loader
+#define CART_FLAGS_IDX (-2)
+
+inline uint32_t get_cart_flags() {
+	return (uint32_t)helper.altval(CART_FLAGS_IDX);
+}
+
+// which ROM mirror the loader maps as segments, the other mirrors are add_mapping'ed to it
+#define CANON_BANKS_IDX (-3)
+
+enum canon_banks_t : uint8_t {
+	CANON_AUTO, // FastROM LoROM at 80+, HiROM at C0+
+	CANON_LOW, // LoROM at 00+, HiROM at 40+
+	CANON_HIGH, // LoROM at 80+, HiROM at C0+
+};
+
+// the one address code and data of a mirrored range are analyzed, named and xref'd at
+inline ea_t canon_ea(ea_t addr) {
+	return use_mapping(addr);
+}
+
+// SHA-1 of the ROM without the copier header (supval), keys the analysis cache
+#define ROM_SHA1_IDX (-4)
+
+// CoprocessorType of the cart (snes_cart.hpp), stored by the loader
+#define COPROCESSOR_IDX (-6)
+
+inline uint32_t get_coprocessor_type() {
+	return (uint32_t)helper.altval(COPROCESSOR_IDX);
+}
+
+// bank switched view set by the user, a byte per rom window with bit 7 set: SA-1 CXB-FXB (bit 7 enables
+// the LoROM view there too), SDD-1 4804-4807, SPC7110 4831-4833. SA-1 BMAPS + 1 at SA1_BMAPS_IDX. None: power-on
+#define MMC_VIEW_IDX (-7)
+#define SA1_BMAPS_IDX (-8)
+
+// BoardId of the memory map (snes_boards.hpp), stored by the loader
+#define BOARD_IDX (-11)
+
+// save RAM size from the header, stored by the loader
+#define SRAM_SIZE_IDX (-10)
+
+// the loader has patched the changed ROM pages on reload
+#define EV_ROM_RELOADED (processor_t::ev_loader + 0)
+
+// path of the IPS/BPS/UPS patch applied at load (supstr), applied again on reload
+#define ROM_PATCH_IDX (-5)
+
+// bytes changed by that patch: altval(start_ea, PATCH_RANGE_TAG) = end_ea, raw ea keys
+#define PATCHES_NODE_NAME "$ 65816 patches"
+#define PATCH_RANGE_TAG ('I')
+#define PATCHED_BG_COLOR 0xC8E6FF
+
+extern netnode patches_node;
+
+inline bool is_rom_patched(ea_t ea) {
+	nodeidx_t start = patches_node.altprev(ea + 1, PATCH_RANGE_TAG);
+	return start != BADNODE && ea < (ea_t)patches_node.altval(start, PATCH_RANGE_TAG);
+}
+
 // !!! problems TODO:
 // C18A1A (C18A4F)
 
@@ -314,7 +444,7 @@ public:
 			}
 		} break;
 		default: { // WRAM
-			segment_t* seg = getseg(use_mapping(0)); // by default it points to zero page
+			segment_t* seg = getseg(canon_ea(0)); // by default it points to zero page
 			start_ea = (seg != nullptr) ? seg->start_ea : BADADDR;
 		} break;
 		}
@@ -389,10 +519,333 @@ struct set_cust_offset_bank_action_t : public set_offset_bank_action_t {
 	set_cust_offset_bank_action_t() : set_offset_bank_action_t(set_offset_bank_mode_t::SOB_CUSTOM) {}
 };
 
+struct insn_cycles_t {
+	uint16_t min_cycles;
+	uint16_t max_cycles;
+	uint32_t min_mclk; // master clocks, depend on memory speed of the accessed regions
+	uint32_t max_mclk;
+
+	void add(const insn_cycles_t& other) {
+		min_cycles += other.min_cycles;
+		max_cycles += other.max_cycles;
+		min_mclk += other.min_mclk;
+		max_mclk += other.max_mclk;
+	}
+};
+
+extern const uint8_t m65816_OpCycles[256];
+extern void calc_insn_cycles(const insn_t& insn, insn_cycles_t* cycles);
+extern void calc_range_cycles(ea_t start_ea, ea_t end_ea, insn_cycles_t* cycles);
+extern void format_cycles(qstring* out, const insn_cycles_t& cycles);
+extern uint8_t get_insn_data_width(const insn_t& insn); // bytes accessed by M/X dependent insns, 0 for others
+extern bool is_rmw_itype(uint16_t itype);
+
+// PPU/CPU/DMA registers are mirrored into every bank of 00-3F and 80-BF,
+// the access index keys them by the bank 0 address
+extern netnode hwregs_node;
+
+extern uint16_t get_hwreg(ea_t addr); // 0 if addr isn't a register
+extern void update_hwreg_index(const insn_t& insn);
+extern bool has_hwreg_write(uint16_t reg); // any indexed instruction writes reg
+extern void gsu_emu(const insn_t& insn); // xrefs of the GSU programs started by the SNES CPU
+
+// the DSP-n (uPD77C25) and ST010/ST011 (uPD96050) firmware dumped after the rom, the loader gives
+// its program and data roms segments of their own past the 24-bit address space
+#define UPD_PROGRAM_EA 0x1000000
+#define UPD_DATA_EA 0x1100000
+
+inline bool is_upd_ea(ea_t ea) {
+	return ea >= UPD_PROGRAM_EA && ea < UPD_DATA_EA;
+}
+
+// the 128KB of WRAM the loader maps at 7E-7F
+#define WRAM_EA 0x7E0000
+#define WRAM_SIZE 0x20000
+
+// PPU memories loaded from a savestate, past the 24-bit space too
+#define PPU_VRAM_EA 0x1200000
+#define PPU_CGRAM_EA 0x1210000
+#define PPU_OAM_EA 0x1220000
+
+// assets unpacked by running their decompressor, a read-only segment each from here on
+#define UNPACKED_EA 0x1300000
+
+extern int upd_ana(insn_t& insn);
+extern int upd_emu(const insn_t& insn);
+extern void upd_out_insn(outctx_t& ctx);
+extern void upd_out_mnem(outctx_t& ctx);
+extern bool upd_out_operand(outctx_t& ctx, const op_t& x);
+
+struct func_cycles_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+struct block_cycles_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+struct import_trace_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+struct import_cdl_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+struct import_symbols_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+struct hwreg_accesses_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+// Direct mapped cache of decoded instructions. M/X and the bank override are a part of the key,
+// so changing them misses by itself, patched bytes and segment changes are invalidated by the idb events
+struct decode_cache_t : public event_listener_t {
+	qvector<ea_t> eas;
+	qvector<uint8_t> flags;
+	qvector<uint16_t> banks; // bank override >> 16, 0xFFFF if none
+	qvector<uint16_t> itypes;
+	qvector<uint8_t> sizes;
+	qvector<uint8_t> modes;
+	qvector<uint8_t> op_types;
+	qvector<uint32_t> op_addrs; // both of the operands for MVN/MVP
+
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t timed_misses = 0;
+	uint64_t timed_ns = 0;
+
+	bool lookup(insn_t& insn, uint8_t ea_flags, ea_t ea_bank);
+	uint64_t start_miss();
+	void store(const insn_t& insn, uint8_t ea_flags, ea_t ea_bank, uint64_t started);
+	void invalidate(ea_t start_ea, ea_t end_ea);
+	void clear();
+	void print_stats() const;
+
+	virtual ssize_t idaapi on_event(ssize_t code, va_list va) override;
+};
+
+struct decode_cache_stats_action_t : public action_handler_t {
+	const decode_cache_t* cache;
+
+	decode_cache_stats_action_t(const decode_cache_t* _cache) : cache(_cache) {}
+
+	virtual int idaapi activate(action_activation_ctx_t* ctx) {
+		cache->print_stats();
+		return 1;
+	}
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+extern void stop_inference();
+
+struct infer_background_action_t : public action_handler_t {
+	const ushort* idpflags;
+
+	infer_background_action_t(const ushort* _idpflags) : idpflags(_idpflags) {}
+
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+// saves the analysis cache when the first auto analysis of the ROM is over
+struct analysis_cache_listener_t : public event_listener_t {
+	virtual ssize_t idaapi on_event(ssize_t code, va_list va) override;
+};
+
+struct save_analysis_cache_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+// switches the rom windows of the SA-1/SDD-1/SPC7110 MMC (and the SA-1 BW-RAM at 6000-7FFF),
+// only the mappings to the rom segments change
+struct bank_view_action_t : public action_handler_t {
+	decode_cache_t* cache;
+
+	bank_view_action_t(decode_cache_t* _cache) : cache(_cache) {}
+
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx);
+};
+
+// WRAM, SRAM, the PPU memories and the CPU registers of a snes9x/Mesen savestate
+struct import_savestate_action_t : public action_handler_t {
+	decode_cache_t* cache;
+
+	import_savestate_action_t(decode_cache_t* _cache) : cache(_cache) {}
+
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+// runs the reset/init code in the micro emulator, the states at the call and indirect jump targets go to the database
+struct run_init_code_action_t : public action_handler_t {
+	decode_cache_t* cache;
+
+	run_init_code_action_t(decode_cache_t* _cache) : cache(_cache) {}
+
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+// runs the routine at the cursor alone with the given registers, the WRAM it wrote becomes a segment
+struct run_decompressor_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+// scores the basic blocks of the code banks, flags or undefines the ones that look like data
+struct code_score_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+// classifies the rom windows (tiles, BRR, compressed...), prints a bank overview and marks the data
+struct region_map_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+// hash of an insn with the operands that move with the code (JSR targets, ROM addresses) masked
+extern uint32_t get_insn_token(ea_t ea, asize_t size);
+
+// clusters the copies of a routine across banks by hashing, names the unnamed copies
+struct dup_funcs_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+// Library of middleware signatures (SPC700 upload, decompressors, sound drivers...), the *.snsig files of
+// <ida dir>/sig/snes and <user idadir>/sig/snes. A line is a hex pattern of the first insns of a function,
+// ".." for a byte that depends on the game, and its name. The patterns are indexed by the hash of their
+// first SIG_KEY_SIZE bytes, one table slot chain per hash
+#define SIG_KEY_SIZE 12
+#define SIG_MAX_SIZE 64
+
+struct sig_entry_t {
+	uint32_t pattern_off; // in bytes, the mask follows the pattern
+	uint32_t name_off; // in names
+	uint8_t size;
+	uint16_t key_mask; // a bit per fixed byte of the key
+};
+
+struct sig_library_t : public event_listener_t {
+	qvector<sig_entry_t> sigs;
+	bytevec_t bytes;
+	qvector<char> names; // nul terminated
+	qvector<uint16_t> key_masks; // the distinct ones, every function is hashed once per mask
+	qvector<uint32_t> buckets; // first sig + 1, 0 if none
+	qvector<uint32_t> chain; // next sig + 1 of the same bucket
+	uint32_t files = 0;
+	bool pending = false; // loaded for a new database, matched when the auto analysis is over
+
+	void clear();
+	bool load_file(const char* path);
+	uint32_t load_dirs();
+	void build_index();
+	uint32_t apply();
+
+	virtual ssize_t idaapi on_event(ssize_t code, va_list va) override;
+};
+
+struct apply_sigs_action_t : public action_handler_t {
+	sig_library_t* library;
+
+	apply_sigs_action_t(sig_library_t* _library) : library(_library) {}
+
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+// writes the signatures of the user named functions, to grow the library from an annotated ROM
+struct create_sigs_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+// writes the hashes and annotations of the functions for another revision of the ROM
+struct export_diff_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
+// aligns the functions with an exported revision and takes its names, comments and overrides
+struct rom_diff_action_t : public action_handler_t {
+	virtual int idaapi activate(action_activation_ctx_t* ctx);
+
+	virtual action_state_t idaapi update(action_update_ctx_t* ctx) {
+		return AST_ENABLE_ALWAYS;
+	}
+};
+
 struct m65816_t : public procmod_t {
 #define ROM_NO_BRK 0x01
 #define ROM_NO_COP 0x02
 #define ROM_NO_WDM 0x04
+#define SHOW_CYCLES 0x08
 	ushort idpflags = ROM_NO_BRK | ROM_NO_COP | ROM_NO_WDM;
 
 	int addr24_id, addr24_fid;
@@ -403,6 +856,29 @@ struct m65816_t : public procmod_t {
 	set_wram_offset_bank_action_t set_wram_offset_bank;
 	set_zero_offset_bank_action_t set_zero_offset_bank;
 	set_cust_offset_bank_action_t set_cust_offset_bank;
+	func_cycles_action_t func_cycles;
+	block_cycles_action_t block_cycles;
+	import_trace_action_t import_trace;
+	import_cdl_action_t import_cdl;
+	import_symbols_action_t import_symbols;
+	hwreg_accesses_action_t hwreg_accesses;
+	decode_cache_t decode_cache;
+	decode_cache_stats_action_t decode_cache_stats{ &decode_cache };
+	infer_background_action_t infer_background{ &idpflags };
+	analysis_cache_listener_t analysis_cache_listener;
+	save_analysis_cache_action_t update_analysis_cache;
+	bank_view_action_t bank_view{ &decode_cache };
+	import_savestate_action_t import_savestate{ &decode_cache };
+	run_init_code_action_t run_init_code{ &decode_cache };
+	run_decompressor_action_t run_decompressor;
+	code_score_action_t code_score;
+	region_map_action_t region_map;
+	dup_funcs_action_t dup_funcs;
+	sig_library_t sig_library;
+	apply_sigs_action_t apply_sigs{ &sig_library };
+	create_sigs_action_t create_sigs;
+	export_diff_action_t export_diff;
+	rom_diff_action_t rom_diff;
 
 	action_desc_t switch_bitmode_action = ACTION_DESC_LITERAL_PROCMOD(switch_bitmode_action_name, "Switch flag", &switch_bitmode, this, "Shift+X", NULL, -1);
 	action_desc_t set_cur_offset_bank_action = ACTION_DESC_LITERAL_PROCMOD(set_cur_offset_bank_action_name, "Change bank to current", &set_cur_offset_bank, this, "O", NULL, -1);
@@ -410,6 +886,26 @@ struct m65816_t : public procmod_t {
 	action_desc_t set_wram_offset_bank_action = ACTION_DESC_LITERAL_PROCMOD(set_wram_offset_bank_action_name, "Change bank to WRAM", &set_wram_offset_bank, this, "Shift+O", NULL, -1);
 	action_desc_t set_zero_offset_bank_action = ACTION_DESC_LITERAL_PROCMOD(set_zero_offset_bank_action_name, "Change bank to ZERO", &set_zero_offset_bank, this, "Ctrl+Shift+O", NULL, -1);
 	action_desc_t set_cust_offset_bank_action = ACTION_DESC_LITERAL_PROCMOD(set_cust_offset_bank_action_name, "Change bank to custom", &set_cust_offset_bank, this, "Ctrl+Alt+O", NULL, -1);
+	action_desc_t func_cycles_action = ACTION_DESC_LITERAL_PROCMOD(func_cycles_action_name, "Function cycle totals", &func_cycles, this, "Ctrl+Shift+Y", NULL, -1);
+	action_desc_t block_cycles_action = ACTION_DESC_LITERAL_PROCMOD(block_cycles_action_name, "Basic block cycle totals", &block_cycles, this, "Shift+Y", NULL, -1);
+	action_desc_t import_trace_action = ACTION_DESC_LITERAL_PROCMOD(import_trace_action_name, "CPU trace log (bsnes/Mesen)...", &import_trace, this, NULL, NULL, -1);
+	action_desc_t import_cdl_action = ACTION_DESC_LITERAL_PROCMOD(import_cdl_action_name, "Code/Data Logger file (Mesen/bsnes-plus)...", &import_cdl, this, NULL, NULL, -1);
+	action_desc_t import_symbols_action = ACTION_DESC_LITERAL_PROCMOD(import_symbols_action_name, "Symbol file (WLA-DX/ca65/bass/asar)...", &import_symbols, this, NULL, NULL, -1);
+	action_desc_t hwreg_accesses_action = ACTION_DESC_LITERAL_PROCMOD(hwreg_accesses_action_name, "Hardware register accesses", &hwreg_accesses, this, "Ctrl+Shift+H", NULL, -1);
+	action_desc_t decode_cache_stats_action = ACTION_DESC_LITERAL_PROCMOD(decode_cache_stats_action_name, "Decode cache statistics", &decode_cache_stats, this, NULL, NULL, -1);
+	action_desc_t infer_background_action = ACTION_DESC_LITERAL_PROCMOD(infer_background_action_name, "Infer M/X and DB in background", &infer_background, this, "Ctrl+Shift+M", NULL, -1);
+	action_desc_t save_analysis_cache_action = ACTION_DESC_LITERAL_PROCMOD(save_analysis_cache_action_name, "Update analysis cache", &update_analysis_cache, this, NULL, NULL, -1);
+	action_desc_t bank_view_action = ACTION_DESC_LITERAL_PROCMOD(bank_view_action_name, "Switch bank view...", &bank_view, this, NULL, NULL, -1);
+	action_desc_t import_savestate_action = ACTION_DESC_LITERAL_PROCMOD(import_savestate_action_name, "Savestate (snes9x/Mesen)...", &import_savestate, this, NULL, NULL, -1);
+	action_desc_t run_init_code_action = ACTION_DESC_LITERAL_PROCMOD(run_init_code_action_name, "Run init code (micro emulator)...", &run_init_code, this, NULL, NULL, -1);
+	action_desc_t run_decompressor_action = ACTION_DESC_LITERAL_PROCMOD(run_decompressor_action_name, "Run decompressor at cursor...", &run_decompressor, this, NULL, NULL, -1);
+	action_desc_t code_score_action = ACTION_DESC_LITERAL_PROCMOD(code_score_action_name, "Score code confidence...", &code_score, this, NULL, NULL, -1);
+	action_desc_t region_map_action = ACTION_DESC_LITERAL_PROCMOD(region_map_action_name, "ROM region map...", &region_map, this, NULL, NULL, -1);
+	action_desc_t dup_funcs_action = ACTION_DESC_LITERAL_PROCMOD(dup_funcs_action_name, "Duplicate functions...", &dup_funcs, this, NULL, NULL, -1);
+	action_desc_t apply_sigs_action = ACTION_DESC_LITERAL_PROCMOD(apply_sigs_action_name, "Apply signature library", &apply_sigs, this, NULL, NULL, -1);
+	action_desc_t create_sigs_action = ACTION_DESC_LITERAL_PROCMOD(create_sigs_action_name, "Create signatures...", &create_sigs, this, NULL, NULL, -1);
+	action_desc_t export_diff_action = ACTION_DESC_LITERAL_PROCMOD(export_diff_action_name, "Analysis for ROM diff...", &export_diff, this, NULL, NULL, -1);
+	action_desc_t rom_diff_action = ACTION_DESC_LITERAL_PROCMOD(rom_diff_action_name, "ROM diff with other revision...", &rom_diff, this, NULL, NULL, -1);
 
 	bool recurse_ana = false;
 	
@@ -427,7 +923,7 @@ struct m65816_t : public procmod_t {
 };
 
 inline void add_op_possible_dref(ea_t addr, const op_t& x, const insn_t& insn, bool ref_anyway) {
-	ea_t ea = use_mapping(addr);
+	ea_t ea = canon_ea(addr);
 
 	if (ref_anyway || op_adds_xrefs(get_flags32(insn.ea), x.n)) {
 		if (is_mapped(ea)) {
@@ -443,7 +939,7 @@ inline void add_op_possible_dref(ea_t addr, const op_t& x, const insn_t& insn, b
 
 inline void add_op_cref(ea_t addr, const op_t& x, const insn_t& insn) {
 	bool is_call = has_insn_feature(insn.itype, CF_CALL);
-	ea_t ea = use_mapping(addr);
+	ea_t ea = canon_ea(addr);
 
 	if (is_mapped(ea)) {
 		insn.add_cref(ea, x.offb, is_call ? fl_CN : fl_JN);
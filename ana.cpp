@@ -1,7 +1,7 @@
 #include "65816.hpp"
 #include <ida.hpp>
 
-static const m65816_opcode itype2opcode[256] = {
+const m65816_opcode itype2opcode[256] = {
   //0         1           2           3           4           5           6           7           8           9           a           b           c           d           e           f
   M65816_brk, M65816_ora, M65816_cop, M65816_ora, M65816_tsb, M65816_ora, M65816_asl, M65816_ora, M65816_php, M65816_ora, M65816_asl, M65816_phd, M65816_tsb, M65816_ora, M65816_asl, M65816_ora, // 0
   M65816_bpl, M65816_ora, M65816_ora, M65816_ora, M65816_trb, M65816_ora, M65816_asl, M65816_ora, M65816_clc, M65816_ora, M65816_inc, M65816_tcs, M65816_trb, M65816_ora, M65816_asl, M65816_ora, // 1
@@ -21,17 +21,6 @@ static const m65816_opcode itype2opcode[256] = {
   M65816_beq, M65816_sbc, M65816_sbc, M65816_sbc, M65816_pea, M65816_sbc, M65816_inc, M65816_sbc, M65816_sed, M65816_sbc, M65816_plx, M65816_xce, M65816_jsr, M65816_sbc, M65816_inc, M65816_sbc  // f
 };
 
-static uint8_t get_op_size(M addrMode, uint8_t flags) {
-  if (addrMode == M::Imx) {
-    return (flags & m65816_flags::IndexMode8) ? 2 : 3;
-  }
-  else if (addrMode == M::Imm) {
-    return (flags & m65816_flags::MemoryMode8) ? 2 : 3;
-  }
-
-  return m65816_OpSize[static_cast<int>(addrMode)];
-}
-
 bool can_change_mem_mode(ea_t ea) {
   uint8_t opCode = get_byte(ea);
   M addrMode = m65816_OpMode[opCode];
@@ -95,39 +84,12 @@ static bool is_cref_itype(const insn_t& insn) {
   }
 }
 
-int idaapi m65816_t::ana(insn_t* _insn) { // SnesDisUtils.cpp / Mesen2
-  if (_insn == NULL) {
-    return 0;
-  }
-
-  insn_t& insn = *_insn;
-  insn.size = 0;
-  uint8_t opCode = insn.get_next_byte();
-
-  if ((idpflags & ROM_NO_BRK) && (opCode == 0x00)) {
-    forget_problem(PR_DISASM, insn.ea);
-    return 0;
-  }
-
-  if ((idpflags & ROM_NO_COP) && (opCode == 0x02)) {
-    forget_problem(PR_DISASM, insn.ea);
-    return 0;
-  }
-
-  if ((idpflags & ROM_NO_WDM) && (opCode == 0x42)) {
-    forget_problem(PR_DISASM, insn.ea);
-    return 0;
-  }
-
+// the part of ana which depends only on the bytes, M/X and the bank override of ea, so it can be cached
+static bool decode_operands(insn_t& insn, uint8_t opCode, uint8_t flags, ea_t ea_bank) {
   M addrMode = m65816_OpMode[opCode];
 
-  int can_change_mode = 0;
-  can_change_mode |= can_change_mem_mode(insn.ea) ? 1 : 0;
-  can_change_mode |= can_change_idx_mode(insn.ea) ? 2 : 0;
-
-  uint8_t flags = ea_get_flags(insn.ea);
   uint8_t opSize = get_op_size(addrMode, flags);
-  uint32_t opAddr = get_operand_address(_insn, opSize, addrMode, insn.ea);
+  uint32_t opAddr = get_operand_address(&insn, opSize, addrMode, insn.ea);
 
   insn.itype = itype2opcode[opCode];
   insn.Op1.offb = 1;
@@ -135,8 +97,6 @@ int idaapi m65816_t::ana(insn_t* _insn) { // SnesDisUtils.cpp / Mesen2
 
   op_dtype_t dtype = dt_byte;
 
-  ea_t ea_bank = ea_get_bank(insn.ea);
-
   if (ea_bank != BADADDR) {
     opAddr |= (uint32_t)ea_bank;
   }
@@ -171,11 +131,11 @@ int idaapi m65816_t::ana(insn_t* _insn) { // SnesDisUtils.cpp / Mesen2
   } break;
   case M::Ind: { // ($0000) - Uses Program bank (opcodes: $6C/JMP)
     insn.Op1.type = o_near;
-    insn.Op1.addr = insn.Op1.value = use_mapping(opAddr);
+    insn.Op1.addr = insn.Op1.value = canon_ea(opAddr);
     insn.Op1.dtype = dtype;
 
-    if (!is_mapped(use_mapping(insn.Op1.addr))) {
-      return 0;
+    if (!is_mapped(canon_ea(insn.Op1.addr))) {
+      return false;
     }
   } break;
   case M::Iax: // ($0000,X) - uses Program bank (opcodes: $FC/JSR, $7C/JMP)
@@ -184,8 +144,8 @@ int idaapi m65816_t::ana(insn_t* _insn) { // SnesDisUtils.cpp / Mesen2
     insn.Op1.addr = insn.Op1.value = (ea_bank == BADADDR) ? ((insn.ea & 0xFF0000) | opAddr) : opAddr;
     insn.Op1.dtype = dtype;
 
-    if (!is_mapped(use_mapping(insn.Op1.addr))) {
-      return 0;
+    if (!is_mapped(canon_ea(insn.Op1.addr))) {
+      return false;
     }
   } break;
   case M::Ablp: // $000000 - absolute jump (opcodes: $5C/JML-JMP, $22/JSL)
@@ -214,6 +174,51 @@ int idaapi m65816_t::ana(insn_t* _insn) { // SnesDisUtils.cpp / Mesen2
   } break;
   }
 
+  return true;
+}
+
+int idaapi m65816_t::ana(insn_t* _insn) { // SnesDisUtils.cpp / Mesen2
+  if (_insn == NULL) {
+    return 0;
+  }
+
+  insn_t& insn = *_insn;
+  insn.size = 0;
+
+  if (is_upd_ea(insn.ea)) {
+    return upd_ana(insn);
+  }
+
+  uint8_t opCode = insn.get_next_byte();
+
+  if ((idpflags & ROM_NO_BRK) && (opCode == 0x00)) {
+    forget_problem(PR_DISASM, insn.ea);
+    return 0;
+  }
+
+  if ((idpflags & ROM_NO_COP) && (opCode == 0x02)) {
+    forget_problem(PR_DISASM, insn.ea);
+    return 0;
+  }
+
+  if ((idpflags & ROM_NO_WDM) && (opCode == 0x42)) {
+    forget_problem(PR_DISASM, insn.ea);
+    return 0;
+  }
+
+  uint8_t flags = ea_get_flags(insn.ea);
+  ea_t ea_bank = ea_get_bank(insn.ea);
+
+  if (!decode_cache.lookup(insn, flags, ea_bank)) {
+    uint64_t started = decode_cache.start_miss();
+
+    if (!decode_operands(insn, opCode, flags, ea_bank)) {
+      return 0;
+    }
+
+    decode_cache.store(insn, flags, ea_bank, started);
+  }
+
   if (recurse_ana) {
     return insn.size;
   }
@@ -237,7 +242,7 @@ int idaapi m65816_t::ana(insn_t* _insn) { // SnesDisUtils.cpp / Mesen2
     }
   } // break;
   default: { // any other instruction
-    if (ea_is_manual_bitmode(insn.ea)) {
+    if (ea_is_fixed_bitmode(insn.ea)) {
       break;
     }
 
@@ -245,14 +250,18 @@ int idaapi m65816_t::ana(insn_t* _insn) { // SnesDisUtils.cpp / Mesen2
     bool ok = xb.first_to(insn.ea, XREF_FLOW);
 
     if (ok && xb.iscode) {
-      uint8_t flags = ea_get_flags(xb.from);
-      flags &= prev_mask;
-      flags |= cur_flags;
-      ea_set_flags(insn.ea, flags);
-
-      recurse_ana = true;
-      ana(&insn);
-      recurse_ana = false;
+      uint8_t flow_flags = ea_get_flags(xb.from);
+      flow_flags &= prev_mask;
+      flow_flags |= cur_flags;
+
+      // decoding again with the same flags gives the same insn
+      if (flow_flags != ea_get_flags(insn.ea)) {
+        ea_set_flags(insn.ea, flow_flags);
+
+        recurse_ana = true;
+        ana(&insn);
+        recurse_ana = false;
+      }
     }
   } break;
   }
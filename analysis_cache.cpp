@@ -0,0 +1,361 @@
+#include "65816.hpp"
+#include "analysis_cache.hpp"
+#include <kernwin.hpp>
+#include <diskio.hpp>
+#include <auto.hpp>
+#include <funcs.hpp>
+#include <segment.hpp>
+
+static const char analysis_cache_magic[4] = { 'S', 'N', 'A', 'C' };
+
+static inline uint32_t rol32(uint32_t x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_block(uint32_t h[5], const uint8_t* p) {
+  uint32_t w[80];
+
+  for (int i = 0; i < 16; ++i) {
+    w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) | ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+  }
+
+  for (int i = 16; i < 80; ++i) {
+    w[i] = rol32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+  for (int i = 0; i < 80; ++i) {
+    uint32_t f, k;
+
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    }
+    else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    }
+    else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    }
+    else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+
+    uint32_t t = rol32(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = rol32(b, 30);
+    b = a;
+    a = t;
+  }
+
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+  h[4] += e;
+}
+
+// the same key as the No-Intro/bsnes databases use
+void sha1_digest(const uint8_t* data, size_t size, uint8_t digest[SHA1_SIZE]) {
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  size_t pos = 0;
+
+  for (; pos + 64 <= size; pos += 64) {
+    sha1_block(h, data + pos);
+  }
+
+  uint8_t tail[128] = {};
+  size_t rest = size - pos;
+  memcpy(tail, data + pos, rest);
+  tail[rest] = 0x80;
+
+  size_t tail_size = (rest < 56) ? 64 : 128;
+  uint64_t bits = (uint64_t)size * 8;
+
+  for (int i = 0; i < 8; ++i) {
+    tail[tail_size - 1 - i] = (uint8_t)(bits >> (i * 8));
+  }
+
+  for (size_t i = 0; i < tail_size; i += 64) {
+    sha1_block(h, tail + i);
+  }
+
+  for (int i = 0; i < 5; ++i) {
+    digest[i * 4] = (uint8_t)(h[i] >> 24);
+    digest[i * 4 + 1] = (uint8_t)(h[i] >> 16);
+    digest[i * 4 + 2] = (uint8_t)(h[i] >> 8);
+    digest[i * 4 + 3] = (uint8_t)h[i];
+  }
+}
+
+// <user idadir>/cache/snes/<sha1>.snac, the file can be shared as is
+bool get_analysis_cache_path(qstring* path, const uint8_t sha1[SHA1_SIZE], bool create_dir) {
+  char dir[QMAXPATH];
+  qmakepath(dir, sizeof(dir), get_user_idadir(), "cache", "snes", nullptr);
+
+  if (create_dir && !qfileexist(dir)) {
+    char parent[QMAXPATH];
+    qmakepath(parent, sizeof(parent), get_user_idadir(), "cache", nullptr);
+    qmkdir(parent, 0755);
+
+    if (qmkdir(dir, 0755) != 0 && !qfileexist(dir)) {
+      return false;
+    }
+  }
+
+  qstring name;
+
+  for (int i = 0; i < SHA1_SIZE; ++i) {
+    name.cat_sprnt("%02x", sha1[i]);
+  }
+
+  name += ".snac";
+
+  char buf[QMAXPATH];
+  qmakepath(buf, sizeof(buf), dir, name.c_str(), nullptr);
+  *path = buf;
+  return true;
+}
+
+static bool write_u32s(FILE* fp, const qvector<uint32_t>& vec) {
+  return vec.empty() || qfwrite(fp, &vec[0], vec.size() * sizeof(uint32_t)) == (ssize_t)(vec.size() * sizeof(uint32_t));
+}
+
+static void collect_eavals(uchar tag, qvector<uint32_t>& pairs) {
+  for (nodeidx_t idx = helper.supfirst(tag); idx != BADNODE; idx = helper.supnext(idx, tag)) {
+    ea_t ea = node2ea(idx);
+    ea_t val = helper.eaget(ea, tag);
+
+    if (val != BADADDR) {
+      pairs.push_back((uint32_t)ea);
+      pairs.push_back((uint32_t)val);
+    }
+  }
+}
+
+uint32_t save_analysis_cache(const uint8_t sha1[SHA1_SIZE]) {
+  qvector<uint32_t> insns;
+  qvector<uint32_t> banks;
+  qvector<uint32_t> dpages;
+  qvector<uint32_t> funcs;
+
+  for (segment_t* seg = get_first_seg(); seg != nullptr; seg = get_next_seg(seg->start_ea)) {
+    // the records keep 24-bit addresses, the uPD firmware and the other segments past them aren't 65816 code
+    if (seg->start_ea > 0xFFFFFF) {
+      continue;
+    }
+
+    ea_t ea = seg->start_ea;
+
+    if (!is_head(get_flags(ea))) {
+      ea = next_head(ea, seg->end_ea);
+    }
+
+    for (; ea != BADADDR; ea = next_head(ea, seg->end_ea)) {
+      if (!is_code(get_flags(ea))) {
+        continue;
+      }
+
+      uint8_t flags = ea_get_flags(ea) & (m65816_flags::MemoryMode8 | m65816_flags::IndexMode8);
+
+      if (ea_is_manual_bitmode(ea)) {
+        flags |= ANALYSIS_CACHE_MANUAL;
+      }
+      else if (ea_is_observed_bitmode(ea)) {
+        flags |= ANALYSIS_CACHE_OBSERVED;
+      }
+
+      insns.push_back((uint32_t)(ea & 0xFFFFFF) | ((uint32_t)flags << 24));
+    }
+  }
+
+  collect_eavals(BANK_TAG, banks);
+  collect_eavals(DPAGE_TAG, dpages);
+
+  for (size_t i = 0; i < get_func_qty(); ++i) {
+    ea_t start_ea = getn_func(i)->start_ea;
+
+    if (start_ea <= 0xFFFFFF) {
+      funcs.push_back((uint32_t)start_ea);
+    }
+  }
+
+  qstring path;
+
+  if (insns.empty() || !get_analysis_cache_path(&path, sha1, true)) {
+    return 0;
+  }
+
+  FILE* fp = fopenWB(path.c_str());
+
+  if (fp == nullptr) {
+    return 0;
+  }
+
+  analysis_cache_header_t hdr;
+  memcpy(hdr.magic, analysis_cache_magic, sizeof(hdr.magic));
+  hdr.version = ANALYSIS_CACHE_VERSION;
+  memcpy(hdr.sha1, sha1, SHA1_SIZE);
+  hdr.canon = (uint8_t)helper.altval(CANON_BANKS_IDX);
+  hdr.board = (uint8_t)helper.altval(BOARD_IDX);
+  hdr.insns = (uint32_t)insns.size();
+  hdr.banks = (uint32_t)(banks.size() / 2);
+  hdr.dpages = (uint32_t)(dpages.size() / 2);
+  hdr.funcs = (uint32_t)funcs.size();
+
+  bool ok = qfwrite(fp, &hdr, sizeof(hdr)) == sizeof(hdr);
+  ok = ok && write_u32s(fp, insns) && write_u32s(fp, banks) && write_u32s(fp, dpages) && write_u32s(fp, funcs);
+  qfclose(fp);
+
+  if (!ok) {
+    qunlink(path.c_str());
+    return 0;
+  }
+
+  return hdr.insns;
+}
+
+uint32_t apply_analysis_cache(const uint8_t sha1[SHA1_SIZE]) {
+  qstring path;
+
+  if (!get_analysis_cache_path(&path, sha1, false) || !qfileexist(path.c_str())) {
+    return 0;
+  }
+
+  FILE* fp = fopenRB(path.c_str());
+
+  if (fp == nullptr) {
+    return 0;
+  }
+
+  qvector<uint32_t> data;
+  analysis_cache_header_t hdr;
+  bool ok = qfread(fp, &hdr, sizeof(hdr)) == sizeof(hdr)
+    && memcmp(hdr.magic, analysis_cache_magic, sizeof(hdr.magic)) == 0
+    && hdr.version == ANALYSIS_CACHE_VERSION
+    && memcmp(hdr.sha1, sha1, SHA1_SIZE) == 0;
+
+  if (ok) {
+    uint64_t count = (uint64_t)hdr.insns + (uint64_t)hdr.banks * 2 + (uint64_t)hdr.dpages * 2 + hdr.funcs;
+    ok = sizeof(hdr) + count * sizeof(uint32_t) == qfsize(fp);
+
+    if (ok && count != 0) {
+      data.resize((size_t)count);
+      ok = qfread(fp, &data[0], data.size() * sizeof(uint32_t)) == (ssize_t)(data.size() * sizeof(uint32_t));
+    }
+  }
+
+  qfclose(fp);
+
+  if (!ok) {
+    msg("Analysis cache %s is outdated or damaged, ignored\n", path.c_str());
+    return 0;
+  }
+
+  // another mirror choice or board puts the same code at other addresses
+  if (hdr.canon != (uint8_t)helper.altval(CANON_BANKS_IDX) || hdr.board != (uint8_t)helper.altval(BOARD_IDX)) {
+    msg("Analysis cache %s was saved with another ROM mapping, ignored\n", path.c_str());
+    return 0;
+  }
+
+  const uint32_t* insns = data.empty() ? nullptr : &data[0];
+  const uint32_t* banks = insns + hdr.insns;
+  const uint32_t* dpages = banks + hdr.banks * 2;
+  const uint32_t* funcs = dpages + hdr.dpages * 2;
+
+  // the state first, so each insn is decoded only once and the same way as it was saved
+  for (uint32_t i = 0; i < hdr.insns; ++i) {
+    ea_t ea = insns[i] & 0xFFFFFF;
+    uint8_t flags = (uint8_t)(insns[i] >> 24);
+
+    ea_set_flags(ea, flags & ~(ANALYSIS_CACHE_MANUAL | ANALYSIS_CACHE_OBSERVED));
+
+    if (flags & ANALYSIS_CACHE_MANUAL) {
+      ea_set_manual_bitmode(ea, true);
+    }
+
+    if (flags & ANALYSIS_CACHE_OBSERVED) {
+      ea_set_observed_bitmode(ea, true);
+    }
+  }
+
+  for (uint32_t i = 0; i < hdr.banks; ++i) {
+    ea_set_bank(banks[i * 2], banks[i * 2 + 1]);
+  }
+
+  for (uint32_t i = 0; i < hdr.dpages; ++i) {
+    ea_set_dpage(dpages[i * 2], (uint16_t)dpages[i * 2 + 1]);
+  }
+
+  show_wait_box("Applying the analysis cache...");
+
+  // ascending order: the flow xref of the previous insn is there when ana propagates M/X
+  uint32_t created = 0;
+
+  for (uint32_t i = 0; i < hdr.insns; ++i) {
+    if (create_insn(insns[i] & 0xFFFFFF) > 0) {
+      created++;
+    }
+
+    if ((i & 0xFFF) == 0 && user_cancelled()) {
+      break;
+    }
+  }
+
+  hide_wait_box();
+
+  for (uint32_t i = 0; i < hdr.funcs; ++i) {
+    auto_make_proc(funcs[i]);
+  }
+
+  return created;
+}
+
+ssize_t idaapi analysis_cache_listener_t::on_event(ssize_t code, va_list va) {
+  if (code != idb_event::auto_empty_finally) {
+    return 0;
+  }
+
+  uint8_t sha1[SHA1_SIZE];
+  qstring path;
+
+  // databases of the older loader have no hash
+  if (helper.supval(ROM_SHA1_IDX, sha1, sizeof(sha1)) != SHA1_SIZE || !get_analysis_cache_path(&path, sha1, false)) {
+    return 0;
+  }
+
+  // only the first finished analysis of a ROM is saved automatically
+  if (!qfileexist(path.c_str())) {
+    uint32_t insns = save_analysis_cache(sha1);
+
+    if (insns != 0) {
+      msg("Analysis cache: %u instructions saved to %s\n", insns, path.c_str());
+    }
+  }
+
+  return 0;
+}
+
+int idaapi save_analysis_cache_action_t::activate(action_activation_ctx_t* ctx) {
+  uint8_t sha1[SHA1_SIZE];
+
+  if (helper.supval(ROM_SHA1_IDX, sha1, sizeof(sha1)) != SHA1_SIZE) {
+    warning("The ROM hash is unknown, reload the ROM with the current loader");
+    return 1;
+  }
+
+  uint32_t insns = save_analysis_cache(sha1);
+
+  if (insns == 0) {
+    warning("Can't save the analysis cache");
+    return 1;
+  }
+
+  msg("Analysis cache: %u instructions saved\n", insns);
+  return 1;
+}
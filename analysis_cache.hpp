@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <pro.h>
+
+// Sidecar cache of the finished analysis, keyed by the SHA-1 of the ROM without the copier header.
+// The proc module saves it once the auto analysis is done, the loader applies it to a new database.
+
+#define SHA1_SIZE 20
+
+#define ANALYSIS_CACHE_VERSION 2
+#define ANALYSIS_CACHE_MANUAL 0x80 // insn record: M/X set by the user
+#define ANALYSIS_CACHE_OBSERVED 0x40 // insn record: M/X seen at runtime
+
+#pragma pack(push, 1)
+struct analysis_cache_header_t {
+	char magic[4]; // "SNAC"
+	uint32_t version;
+	uint8_t sha1[SHA1_SIZE];
+	uint8_t canon; // canon_banks_t and BoardId of the mapping the addresses are in
+	uint8_t board;
+	uint32_t insns; // uint32_t each: ea | (M/X | ANALYSIS_CACHE_MANUAL or _OBSERVED) << 24, ascending
+	uint32_t banks; // uint32_t pairs: ea, bank
+	uint32_t dpages; // uint32_t pairs: ea, dpage
+	uint32_t funcs; // uint32_t each: start ea
+};
+#pragma pack(pop)
+
+void sha1_digest(const uint8_t* data, size_t size, uint8_t digest[SHA1_SIZE]);
+bool get_analysis_cache_path(qstring* path, const uint8_t sha1[SHA1_SIZE], bool create_dir);
+
+// both return the number of instructions, 0 on failure
+uint32_t save_analysis_cache(const uint8_t sha1[SHA1_SIZE]);
+uint32_t apply_analysis_cache(const uint8_t sha1[SHA1_SIZE]);
@@ -0,0 +1,202 @@
+#include "65816.hpp"
+#include "snes_cart.hpp"
+#include <kernwin.hpp>
+#include <segment.hpp>
+
+// The loader gives every rom page one segment, the MMC windows are only mappings to them: C0-FF on SA-1
+// (00-3F/80-BF:8000 are the windows there), the rom pages past the fixed ones on SDD-1 and SPC7110.
+// So a view switch doesn't touch the analysis: the code at a switched address is still analyzed
+// and xref'd at the segment of its rom page.
+
+#define MMC_BLOCK_SIZE 0x100000
+#define SA1_BWRAM_BLOCK_SIZE 0x2000
+#define SA1_BWRAM_EA 0x400000
+
+struct bank_window_t {
+  uint8_t start_bank;
+  uint8_t banks;
+  uint16_t start_addr; // up to the end of each bank
+};
+
+static const bank_window_t sa1_windows[] = { // CXB, DXB, EXB, FXB
+  { 0x00, 0x20, 0x8000 },
+  { 0x20, 0x20, 0x8000 },
+  { 0x80, 0x20, 0x8000 },
+  { 0xA0, 0x20, 0x8000 },
+};
+
+static const bank_window_t sdd1_windows[] = { // 4804-4807
+  { 0xC0, 0x10, 0x0000 },
+  { 0xD0, 0x10, 0x0000 },
+  { 0xE0, 0x10, 0x0000 },
+  { 0xF0, 0x10, 0x0000 },
+};
+
+static const bank_window_t spc7110_windows[] = { // 4831-4833, blocks of the data rom after the 1MB of program rom
+  { 0xD0, 0x10, 0x0000 },
+  { 0xE0, 0x10, 0x0000 },
+  { 0xF0, 0x10, 0x0000 },
+};
+
+static void map_rom_view(ea_t ea, asize_t size, qoff64_t rom_offset) {
+  for (asize_t i = 0; i < size; i += 0x1000) {
+    // the rom pages that didn't fit elsewhere have their segment right in the window
+    if (getseg(ea + i) != nullptr) {
+      continue;
+    }
+
+    del_mapping(ea + i);
+
+    // a block past the end of the rom is open bus
+    ea_t target = get_fileregion_ea(rom_offset + i);
+
+    if (target != BADADDR) {
+      add_mapping(ea + i, target, 0x1000);
+    }
+  }
+}
+
+static void set_window(const bank_window_t& window, qoff64_t rom_base, uint8_t block) {
+  asize_t size = 0x10000 - window.start_addr;
+
+  for (uint32_t i = 0; i < window.banks; ++i) {
+    ea_t ea = ((ea_t)(window.start_bank + i) << 16) | window.start_addr;
+    map_rom_view(ea, size, rom_base + (qoff64_t)block * MMC_BLOCK_SIZE + i * size);
+  }
+}
+
+static void set_bwram_view(uint8_t block) {
+  ea_t target = SA1_BWRAM_EA + block * SA1_BWRAM_BLOCK_SIZE;
+
+  if (getseg(target) == nullptr) {
+    target = BADADDR;
+  }
+
+  for (uint32_t bank = 0x00; bank <= 0xBF; ++bank) {
+    if (bank == 0x40) {
+      bank = 0x80;
+    }
+
+    ea_t ea = (bank << 16) | 0x6000;
+    del_mapping(ea);
+
+    if (target != BADADDR) {
+      add_mapping(ea, target, SA1_BWRAM_BLOCK_SIZE);
+    }
+  }
+}
+
+int idaapi bank_view_action_t::activate(action_activation_ctx_t* ctx) {
+  static const char sa1_form[] =
+    "SA-1 MMC banks\n"
+    "\n"
+    "1MB rom blocks seen at 8000-FFFF (0-7)\n"
+    "<~C~XB, 00-1F:D:1:1::>\n"
+    "<~D~XB, 20-3F:D:1:1::>\n"
+    "<~E~XB, 80-9F:D:1:1::>\n"
+    "<~F~XB, A0-BF:D:1:1::>\n"
+    "\n"
+    "8KB BW-RAM block seen at 6000-7FFF (0-31)\n"
+    "<~B~MAPS:D:2:2::>\n"
+    "\n";
+  static const char sdd1_form[] =
+    "SDD-1 MMC banks\n"
+    "\n"
+    "1MB rom blocks (0-7)\n"
+    "<~C~0-CF (4804):D:1:1::>\n"
+    "<~D~0-DF (4805):D:1:1::>\n"
+    "<~E~0-EF (4806):D:1:1::>\n"
+    "<~F~0-FF (4807):D:1:1::>\n"
+    "\n";
+  static const char spc7110_form[] =
+    "SPC7110 data rom banks\n"
+    "\n"
+    "1MB data rom blocks (0-7)\n"
+    "<~D~0-DF (4831):D:1:1::>\n"
+    "<~E~0-EF (4832):D:1:1::>\n"
+    "<~F~0-FF (4833):D:1:1::>\n"
+    "\n";
+
+  CoprocessorType chip = (CoprocessorType)get_coprocessor_type();
+  nodeidx_t view = helper.altval(MMC_VIEW_IDX);
+  nodeidx_t bmaps = helper.altval(SA1_BMAPS_IDX);
+  sval_t blocks[4];
+  sval_t bwram = bmaps != 0 ? (sval_t)bmaps - 1 : 0;
+
+  for (int i = 0; i < 4; ++i) {
+    blocks[i] = view != 0 ? (sval_t)((view >> (i * 8)) & 7) : i;
+  }
+
+  const bank_window_t* windows;
+  int count;
+  qoff64_t rom_base = 0;
+  int res;
+
+  switch (chip) {
+  case CoprocessorType::SA1:
+    windows = sa1_windows;
+    count = qnumber(sa1_windows);
+    res = ask_form(sa1_form, &blocks[0], &blocks[1], &blocks[2], &blocks[3], &bwram);
+    break;
+  case CoprocessorType::SDD1:
+    windows = sdd1_windows;
+    count = qnumber(sdd1_windows);
+    res = ask_form(sdd1_form, &blocks[0], &blocks[1], &blocks[2], &blocks[3]);
+    break;
+  case CoprocessorType::SPC7110:
+    windows = spc7110_windows;
+    count = qnumber(spc7110_windows);
+    rom_base = MMC_BLOCK_SIZE;
+    res = ask_form(spc7110_form, &blocks[0], &blocks[1], &blocks[2]);
+    break;
+  default:
+    return 0;
+  }
+
+  if (res <= 0) {
+    return 0;
+  }
+
+  show_wait_box("Switching the bank view...");
+  view = 0;
+
+  for (int i = 0; i < count; ++i) {
+    blocks[i] &= 7;
+    set_window(windows[i], rom_base, (uint8_t)blocks[i]);
+    view |= (nodeidx_t)(0x80 | blocks[i]) << (i * 8);
+  }
+
+  helper.altset(MMC_VIEW_IDX, view);
+
+  if (chip == CoprocessorType::SA1) {
+    bwram &= 0x1F;
+    set_bwram_view((uint8_t)bwram);
+    helper.altset(SA1_BMAPS_IDX, bwram + 1);
+  }
+
+  hide_wait_box();
+
+  // the operand addresses of the cached insns went through the old mappings
+  cache->clear();
+  request_refresh(IWID_DISASMS);
+
+  qstring info;
+
+  for (int i = 0; i < count; ++i) {
+    info.cat_sprnt(" %02X:%d", windows[i].start_bank, (int)blocks[i]);
+  }
+
+  msg("Bank view (window:block):%s\n", info.c_str());
+  return 1;
+}
+
+action_state_t idaapi bank_view_action_t::update(action_update_ctx_t* ctx) {
+  switch ((CoprocessorType)get_coprocessor_type()) {
+  case CoprocessorType::SA1:
+  case CoprocessorType::SDD1:
+  case CoprocessorType::SPC7110:
+    return AST_ENABLE_FOR_IDB;
+  default:
+    return AST_DISABLE_FOR_IDB;
+  }
+}
@@ -0,0 +1,224 @@
+#include "65816.hpp"
+#include "mapped_file.hpp"
+#include <kernwin.hpp>
+#include <auto.hpp>
+#include <loader.hpp>
+
+// Code/Data Logger files have one byte of flags per PRG ROM byte (without the copier header)
+
+// normalized flags, the same bits as Mesen uses
+#define CDL_CODE 0x01
+#define CDL_DATA 0x02
+#define CDL_JUMP 0x04
+#define CDL_SUB 0x08
+#define CDL_X8 0x10 // m65816_flags::IndexMode8
+#define CDL_M8 0x20 // m65816_flags::MemoryMode8
+#define CDL_OPCODE 0x40 // only when the format knows opcode bytes
+
+// bsnes-plus usage flags
+#define USAGE_READ 0x80
+#define USAGE_WRITE 0x40
+#define USAGE_EXEC 0x20
+#define USAGE_OPCODE 0x10
+#define USAGE_FLAG_M 0x02
+#define USAGE_FLAG_X 0x01
+
+#define CDL_PAGE_SIZE 0x1000
+
+static const char mesen_cdl_magic[] = "CDLv2";
+
+enum class cdl_format_t : uint8_t {
+  Mesen,
+  BsnesPlus,
+};
+
+struct cdl_stats_t {
+  uint32_t code_runs;
+  uint32_t data_runs;
+  uint32_t insns;
+  uint32_t entries;
+};
+
+static inline uint8_t normalize_cdl(cdl_format_t format, uint8_t b) {
+  if (format == cdl_format_t::Mesen) {
+    return b & (CDL_CODE | CDL_DATA | CDL_JUMP | CDL_SUB | CDL_X8 | CDL_M8);
+  }
+
+  uint8_t res = 0;
+
+  if (b & (USAGE_EXEC | USAGE_OPCODE)) {
+    res |= CDL_CODE;
+  }
+  else if (b & USAGE_READ) {
+    res |= CDL_DATA;
+  }
+
+  if (b & USAGE_OPCODE) {
+    res |= CDL_OPCODE;
+  }
+
+  if (b & USAGE_FLAG_M) {
+    res |= CDL_M8;
+  }
+
+  if (b & USAGE_FLAG_X) {
+    res |= CDL_X8;
+  }
+
+  return res;
+}
+
+// the loader passes the rom offsets to mem2base, so file regions give us the page mapping
+static void build_page_map(uint64_t size, qvector<ea_t>& pages) {
+  pages.resize((size_t)((size + CDL_PAGE_SIZE - 1) / CDL_PAGE_SIZE));
+
+  for (size_t i = 0; i < pages.size(); ++i) {
+    pages[i] = get_fileregion_ea((int64)i * CDL_PAGE_SIZE);
+  }
+}
+
+static void apply_code_run(const uint8_t* cdl, cdl_format_t format, uint32_t start, uint32_t end, ea_t ea, cdl_stats_t* stats) {
+  bool has_opcodes = (format == cdl_format_t::BsnesPlus);
+  uint32_t pos = start;
+
+  while (pos < end) {
+    uint8_t flags = normalize_cdl(format, cdl[pos]);
+
+    if (has_opcodes && !(flags & CDL_OPCODE)) {
+      pos++; // resync on the next known opcode
+      continue;
+    }
+
+    ea_t insn_ea = ea + (pos - start);
+
+    if (!ea_is_manual_bitmode(insn_ea)) {
+      ea_set_flags(insn_ea, flags & (CDL_M8 | CDL_X8));
+      ea_set_observed_bitmode(insn_ea, true);
+    }
+
+    if (flags & CDL_SUB) {
+      auto_make_proc(insn_ea);
+      stats->entries++;
+    }
+    else if (flags & CDL_JUMP) {
+      stats->entries++;
+    }
+
+    stats->insns++;
+
+    M addrMode = m65816_OpMode[get_byte(insn_ea)];
+    pos += get_op_size(addrMode, flags);
+  }
+
+  // instructions get created in ascending order, so operands become tails before the next opcode
+  auto_mark_range(ea, ea + (end - start), AU_CODE);
+  stats->code_runs++;
+}
+
+static void apply_data_run(ea_t ea, uint32_t size, cdl_stats_t* stats) {
+  ea_t end_ea = ea + size;
+
+  // keep anything already defined there
+  if (!is_unknown(get_flags(ea)) || next_head(ea, end_ea) != BADADDR) {
+    return;
+  }
+
+  create_byte(ea, size);
+  stats->data_runs++;
+}
+
+static void apply_cdl(const uint8_t* cdl, uint64_t size, cdl_format_t format, cdl_stats_t* stats) {
+  qvector<ea_t> pages;
+  build_page_map(size, pages);
+
+  uint32_t pos = 0;
+  uint32_t runs = 0;
+
+  while (pos < size) {
+    uint32_t page = pos / CDL_PAGE_SIZE;
+    uint32_t page_end = std::min<uint32_t>((page + 1) * CDL_PAGE_SIZE, (uint32_t)size);
+    ea_t page_ea = pages[page];
+
+    if (page_ea == BADADDR) {
+      pos = page_end;
+      continue;
+    }
+
+    uint8_t kind = normalize_cdl(format, cdl[pos]) & (CDL_CODE | CDL_DATA);
+    uint32_t start = pos;
+
+    // runs may continue into the next page only if it's mapped contiguously
+    while (pos < size) {
+      uint32_t cur_page = pos / CDL_PAGE_SIZE;
+
+      if (cur_page != page) {
+        if (pages[cur_page] != pages[page] + (ea_t)(cur_page - page) * CDL_PAGE_SIZE) {
+          break;
+        }
+      }
+
+      if ((normalize_cdl(format, cdl[pos]) & (CDL_CODE | CDL_DATA)) != kind) {
+        break;
+      }
+
+      pos++;
+    }
+
+    ea_t ea = page_ea + (start - page * CDL_PAGE_SIZE);
+
+    if (kind & CDL_CODE) {
+      apply_code_run(cdl, format, start, pos, ea, stats);
+    }
+    else if (kind == CDL_DATA) {
+      apply_data_run(ea, pos - start, stats);
+    }
+
+    if ((++runs & 0xFFF) == 0 && user_cancelled()) {
+      break;
+    }
+  }
+}
+
+int idaapi import_cdl_action_t::activate(action_activation_ctx_t* ctx) {
+  const char* path = ask_file(false, "*.cdl", "Select Code/Data Logger file");
+
+  if (path == nullptr) {
+    return 1;
+  }
+
+  mapped_file_t file;
+
+  if (!file.open(path)) {
+    warning("Can't open CDL file %s", path);
+    return 1;
+  }
+
+  const uint8_t* cdl = file.data();
+  uint64_t size = file.size();
+  cdl_format_t format = cdl_format_t::Mesen;
+
+  if (size > sizeof(mesen_cdl_magic) + 3 && memcmp(cdl, mesen_cdl_magic, sizeof(mesen_cdl_magic) - 1) == 0) {
+    // magic + CRC32 of the rom
+    cdl += sizeof(mesen_cdl_magic) - 1 + 4;
+    size -= sizeof(mesen_cdl_magic) - 1 + 4;
+  }
+  else {
+    int res = ask_buttons("~M~esen", "~b~snes-plus", "Cancel", ASKBTN_YES, "Which emulator produced this CDL file?");
+
+    if (res == ASKBTN_CANCEL) {
+      return 1;
+    }
+
+    format = (res == ASKBTN_YES) ? cdl_format_t::Mesen : cdl_format_t::BsnesPlus;
+  }
+
+  show_wait_box("Applying CDL...");
+
+  cdl_stats_t stats = {};
+  apply_cdl(cdl, size, format, &stats);
+
+  hide_wait_box();
+
+  msg("CDL: %u instructions in %u code runs, %u data runs, %u entry points\n", stats.insns, stats.code_runs, stats.data_runs, stats.entries);
+  return 1;
+}
@@ -0,0 +1,377 @@
+#include "65816.hpp"
+#include <bytes.hpp>
+#include <segment.hpp>
+#include <problems.hpp>
+#include <kernwin.hpp>
+#include <name.hpp>
+#include <algorithm>
+
+// Data traced as code (graphics, tables) looks unlike 65816 anyone wrote: rare opcodes and addressing
+// modes, REP/SEP of flags nobody toggles, stores into ROM, branches into the middle of other insns.
+// Every basic block gets a penalty per insn, one pass over each code bank with its bytes read at once;
+// only the insns with a target or an immediate that matters are decoded.
+
+#define SCORE_COMMON 1
+#define SCORE_UNCOMMON 3
+#define SCORE_RARE 5
+#define SCORE_SUSPICIOUS 9
+#define SCORE_HARD 16 // a branch into an operand, a store into ROM
+#define SCORE_MIN_INSNS 3 // shorter blocks need a hard penalty to be flagged
+#define SCORE_DEFAULT_LIMIT 40 // tenths of a penalty per insn
+
+#define SCORE_FLAG 0
+#define SCORE_UNDEFINE 1
+
+struct score_block_t {
+  ea_t start;
+  ea_t end;
+  uint32_t insns;
+  uint32_t penalty;
+  uint32_t hard;
+
+  uint32_t score() const {
+    return (penalty + hard * SCORE_HARD) * 10 / insns;
+  }
+};
+
+// how unusual an opcode is in real code, from its mnemonic and addressing mode
+static uint8_t get_opcode_penalty(uint8_t op) {
+  uint8_t by_itype;
+  uint8_t by_mode;
+
+  switch (itype2opcode[op]) {
+  case M65816_brk:
+  case M65816_cop:
+  case M65816_wdm:
+  case M65816_stp:
+    by_itype = SCORE_SUSPICIOUS;
+    break;
+  case M65816_rti:
+  case M65816_wai:
+  case M65816_mvp:
+  case M65816_bvc:
+  case M65816_bvs:
+  case M65816_brl:
+  case M65816_clv:
+  case M65816_sed:
+  case M65816_xce:
+  case M65816_per:
+  case M65816_pei:
+  case M65816_tsx:
+  case M65816_txs:
+    by_itype = SCORE_RARE;
+    break;
+  case M65816_lda:
+  case M65816_sta:
+  case M65816_ldx:
+  case M65816_ldy:
+  case M65816_stx:
+  case M65816_sty:
+  case M65816_stz:
+  case M65816_jsr:
+  case M65816_jsl:
+  case M65816_rts:
+  case M65816_rtl:
+  case M65816_jmp:
+  case M65816_jml:
+  case M65816_bra:
+  case M65816_bne:
+  case M65816_beq:
+  case M65816_bpl:
+  case M65816_bmi:
+  case M65816_bcc:
+  case M65816_bcs:
+  case M65816_rep:
+  case M65816_sep:
+  case M65816_inc:
+  case M65816_dec:
+  case M65816_inx:
+  case M65816_iny:
+  case M65816_dex:
+  case M65816_dey:
+  case M65816_cmp:
+  case M65816_cpx:
+  case M65816_cpy:
+  case M65816_and:
+  case M65816_ora:
+  case M65816_adc:
+  case M65816_sbc:
+  case M65816_clc:
+  case M65816_sec:
+  case M65816_sei:
+  case M65816_tax:
+  case M65816_tay:
+  case M65816_txa:
+  case M65816_tya:
+  case M65816_pha:
+  case M65816_pla:
+  case M65816_php:
+  case M65816_plp:
+  case M65816_phb:
+  case M65816_plb:
+  case M65816_phx:
+  case M65816_phy:
+  case M65816_plx:
+  case M65816_ply:
+  case M65816_phk:
+  case M65816_phd:
+  case M65816_pld:
+  case M65816_asl:
+  case M65816_lsr:
+  case M65816_xba:
+  case M65816_tcd:
+  case M65816_tdc:
+    by_itype = SCORE_COMMON;
+    break;
+  default:
+    by_itype = SCORE_UNCOMMON;
+    break;
+  }
+
+  switch (m65816_OpMode[op]) {
+  case M::Idx:
+  case M::Sr:
+  case M::Isy:
+    by_mode = SCORE_RARE;
+    break;
+  case M::Idp:
+  case M::Idl:
+  case M::Idy:
+  case M::Idly:
+  case M::Alx:
+  case M::Dpy:
+  case M::Ind:
+  case M::Iax:
+  case M::Ial:
+  case M::Rell:
+    by_mode = SCORE_UNCOMMON;
+    break;
+  default:
+    by_mode = SCORE_COMMON;
+    break;
+  }
+
+  return std::max(by_itype, by_mode);
+}
+
+static bool is_store_itype(uint16_t itype) {
+  switch (itype) {
+  case M65816_sta:
+  case M65816_stx:
+  case M65816_sty:
+  case M65816_stz:
+  case M65816_tsb:
+  case M65816_trb:
+    return true;
+  default:
+    return is_rmw_itype(itype);
+  }
+}
+
+// hard penalties of an insn: where it goes or writes can't be right for code
+static uint32_t get_hard_penalties(const insn_t& insn, uint8_t op, uint8_t prev_op, uint8_t prev_imm) {
+  uint32_t hard = 0;
+  M addrMode = static_cast<M>(insn.insnpref);
+
+  switch (insn.itype) {
+  case M65816_rep:
+  case M65816_sep: {
+    uint8_t bits = (uint8_t)insn.Op1.value;
+
+    // N, V and Z are results, not modes
+    if (bits & (m65816_flags::Negative | m65816_flags::Overflow | m65816_flags::Zero)) {
+      hard++;
+    }
+
+    // undoes the mode change right before it
+    if ((prev_op == 0xC2 || prev_op == 0xE2) && prev_op != op && prev_imm == bits) {
+      hard++;
+    }
+  } break;
+  }
+
+  for (int i = 0; i < UA_MAXOP && insn.ops[i].type != o_void; ++i) {
+    const op_t& x = insn.ops[i];
+
+    if (x.type == o_near) {
+      ea_t target = canon_ea(x.addr);
+      flags64_t flags = get_flags(target);
+
+      if (!is_mapped(target) || is_tail(flags) || is_data(flags)) {
+        hard++;
+      }
+    }
+    else if (x.type == o_mem && is_store_itype(insn.itype)) {
+      switch (addrMode) {
+      case M::Absd:
+      case M::Abx:
+      case M::Aby:
+      case M::Abld:
+      case M::Alx: {
+        ea_t target = canon_ea(x.addr);
+        segment_t* seg = getseg(target);
+
+        if (get_hwreg(x.addr) == 0 && seg != nullptr && (seg->perm & SEGPERM_WRITE) == 0) {
+          hard++;
+        }
+      } break;
+      }
+    }
+  }
+
+  return hard;
+}
+
+static bool needs_decode(uint8_t op) {
+  switch (m65816_OpMode[op]) {
+  case M::Rel:
+  case M::Rell:
+  case M::Absp:
+  case M::Ablp:
+    return true;
+  case M::Im8:
+    return op == 0xC2 || op == 0xE2; // REP/SEP
+  case M::Absd:
+  case M::Abx:
+  case M::Aby:
+  case M::Abld:
+  case M::Alx:
+    return is_store_itype(itype2opcode[op]);
+  default:
+    return false;
+  }
+}
+
+static bool ends_block(uint8_t op) {
+  uint16_t itype = itype2opcode[op];
+  return has_insn_feature(itype, CF_STOP) || has_insn_feature(itype, CF_JUMP) || m65816_OpMode[op] == M::Rel;
+}
+
+static void score_segment(segment_t* seg, uint8_t penalties[256], uint32_t limit, qvector<score_block_t>* bad) {
+  asize_t size = seg->size();
+  bytevec_t bytes;
+  bytes.resize(size, 0);
+  get_bytes(&bytes[0], size, seg->start_ea, GMB_READALL);
+
+  score_block_t block = {};
+  uint8_t prev_op = 0;
+  uint8_t prev_imm = 0;
+  bool skip = false; // user named code stays as it is
+
+  auto close_block = [&](ea_t end) {
+    block.end = end;
+
+    if (!skip && block.insns != 0 && block.score() > limit && (block.insns >= SCORE_MIN_INSNS || block.hard != 0)) {
+      bad->push_back(block);
+    }
+
+    block = {};
+    skip = false;
+  };
+
+  insn_t insn;
+
+  for (ea_t ea = seg->start_ea; ea < seg->end_ea && ea != BADADDR; ea = next_head(ea, seg->end_ea)) {
+    flags64_t flags = get_flags(ea);
+
+    if (!is_code(flags)) {
+      if (block.insns != 0) {
+        close_block(ea);
+      }
+
+      continue;
+    }
+
+    // a block that doesn't flow from the previous insn starts here
+    if (block.insns != 0 && !is_flow(flags)) {
+      close_block(ea);
+    }
+
+    if (block.insns == 0) {
+      block.start = ea;
+    }
+
+    uint8_t op = bytes[ea - seg->start_ea];
+    block.insns++;
+    block.penalty += penalties[op];
+    skip |= has_user_name(flags);
+
+    if (needs_decode(op) && decode_insn(&insn, ea) > 0) {
+      block.hard += get_hard_penalties(insn, op, prev_op, prev_imm);
+    }
+
+    prev_op = op;
+    prev_imm = (ea + 1 < seg->end_ea) ? bytes[ea + 1 - seg->start_ea] : 0;
+
+    if (ends_block(op)) {
+      close_block(get_item_end(ea));
+    }
+  }
+
+  if (block.insns != 0) {
+    close_block(seg->end_ea);
+  }
+}
+
+int idaapi code_score_action_t::activate(action_activation_ctx_t* ctx) {
+  static const char form[] =
+    "Code confidence\n"
+    "\n"
+    "<~L~imit, tenths of a penalty per insn:D::8::>\n"
+    "Low confidence blocks\n"
+    "<~F~lag in the problems list:R>\n"
+    "<~U~ndefine:R>>\n"
+    "\n";
+
+  sval_t limit = SCORE_DEFAULT_LIMIT;
+  ushort what = SCORE_FLAG;
+
+  if (ask_form(form, &limit, &what) <= 0 || limit <= 0) {
+    return 1;
+  }
+
+  uint8_t penalties[256];
+
+  for (int op = 0; op < 256; ++op) {
+    penalties[op] = get_opcode_penalty((uint8_t)op);
+  }
+
+  show_wait_box("Scoring code...");
+
+  qvector<score_block_t> bad;
+  uint32_t banks = 0;
+
+  for (segment_t* seg = get_first_seg(); seg != nullptr; seg = get_next_seg(seg->start_ea)) {
+    if (seg->type != SEG_CODE || is_upd_ea(seg->start_ea)) {
+      continue;
+    }
+
+    replace_wait_box("Scoring code at %a...", seg->start_ea);
+    score_segment(seg, penalties, (uint32_t)limit, &bad);
+    banks++;
+
+    if (user_cancelled()) {
+      break;
+    }
+  }
+
+  // all blocks are scored before any goes away, the undefined ones would change the next scores
+  for (const score_block_t& block : bad) {
+    uint32_t score = block.score();
+    msg("%a: %u insns, score %u.%u%s\n", block.start, block.insns, score / 10, score % 10,
+      (block.hard != 0) ? ", branches into operands or stores into ROM" : "");
+
+    if (what == SCORE_UNDEFINE) {
+      del_items(block.start, DELIT_SIMPLE, block.end - block.start);
+    }
+    else {
+      remember_problem(PR_ATTN, block.start, "Low code confidence");
+    }
+  }
+
+  hide_wait_box();
+  msg("Code confidence: %u low confidence blocks in %u code segments%s\n", (uint32_t)bad.size(), banks,
+    (what == SCORE_UNDEFINE) ? " undefined" : "");
+
+  return 1;
+}
@@ -0,0 +1,584 @@
+#include "65816.hpp"
+#include "snes_cart.hpp"
+#include <funcs.hpp>
+#include <gdl.hpp>
+
+// Native mode cycles with 8-bit M/X, DL=0, no page crossing and branches not taken (BRA/BRL always taken)
+const uint8_t m65816_OpCycles[256] = {
+  // 0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+     8, 6, 8, 4, 5, 3, 5, 6, 3, 2, 2, 4, 6, 4, 6, 5, // 0
+     2, 5, 5, 7, 5, 4, 6, 6, 2, 4, 2, 2, 6, 4, 7, 5, // 1
+     6, 6, 8, 4, 3, 3, 5, 6, 4, 2, 2, 5, 4, 4, 6, 5, // 2
+     2, 5, 5, 7, 4, 4, 6, 6, 2, 4, 2, 2, 4, 4, 7, 5, // 3
+     7, 6, 2, 4, 7, 3, 5, 6, 3, 2, 2, 3, 3, 4, 6, 5, // 4
+     2, 5, 5, 7, 7, 4, 6, 6, 2, 4, 3, 2, 4, 4, 7, 5, // 5
+     6, 6, 6, 4, 3, 3, 5, 6, 4, 2, 2, 6, 5, 4, 6, 5, // 6
+     2, 5, 5, 7, 4, 4, 6, 6, 2, 4, 4, 2, 6, 4, 7, 5, // 7
+     3, 6, 4, 4, 3, 3, 3, 6, 2, 2, 2, 3, 4, 4, 4, 5, // 8
+     2, 6, 5, 7, 4, 4, 4, 6, 2, 5, 2, 2, 4, 5, 5, 5, // 9
+     2, 6, 2, 4, 3, 3, 3, 6, 2, 2, 2, 4, 4, 4, 4, 5, // A
+     2, 5, 5, 7, 4, 4, 4, 6, 2, 4, 2, 2, 4, 4, 4, 5, // B
+     2, 6, 3, 4, 3, 3, 5, 6, 2, 2, 2, 3, 4, 4, 6, 5, // C
+     2, 5, 5, 7, 6, 4, 6, 6, 2, 4, 3, 3, 6, 4, 7, 5, // D
+     2, 6, 3, 4, 3, 3, 5, 6, 2, 2, 2, 3, 4, 4, 6, 5, // E
+     2, 5, 5, 7, 5, 4, 6, 6, 2, 4, 4, 2, 8, 4, 7, 5, // F
+};
+
+// cycle is always 6 master clocks for internal operations
+#define IO_MCLK 6
+
+struct mem_speed_t {
+  uint8_t min;
+  uint8_t max;
+};
+
+static const mem_speed_t unknown_speed = { 6, 8 };
+static const mem_speed_t wram_speed = { 8, 8 };
+
+enum class insn_width_t : uint8_t {
+  None,
+  Mem, // depends on m
+  Idx, // depends on x
+};
+
+static insn_width_t get_insn_width(uint16_t itype) {
+  switch (itype) {
+  case M65816_adc:
+  case M65816_and:
+  case M65816_asl:
+  case M65816_bit:
+  case M65816_cmp:
+  case M65816_dec:
+  case M65816_eor:
+  case M65816_inc:
+  case M65816_lda:
+  case M65816_lsr:
+  case M65816_ora:
+  case M65816_pha:
+  case M65816_pla:
+  case M65816_rol:
+  case M65816_ror:
+  case M65816_sbc:
+  case M65816_sta:
+  case M65816_stz:
+  case M65816_trb:
+  case M65816_tsb:
+    return insn_width_t::Mem;
+  case M65816_cpx:
+  case M65816_cpy:
+  case M65816_ldx:
+  case M65816_ldy:
+  case M65816_phx:
+  case M65816_phy:
+  case M65816_plx:
+  case M65816_ply:
+  case M65816_stx:
+  case M65816_sty:
+    return insn_width_t::Idx;
+  default:
+    return insn_width_t::None;
+  }
+}
+
+bool is_rmw_itype(uint16_t itype) {
+  switch (itype) {
+  case M65816_asl:
+  case M65816_dec:
+  case M65816_inc:
+  case M65816_lsr:
+  case M65816_rol:
+  case M65816_ror:
+  case M65816_trb:
+  case M65816_tsb:
+    return true;
+  default:
+    return false;
+  }
+}
+
+uint8_t get_insn_data_width(const insn_t& insn) {
+  M addrMode = static_cast<M>(insn.insnpref);
+  insn_width_t kind = (addrMode == M::Regs) ? insn_width_t::None : get_insn_width(insn.itype);
+  uint8_t flags = ea_get_flags(insn.ea);
+
+  if (kind == insn_width_t::Mem) {
+    return (flags & m65816_flags::MemoryMode8) ? 1 : 2;
+  }
+  else if (kind == insn_width_t::Idx) {
+    return (flags & m65816_flags::IndexMode8) ? 1 : 2;
+  }
+
+  return 0;
+}
+
+static bool is_dp_mode(M addrMode) {
+  switch (addrMode) {
+  case M::Dp:
+  case M::Dps:
+  case M::Dpx:
+  case M::Dpy:
+  case M::Idp:
+  case M::Idx:
+  case M::Idy:
+  case M::Idl:
+  case M::Idly:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static uint8_t get_stack_bytes(uint16_t itype, uint8_t width) {
+  switch (itype) {
+  case M65816_pha:
+  case M65816_pla:
+  case M65816_phx:
+  case M65816_plx:
+  case M65816_phy:
+  case M65816_ply:
+    return width;
+  case M65816_phb:
+  case M65816_plb:
+  case M65816_phk:
+  case M65816_php:
+  case M65816_plp:
+    return 1;
+  case M65816_phd:
+  case M65816_pld:
+  case M65816_pea:
+  case M65816_pei:
+  case M65816_per:
+  case M65816_jsr:
+  case M65816_rts:
+    return 2;
+  case M65816_jsl:
+  case M65816_rtl:
+    return 3;
+  case M65816_brk:
+  case M65816_cop:
+  case M65816_rti:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+static uint8_t get_pointer_bytes(M addrMode) {
+  switch (addrMode) {
+  case M::Dps:
+  case M::Idp:
+  case M::Idx:
+  case M::Idy:
+  case M::Isy:
+  case M::Ind:
+  case M::Iax:
+    return 2;
+  case M::Idl:
+  case M::Idly:
+  case M::Ial:
+    return 3;
+  default:
+    return 0;
+  }
+}
+
+// MEMSEL (420D) bit 0 makes 80-BF:8000-FFFF and C0-FF 6 clocks, 00-7F is always 8. It's only known to be
+// clear when the header says SlowROM and no code writes 420D, else the ROM speed there is a range.
+static bool memsel_may_be_set() {
+  return (get_cart_flags() & CartFlags::FastRom) != 0 || has_hwreg_write(0x420D);
+}
+
+static mem_speed_t get_mem_speed(uint32_t addr, bool fast_rom) {
+  uint8_t bank = (addr >> 16) & 0xFF;
+  uint16_t offset = addr & 0xFFFF;
+
+  if ((bank & 0x40) == 0) { // 00-3F, 80-BF
+    if (offset < 0x2000) {
+      return wram_speed;
+    }
+    else if (offset < 0x4000) {
+      return { 6, 6 };
+    }
+    else if (offset < 0x4200) {
+      return { 12, 12 }; // old style joypad regs
+    }
+    else if (offset < 0x6000) {
+      return { 6, 6 };
+    }
+    else if (offset < 0x8000) {
+      return { 8, 8 };
+    }
+  }
+  else if (bank == 0x7E || bank == 0x7F) {
+    return wram_speed;
+  }
+
+  if (!fast_rom || (bank & 0x80) == 0) {
+    return { 8, 8 };
+  }
+
+  return unknown_speed;
+}
+
+static mem_speed_t get_dp_speed(ea_t dpage, uint32_t offset, bool fast_rom) {
+  if (dpage == BADADDR) {
+    return unknown_speed;
+  }
+
+  return get_mem_speed((dpage + offset) & 0xFFFF, fast_rom);
+}
+
+static void add_accesses(insn_cycles_t* cycles, uint32_t count, const mem_speed_t& speed) {
+  cycles->min_mclk += count * speed.min;
+  cycles->max_mclk += count * speed.max;
+}
+
+void calc_insn_cycles(const insn_t& insn, insn_cycles_t* cycles) {
+  uint8_t opCode = get_byte(insn.ea);
+  M addrMode = static_cast<M>(insn.insnpref);
+  uint8_t flags = ea_get_flags(insn.ea);
+  bool fast_rom = memsel_may_be_set();
+
+  bool rmw = is_rmw_itype(insn.itype);
+  uint8_t width = get_insn_data_width(insn);
+
+  uint16_t fixed = m65816_OpCycles[opCode];
+  uint16_t optional = 0;
+
+  if (width == 2) {
+    fixed += rmw ? 2 : 1;
+  }
+
+  ea_t dpage = BADADDR;
+
+  if (is_dp_mode(addrMode)) {
+    dpage = ea_get_dpage(insn.ea);
+
+    if (dpage == BADADDR) {
+      optional++;
+    }
+    else if (dpage & 0xFF) {
+      fixed++;
+    }
+  }
+
+  switch (addrMode) {
+  case M::Abx:
+  case M::Aby:
+  case M::Idy: {
+    // stores and RMW always take the extra cycle, it's counted in the table
+    if (rmw || insn.itype == M65816_sta || insn.itype == M65816_stz) {
+      break;
+    }
+
+    if (flags & m65816_flags::IndexMode8) {
+      optional++; // only when a page boundary is crossed
+    }
+    else {
+      fixed++;
+    }
+  } break;
+  case M::Rel: {
+    if (insn.itype != M65816_bra) {
+      optional++; // branch taken
+    }
+  } break;
+  }
+
+  cycles->min_cycles = fixed;
+  cycles->max_cycles = fixed + optional;
+  cycles->min_mclk = 0;
+  cycles->max_mclk = 0;
+
+  uint32_t accesses = insn.size;
+  add_accesses(cycles, insn.size, get_mem_speed((uint32_t)insn.ea, fast_rom));
+
+  uint8_t stack_bytes = get_stack_bytes(insn.itype, width);
+  accesses += stack_bytes;
+  add_accesses(cycles, stack_bytes, wram_speed);
+
+  uint8_t pointer_bytes = get_pointer_bytes(addrMode);
+  accesses += pointer_bytes;
+
+  switch (addrMode) {
+  case M::Ind:
+  case M::Ial: {
+    add_accesses(cycles, pointer_bytes, get_mem_speed((uint32_t)insn.Op1.addr & 0xFFFF, fast_rom));
+  } break;
+  case M::Iax: {
+    add_accesses(cycles, pointer_bytes, get_mem_speed((uint32_t)insn.Op1.addr, fast_rom));
+  } break;
+  case M::Isy: {
+    add_accesses(cycles, pointer_bytes, wram_speed);
+  } break;
+  default: {
+    add_accesses(cycles, pointer_bytes, get_dp_speed(dpage, (uint32_t)insn.Op1.addr & 0xFF, fast_rom));
+  } break;
+  }
+
+  uint8_t data_bytes = 0;
+  mem_speed_t data_speed = unknown_speed;
+
+  switch (addrMode) {
+  case M::Sr: {
+    data_bytes = width;
+    data_speed = wram_speed;
+  } break;
+  case M::Dp:
+  case M::Dpx:
+  case M::Dpy: {
+    data_bytes = width;
+    data_speed = get_dp_speed(dpage, (uint32_t)insn.Op1.addr & 0xFF, fast_rom);
+  } break;
+  case M::Idp:
+  case M::Idx:
+  case M::Idy:
+  case M::Idl:
+  case M::Idly:
+  case M::Isy: {
+    data_bytes = width;
+  } break;
+  case M::Absd:
+  case M::Abx:
+  case M::Aby: {
+    data_bytes = width;
+
+    if (ea_get_bank(insn.ea) != BADADDR || (insn.Op1.addr & 0xFFFF) < 0x8000) {
+      // system area is the same for every bank where DB usually points to
+      data_speed = get_mem_speed((uint32_t)insn.Op1.addr, fast_rom);
+    }
+    else if (!fast_rom) {
+      data_speed = { 8, 8 };
+    }
+  } break;
+  case M::Abld:
+  case M::Alx: {
+    data_bytes = width;
+    data_speed = get_mem_speed((uint32_t)insn.Op1.addr, fast_rom);
+  } break;
+  case M::Bm: {
+    data_bytes = 2; // per byte moved
+  } break;
+  }
+
+  if (rmw) {
+    data_bytes *= 2;
+  }
+
+  accesses += data_bytes;
+  add_accesses(cycles, data_bytes, data_speed);
+
+  uint32_t io_min = (cycles->min_cycles > accesses) ? (cycles->min_cycles - accesses) : 0;
+  uint32_t io_max = (cycles->max_cycles > accesses) ? (cycles->max_cycles - accesses) : 0;
+
+  cycles->min_mclk += io_min * IO_MCLK;
+  cycles->max_mclk += io_max * IO_MCLK;
+}
+
+void calc_range_cycles(ea_t start_ea, ea_t end_ea, insn_cycles_t* cycles) {
+  *cycles = {};
+
+  for (ea_t ea = start_ea; ea < end_ea && ea != BADADDR; ea = next_head(ea, end_ea)) {
+    insn_t insn;
+
+    if (!is_code(get_flags(ea)) || decode_insn(&insn, ea) <= 0) {
+      continue;
+    }
+
+    insn_cycles_t insn_cycles;
+    calc_insn_cycles(insn, &insn_cycles);
+    cycles->add(insn_cycles);
+  }
+}
+
+void format_cycles(qstring* out, const insn_cycles_t& cycles) {
+  if (cycles.min_cycles == cycles.max_cycles) {
+    out->cat_sprnt("%u cyc", cycles.min_cycles);
+  }
+  else {
+    out->cat_sprnt("%u-%u cyc", cycles.min_cycles, cycles.max_cycles);
+  }
+
+  if (cycles.min_mclk == cycles.max_mclk) {
+    out->cat_sprnt(", %u mclk", cycles.min_mclk);
+  }
+  else {
+    out->cat_sprnt(", %u-%u mclk", cycles.min_mclk, cycles.max_mclk);
+  }
+}
+
+static size_t count_insns(ea_t start_ea, ea_t end_ea) {
+  size_t count = 0;
+
+  for (ea_t ea = start_ea; ea < end_ea && ea != BADADDR; ea = next_head(ea, end_ea)) {
+    if (is_code(get_flags(ea))) {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+struct cycles_row_t {
+  ea_t start_ea;
+  ea_t end_ea;
+  size_t insns;
+  insn_cycles_t cycles;
+};
+
+static void get_cycles_row(qstrvec_t* cols, const cycles_row_t& row) {
+  (*cols)[2].sprnt("%u", (uint32_t)row.insns);
+  (*cols)[3].sprnt("%u", row.cycles.min_cycles);
+  (*cols)[4].sprnt("%u", row.cycles.max_cycles);
+  (*cols)[5].sprnt("%u", row.cycles.min_mclk);
+  (*cols)[6].sprnt("%u", row.cycles.max_mclk);
+}
+
+static const int cycles_widths[] = {
+  CHCOL_PLAIN | 24,
+  CHCOL_HEX | 8,
+  CHCOL_DEC | 6,
+  CHCOL_DEC | 8,
+  CHCOL_DEC | 8,
+  CHCOL_DEC | 8,
+  CHCOL_DEC | 8,
+};
+
+static const char* const func_cycles_header[] = {
+  "Function", "Address", "Insns", "Min cycles", "Max cycles", "Min mclk", "Max mclk",
+};
+
+static const char* const block_cycles_header[] = {
+  "Block", "Address", "Insns", "Min cycles", "Max cycles", "Min mclk", "Max mclk",
+};
+
+CASSERT(qnumber(cycles_widths) == qnumber(func_cycles_header));
+CASSERT(qnumber(cycles_widths) == qnumber(block_cycles_header));
+
+struct func_cycles_chooser_t : public chooser_t {
+  qvector<cycles_row_t> rows;
+
+  func_cycles_chooser_t() : chooser_t(0, qnumber(cycles_widths), cycles_widths, func_cycles_header, "Function cycle totals") {
+    size_t qty = get_func_qty();
+
+    for (size_t i = 0; i < qty; ++i) {
+      func_t* pfn = getn_func(i);
+
+      // the uPD firmware has no 65816 cycles
+      if (pfn == nullptr || is_upd_ea(pfn->start_ea)) {
+        continue;
+      }
+
+      cycles_row_t& row = rows.push_back();
+      row.start_ea = pfn->start_ea;
+      row.end_ea = pfn->end_ea;
+      row.insns = 0;
+      row.cycles = {};
+
+      func_item_iterator_t fii;
+
+      for (bool ok = fii.set(pfn); ok; ok = fii.next_code()) {
+        ea_t ea = fii.current();
+        insn_t insn;
+
+        if (decode_insn(&insn, ea) <= 0) {
+          continue;
+        }
+
+        insn_cycles_t insn_cycles;
+        calc_insn_cycles(insn, &insn_cycles);
+        row.cycles.add(insn_cycles);
+        row.insns++;
+      }
+    }
+  }
+
+  virtual size_t idaapi get_count() const override {
+    return rows.size();
+  }
+
+  virtual void idaapi get_row(qstrvec_t* cols, int* icon_, chooser_item_attrs_t* attrs, size_t n) const override {
+    const cycles_row_t& row = rows[n];
+    get_func_name(&(*cols)[0], row.start_ea);
+    (*cols)[1].sprnt("%06a", row.start_ea);
+    get_cycles_row(cols, row);
+  }
+
+  virtual ea_t idaapi get_ea(size_t n) const override {
+    return rows[n].start_ea;
+  }
+};
+
+struct block_cycles_chooser_t : public chooser_t {
+  qvector<cycles_row_t> rows;
+
+  block_cycles_chooser_t(func_t* pfn) : chooser_t(0, qnumber(cycles_widths), cycles_widths, block_cycles_header, "Basic block cycle totals") {
+    qflow_chart_t fc("", pfn, BADADDR, BADADDR, FC_NOEXT);
+
+    cycles_row_t total = {};
+    total.start_ea = pfn->start_ea;
+
+    for (int i = 0; i < fc.size(); ++i) {
+      const qbasic_block_t& bb = fc.blocks[i];
+
+      cycles_row_t& row = rows.push_back();
+      row.start_ea = bb.start_ea;
+      row.end_ea = bb.end_ea;
+      row.insns = count_insns(bb.start_ea, bb.end_ea);
+      calc_range_cycles(bb.start_ea, bb.end_ea, &row.cycles);
+
+      total.insns += row.insns;
+      total.cycles.add(row.cycles);
+    }
+
+    std::sort(rows.begin(), rows.end(), [](const cycles_row_t& a, const cycles_row_t& b) {
+      return a.start_ea < b.start_ea;
+    });
+
+    // first row is the whole function
+    rows.insert(rows.begin(), total);
+  }
+
+  virtual size_t idaapi get_count() const override {
+    return rows.size();
+  }
+
+  virtual void idaapi get_row(qstrvec_t* cols, int* icon_, chooser_item_attrs_t* attrs, size_t n) const override {
+    const cycles_row_t& row = rows[n];
+
+    if (n == 0) {
+      (*cols)[0] = "(function total)";
+    }
+    else {
+      (*cols)[0].sprnt("%06a..%06a", row.start_ea, row.end_ea);
+    }
+
+    (*cols)[1].sprnt("%06a", row.start_ea);
+    get_cycles_row(cols, row);
+  }
+
+  virtual ea_t idaapi get_ea(size_t n) const override {
+    return rows[n].start_ea;
+  }
+};
+
+int idaapi func_cycles_action_t::activate(action_activation_ctx_t* ctx) {
+  show_wait_box("Calculating cycles...");
+  func_cycles_chooser_t* ch = new func_cycles_chooser_t();
+  hide_wait_box();
+
+  ch->choose();
+  return 1;
+}
+
+int idaapi block_cycles_action_t::activate(action_activation_ctx_t* ctx) {
+  func_t* pfn = get_func(ctx->cur_ea);
+
+  if (pfn == nullptr || is_upd_ea(pfn->start_ea)) {
+    return 1;
+  }
+
+  block_cycles_chooser_t* ch = new block_cycles_chooser_t(pfn);
+  ch->choose();
+  return 1;
+}
@@ -0,0 +1,140 @@
+#include "65816.hpp"
+#include <chrono>
+
+#define DECODE_CACHE_BITS 16
+#define DECODE_CACHE_SIZE (1 << DECODE_CACHE_BITS)
+#define DECODE_CACHE_MASK (DECODE_CACHE_SIZE - 1)
+#define DECODE_CACHE_NO_BANK 0xFFFF
+
+// every 16th miss is timed, enough for the average decoding time
+#define DECODE_CACHE_TIMING_MASK 0x0F
+
+static inline size_t cache_index(ea_t ea) {
+  // the same offset of neighbour banks must not collide
+  return (size_t)((ea ^ (ea >> DECODE_CACHE_BITS)) & DECODE_CACHE_MASK);
+}
+
+static inline uint16_t cache_bank(ea_t ea_bank) {
+  return (ea_bank == BADADDR) ? DECODE_CACHE_NO_BANK : (uint16_t)(ea_bank >> 16);
+}
+
+static inline uint64_t now_ns() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool decode_cache_t::lookup(insn_t& insn, uint8_t ea_flags, ea_t ea_bank) {
+  if (eas.empty()) {
+    clear();
+  }
+
+  size_t i = cache_index(insn.ea);
+
+  if (eas[i] != insn.ea || flags[i] != ea_flags || banks[i] != cache_bank(ea_bank)) {
+    return false;
+  }
+
+  M addrMode = static_cast<M>(modes[i]);
+
+  insn.itype = itypes[i];
+  insn.size = sizes[i];
+  insn.insnpref = static_cast<char>(addrMode);
+
+  insn.Op1.offb = 1;
+  insn.Op1.type = op_types[i];
+  insn.Op1.dtype = dt_byte;
+
+  if (addrMode == M::Bm) {
+    insn.Op1.addr = insn.Op1.value = (op_addrs[i] >> 8) & 0xFF;
+
+    insn.Op2.type = o_mem;
+    insn.Op2.addr = insn.Op2.value = op_addrs[i] & 0xFF;
+    insn.Op2.dtype = dt_byte;
+    insn.Op2.offb = 2;
+  }
+  else {
+    insn.Op1.addr = insn.Op1.value = op_addrs[i];
+  }
+
+  hits++;
+  return true;
+}
+
+uint64_t decode_cache_t::start_miss() {
+  return ((misses++ & DECODE_CACHE_TIMING_MASK) == 0) ? now_ns() : 0;
+}
+
+void decode_cache_t::store(const insn_t& insn, uint8_t ea_flags, ea_t ea_bank, uint64_t started) {
+  size_t i = cache_index(insn.ea);
+  M addrMode = static_cast<M>(insn.insnpref);
+
+  eas[i] = insn.ea;
+  flags[i] = ea_flags;
+  banks[i] = cache_bank(ea_bank);
+  itypes[i] = insn.itype;
+  sizes[i] = (uint8_t)insn.size;
+  modes[i] = (uint8_t)addrMode;
+  op_types[i] = insn.Op1.type;
+  op_addrs[i] = (addrMode == M::Bm) ? (uint32_t)((insn.Op1.addr << 8) | insn.Op2.addr) : (uint32_t)insn.Op1.addr;
+
+  if (started != 0) {
+    timed_ns += now_ns() - started;
+    timed_misses++;
+  }
+}
+
+void decode_cache_t::invalidate(ea_t start_ea, ea_t end_ea) {
+  if (eas.empty()) {
+    return;
+  }
+
+  for (ea_t ea = start_ea; ea < end_ea; ++ea) {
+    size_t i = cache_index(ea);
+
+    if (eas[i] == ea) {
+      eas[i] = BADADDR;
+    }
+  }
+}
+
+void decode_cache_t::clear() {
+  eas.resize(DECODE_CACHE_SIZE);
+  std::fill(eas.begin(), eas.end(), BADADDR);
+
+  flags.resize(DECODE_CACHE_SIZE);
+  banks.resize(DECODE_CACHE_SIZE);
+  itypes.resize(DECODE_CACHE_SIZE);
+  sizes.resize(DECODE_CACHE_SIZE);
+  modes.resize(DECODE_CACHE_SIZE);
+  op_types.resize(DECODE_CACHE_SIZE);
+  op_addrs.resize(DECODE_CACHE_SIZE);
+}
+
+void decode_cache_t::print_stats() const {
+  uint64_t total = hits + misses;
+  double hit_rate = (total != 0) ? (100.0 * hits / total) : 0.0;
+  double avg_ns = (timed_misses != 0) ? ((double)timed_ns / timed_misses) : 0.0;
+
+  msg("Decode cache: %" FMT_64 "u hits, %" FMT_64 "u misses (%.1f%% hit rate), %.0f ns per decode, ~%.1f ms saved\n",
+    hits, misses, hit_rate, avg_ns, hits * avg_ns / 1000000.0);
+}
+
+ssize_t idaapi decode_cache_t::on_event(ssize_t code, va_list va) {
+  switch (code) {
+  case idb_event::byte_patched: {
+    ea_t ea = va_arg(va, ea_t);
+
+    // the longest insn starts 3 bytes before
+    invalidate((ea >= 3) ? (ea - 3) : 0, ea + 1);
+  } break;
+  case idb_event::segm_added:
+  case idb_event::segm_deleted:
+  case idb_event::segm_start_changed:
+  case idb_event::segm_end_changed:
+  case idb_event::segm_moved: {
+    // jumps into unmapped memory aren't decoded
+    clear();
+  } break;
+  }
+
+  return 0;
+}
@@ -0,0 +1,415 @@
+#include "65816.hpp"
+#include <bytes.hpp>
+#include <funcs.hpp>
+#include <name.hpp>
+#include <kernwin.hpp>
+#include <algorithm>
+#include <unordered_map>
+
+// Games copy routines into the banks that call them with JSR. Each function gets a position independent
+// token per insn (operands pointing into the ROM masked), an exact hash of the tokens and a MinHash
+// signature of the rolling hashes of its token k-grams. Exact copies share the hash, near copies a band
+// of the signature (LSH), so the clusters come from hash buckets, never from comparing every pair.
+
+#define DUP_MIN_INSNS 4
+#define DUP_SHINGLE 4 // insns per k-gram
+#define DUP_MINHASHES 16
+#define DUP_BANDS 8
+#define DUP_ROWS (DUP_MINHASHES / DUP_BANDS)
+#define DUP_NEAR_MATCH 12 // of DUP_MINHASHES, ~75% of the k-grams shared
+#define DUP_ROLL_BASE 0x100000001B3ULL
+
+struct dup_func_t {
+  ea_t start_ea;
+  uint32_t insns;
+  uint64_t exact;
+  uint64_t minhash[DUP_MINHASHES];
+  bool has_minhash;
+};
+
+static inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDULL;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static inline uint32_t fnv1a(uint32_t hash, uint8_t byte) {
+  return (hash ^ byte) * 0x01000193;
+}
+
+// operand bytes that change when the routine is copied to another bank or offset
+static uint32_t get_masked_operand(const uint8_t* bytes, asize_t size) {
+  M addrMode = m65816_OpMode[bytes[0]];
+  uint16_t offset = (size >= 3) ? (uint16_t)(bytes[1] | (bytes[2] << 8)) : 0;
+  uint8_t bank = (size >= 4) ? bytes[3] : 0;
+
+  switch (addrMode) {
+  case M::Absp:
+  case M::Ablp:
+  case M::Iax:
+    return 0x3; // code of its own bank: JSR/JMP, JSL/JML and jump tables
+  case M::Absd:
+  case M::Abx:
+  case M::Aby:
+  case M::Ind:
+  case M::Ial:
+    return (offset >= 0x8000) ? 0x3 : 0; // RAM and registers are the same for every copy
+  case M::Abld:
+  case M::Alx:
+    return (bank != 0x7E && bank != 0x7F && ((bank & 0x40) || offset >= 0x8000)) ? 0x7 : 0;
+  default:
+    return 0;
+  }
+}
+
+uint32_t get_insn_token(ea_t ea, asize_t size) {
+  uint8_t bytes[4] = {};
+  get_bytes(bytes, std::min<asize_t>(size, sizeof(bytes)), ea);
+
+  uint32_t masked = get_masked_operand(bytes, size);
+  uint32_t hash = fnv1a(0x811C9DC5, (uint8_t)size);
+
+  for (asize_t i = 0; i < size && i < sizeof(bytes); ++i) {
+    hash = fnv1a(hash, (i > 0 && (masked & (1 << (i - 1)))) ? 0 : bytes[i]);
+  }
+
+  return hash;
+}
+
+static void hash_func(func_t* pfn, dup_func_t* res) {
+  qvector<uint32_t> tokens;
+  func_item_iterator_t fii;
+
+  for (bool ok = fii.set(pfn); ok; ok = fii.next_code()) {
+    ea_t ea = fii.current();
+    tokens.push_back(get_insn_token(ea, get_item_size(ea)));
+  }
+
+  res->start_ea = pfn->start_ea;
+  res->insns = (uint32_t)tokens.size();
+  res->exact = 0xCBF29CE484222325ULL ^ tokens.size();
+
+  for (uint32_t token : tokens) {
+    res->exact = mix64(res->exact ^ token);
+  }
+
+  res->has_minhash = tokens.size() >= DUP_SHINGLE * 2;
+
+  if (!res->has_minhash) {
+    return;
+  }
+
+  std::fill(res->minhash, res->minhash + DUP_MINHASHES, ~0ULL);
+
+  // rolling hash of the last DUP_SHINGLE tokens
+  uint64_t out_factor = 1;
+
+  for (int i = 0; i < DUP_SHINGLE - 1; ++i) {
+    out_factor *= DUP_ROLL_BASE;
+  }
+
+  uint64_t roll = 0;
+
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (i >= DUP_SHINGLE) {
+      roll -= tokens[i - DUP_SHINGLE] * out_factor;
+    }
+
+    roll = roll * DUP_ROLL_BASE + tokens[i];
+
+    if (i + 1 < DUP_SHINGLE) {
+      continue;
+    }
+
+    for (int h = 0; h < DUP_MINHASHES; ++h) {
+      res->minhash[h] = std::min(res->minhash[h], mix64(roll + h * 0x9E3779B97F4A7C15ULL));
+    }
+  }
+}
+
+static uint32_t count_minhash_matches(const dup_func_t& a, const dup_func_t& b) {
+  uint32_t matches = 0;
+
+  for (int h = 0; h < DUP_MINHASHES; ++h) {
+    matches += (a.minhash[h] == b.minhash[h]) ? 1 : 0;
+  }
+
+  return matches;
+}
+
+struct dup_sets_t {
+  qvector<uint32_t> parent;
+
+  dup_sets_t(size_t count) {
+    parent.resize(count);
+
+    for (size_t i = 0; i < count; ++i) {
+      parent[i] = (uint32_t)i;
+    }
+  }
+
+  uint32_t find(uint32_t i) {
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+
+    return i;
+  }
+
+  void join(uint32_t a, uint32_t b) {
+    a = find(a);
+    b = find(b);
+
+    if (a != b) {
+      parent[std::max(a, b)] = std::min(a, b);
+    }
+  }
+};
+
+struct dup_row_t {
+  uint32_t cluster;
+  ea_t start_ea;
+  uint32_t insns;
+  uint32_t match; // percent of the k-grams shared with the first of the cluster, 100 for exact copies
+};
+
+static const int dup_widths[] = {
+  CHCOL_DEC | 6,
+  CHCOL_HEX | 8,
+  CHCOL_PLAIN | 24,
+  CHCOL_DEC | 6,
+  CHCOL_PLAIN | 8,
+};
+
+static const char* const dup_header[] = {
+  "Cluster", "Address", "Function", "Insns", "Match",
+};
+
+CASSERT(qnumber(dup_widths) == qnumber(dup_header));
+
+struct dup_funcs_chooser_t : public chooser_t {
+  qvector<dup_row_t> rows;
+
+  dup_funcs_chooser_t() : chooser_t(0, qnumber(dup_widths), dup_widths, dup_header, "Duplicate functions") {}
+
+  virtual size_t idaapi get_count() const override {
+    return rows.size();
+  }
+
+  virtual void idaapi get_row(qstrvec_t* cols, int* icon_, chooser_item_attrs_t* attrs, size_t n) const override {
+    const dup_row_t& row = rows[n];
+    (*cols)[0].sprnt("%u", row.cluster);
+    (*cols)[1].sprnt("%06a", row.start_ea);
+    get_func_name(&(*cols)[2], row.start_ea);
+    (*cols)[3].sprnt("%u", row.insns);
+
+    if (row.match == 100) {
+      (*cols)[4] = "exact";
+    }
+    else {
+      (*cols)[4].sprnt("~%u%%", row.match);
+    }
+  }
+
+  virtual ea_t idaapi get_ea(size_t n) const override {
+    return rows[n].start_ea;
+  }
+};
+
+// the one user name of a cluster goes to its unnamed members, with their bank
+static uint32_t propagate_names(const qvector<dup_row_t>& rows, size_t first, size_t end) {
+  qstring name;
+
+  for (size_t i = first; i < end; ++i) {
+    if (!has_user_name(get_flags(rows[i].start_ea))) {
+      continue;
+    }
+
+    qstring other = get_name(rows[i].start_ea);
+
+    if (!name.empty() && name != other) {
+      return 0; // named differently already, which one is right isn't known
+    }
+
+    name = other;
+  }
+
+  if (name.empty()) {
+    return 0;
+  }
+
+  uint32_t named = 0;
+
+  for (size_t i = first; i < end; ++i) {
+    ea_t ea = rows[i].start_ea;
+
+    if (has_user_name(get_flags(ea))) {
+      continue;
+    }
+
+    qstring copy;
+    copy.sprnt("%s_%02X", name.c_str(), (uint32_t)(ea >> 16));
+
+    if (!set_name(ea, copy.c_str(), SN_NOWARN | SN_NOCHECK)) {
+      copy.sprnt("%s_%06X", name.c_str(), (uint32_t)ea);
+
+      if (!set_name(ea, copy.c_str(), SN_NOWARN | SN_NOCHECK)) {
+        continue;
+      }
+    }
+
+    qstring cmt;
+    cmt.sprnt("copy of %s", name.c_str());
+    set_cmt(ea, cmt.c_str(), true);
+    named++;
+  }
+
+  return named;
+}
+
+int idaapi dup_funcs_action_t::activate(action_activation_ctx_t* ctx) {
+  static const char form[] =
+    "Duplicate functions\n"
+    "\n"
+    "<~N~ear copies too:C>\n"
+    "<~P~ropagate the user name of a cluster to its unnamed copies:C>>\n"
+    "\n";
+
+  ushort what = 1;
+
+  if (ask_form(form, &what) <= 0) {
+    return 1;
+  }
+
+  bool near_copies = (what & 1) != 0;
+  bool propagate = (what & 2) != 0;
+
+  show_wait_box("Hashing functions...");
+
+  qvector<dup_func_t> funcs;
+  size_t qty = get_func_qty();
+
+  for (size_t i = 0; i < qty; ++i) {
+    func_t* pfn = getn_func(i);
+
+    if (pfn == nullptr || is_upd_ea(pfn->start_ea)) {
+      continue;
+    }
+
+    dup_func_t res;
+    hash_func(pfn, &res);
+
+    if (res.insns >= DUP_MIN_INSNS) {
+      funcs.push_back(res);
+    }
+
+    if ((i & 0xFF) == 0 && user_cancelled()) {
+      hide_wait_box();
+      return 1;
+    }
+  }
+
+  replace_wait_box("Clustering functions...");
+
+  dup_sets_t sets(funcs.size());
+  std::unordered_map<uint64_t, uint32_t> buckets; // key -> first function seen with it
+
+  for (uint32_t i = 0; i < funcs.size(); ++i) {
+    auto res = buckets.emplace(funcs[i].exact, i);
+
+    if (!res.second) {
+      sets.join(res.first->second, i);
+    }
+  }
+
+  if (near_copies) {
+    for (int band = 0; band < DUP_BANDS; ++band) {
+      buckets.clear();
+
+      for (uint32_t i = 0; i < funcs.size(); ++i) {
+        const dup_func_t& func = funcs[i];
+
+        if (!func.has_minhash) {
+          continue;
+        }
+
+        uint64_t key = mix64(band);
+
+        for (int r = 0; r < DUP_ROWS; ++r) {
+          key = mix64(key ^ func.minhash[band * DUP_ROWS + r]);
+        }
+
+        auto res = buckets.emplace(key, i);
+
+        // checked against the first of the bucket only, sizes within a quarter
+        if (!res.second) {
+          const dup_func_t& other = funcs[res.first->second];
+          uint32_t larger = std::max(func.insns, other.insns);
+          uint32_t smaller = std::min(func.insns, other.insns);
+
+          if (smaller * 4 >= larger * 3 && count_minhash_matches(func, other) >= DUP_NEAR_MATCH) {
+            sets.join(res.first->second, i);
+          }
+        }
+      }
+    }
+  }
+
+  // clusters of 2 or more, in the order of their first function
+  std::unordered_map<uint32_t, uint32_t> sizes;
+
+  for (uint32_t i = 0; i < funcs.size(); ++i) {
+    sizes[sets.find(i)]++;
+  }
+
+  dup_funcs_chooser_t* ch = new dup_funcs_chooser_t();
+  std::unordered_map<uint32_t, uint32_t> cluster_ids;
+
+  for (uint32_t i = 0; i < funcs.size(); ++i) {
+    uint32_t root = sets.find(i);
+
+    if (sizes[root] < 2) {
+      continue;
+    }
+
+    auto id = cluster_ids.emplace(root, (uint32_t)cluster_ids.size() + 1);
+    const dup_func_t& first = funcs[root];
+
+    dup_row_t& row = ch->rows.push_back();
+    row.cluster = id.first->second;
+    row.start_ea = funcs[i].start_ea;
+    row.insns = funcs[i].insns;
+    row.match = (funcs[i].exact == first.exact) ? 100 : count_minhash_matches(funcs[i], first) * 100 / DUP_MINHASHES;
+  }
+
+  std::stable_sort(ch->rows.begin(), ch->rows.end(), [](const dup_row_t& a, const dup_row_t& b) {
+    return a.cluster < b.cluster;
+  });
+
+  uint32_t named = 0;
+
+  if (propagate) {
+    for (size_t first = 0; first < ch->rows.size();) {
+      size_t end = first;
+
+      while (end < ch->rows.size() && ch->rows[end].cluster == ch->rows[first].cluster) {
+        end++;
+      }
+
+      named += propagate_names(ch->rows, first, end);
+      first = end;
+    }
+  }
+
+  hide_wait_box();
+
+  msg("Duplicate functions: %u functions hashed, %u clusters of %u functions, %u names propagated\n",
+    (uint32_t)funcs.size(), (uint32_t)cluster_ids.size(), (uint32_t)ch->rows.size(), named);
+
+  ch->choose();
+  return 1;
+}
@@ -43,6 +43,10 @@ void m65816_t::handle_operand(const op_t& x, bool read_access, const insn_t& ins
 }
 
 int m65816_t::emu(const insn_t& insn) {
+  if (is_upd_ea(insn.ea)) {
+    return upd_emu(insn);
+  }
+
   uint32_t feature = insn.get_canon_feature(ph);
 
   if (feature & CF_USE1) {
@@ -62,6 +66,9 @@ int m65816_t::emu(const insn_t& insn) {
     add_cref(insn.ea, insn.ea + insn.size, fl_F);
   }
 
+  update_hwreg_index(insn);
+  gsu_emu(insn);
+
   switch (insn.itype) {
   case M65816_plb: {
     remember_problem(PR_ATTN, insn.ea, "Data Bank Change");
@@ -0,0 +1,197 @@
+#include "65816.hpp"
+#include "snes_cart.hpp"
+#include <bytes.hpp>
+#include <name.hpp>
+#include <xref.hpp>
+
+// The SNES CPU starts a GSU program by writing its bank to PBR and its address to R15,
+// the write to the high byte of R15 starts the GSU. That write gets a data xref to the program,
+// the GSU code itself isn't 65816 code so it's only named. The bank must be stored to PBR in the same flow,
+// a start without one depends on the path taken to it and is left alone.
+
+#define GSU_R15 0x301E
+#define GSU_PBR 0x3034
+#define GSU_BACKTRACK 16 // insns back in the flow to look for the loads
+
+// the address of a plain store to a GSU register, 0 for others
+static uint16_t get_gsu_store_reg(const insn_t& insn) {
+  if (insn.itype != M65816_sta && insn.itype != M65816_stx && insn.itype != M65816_sty) {
+    return 0;
+  }
+
+  M addrMode = static_cast<M>(insn.insnpref);
+
+  if (insn.Op1.type != o_mem || (addrMode != M::Absd && addrMode != M::Abld)) {
+    return 0;
+  }
+
+  uint16_t reg = get_hwreg(insn.Op1.addr);
+  return (reg >= 0x3000 && reg <= 0x303F) ? reg : 0;
+}
+
+// a call, branch or jump back in the flow, the registers may come from another path past it
+static bool is_flow_break(const insn_t& insn) {
+  M addrMode = static_cast<M>(insn.insnpref);
+
+  return has_insn_feature(insn.itype, CF_CALL) || has_insn_feature(insn.itype, CF_STOP) || addrMode == M::Rel || addrMode == M::Rell;
+}
+
+// whether insn changes the register that load is for (other than with that load)
+static bool writes_load_reg(const insn_t& insn, uint16_t load) {
+  bool accumulator = static_cast<M>(insn.insnpref) == M::Regs;
+
+  switch (insn.itype) {
+  case M65816_mvn:
+  case M65816_mvp:
+    return true;
+  case M65816_adc:
+  case M65816_sbc:
+  case M65816_and:
+  case M65816_ora:
+  case M65816_eor:
+  case M65816_txa:
+  case M65816_tya:
+  case M65816_tdc:
+  case M65816_tsc:
+  case M65816_xba:
+  case M65816_pla:
+    return load == M65816_lda;
+  case M65816_asl:
+  case M65816_lsr:
+  case M65816_rol:
+  case M65816_ror:
+  case M65816_inc:
+  case M65816_dec:
+    return load == M65816_lda && accumulator;
+  case M65816_inx:
+  case M65816_dex:
+  case M65816_tax:
+  case M65816_tsx:
+  case M65816_tyx:
+  case M65816_plx:
+    return load == M65816_ldx;
+  case M65816_iny:
+  case M65816_dey:
+  case M65816_tay:
+  case M65816_txy:
+  case M65816_ply:
+    return load == M65816_ldy;
+  default:
+    return false;
+  }
+}
+
+// the immediate the stored register was loaded with, in the straight flow before the store and with nothing changing it since
+static bool find_stored_imm(const insn_t& store, uint32_t* value) {
+  uint16_t load;
+
+  switch (store.itype) {
+  case M65816_sta: load = M65816_lda; break;
+  case M65816_stx: load = M65816_ldx; break;
+  case M65816_sty: load = M65816_ldy; break;
+  default: return false;
+  }
+
+  insn_t insn;
+  ea_t ea = store.ea;
+
+  for (int i = 0; i < GSU_BACKTRACK; ++i) {
+    if (has_xref(get_flags(ea))) {
+      return false;
+    }
+
+    ea = decode_prev_insn(&insn, ea);
+
+    if (ea == BADADDR || is_flow_break(insn) || writes_load_reg(insn, load)) {
+      return false;
+    }
+
+    if (insn.itype == load) {
+      if (insn.Op1.type != o_imm) {
+        return false;
+      }
+
+      // a bank override turns an immediate into a pointer
+      *value = (uint32_t)(insn.Op1.value & 0xFFFF);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// the last store to reg before ea in the straight flow
+static bool find_prev_store(ea_t ea, uint16_t reg, insn_t* store) {
+  for (int i = 0; i < GSU_BACKTRACK; ++i) {
+    if (has_xref(get_flags(ea))) {
+      return false;
+    }
+
+    ea = decode_prev_insn(store, ea);
+
+    if (ea == BADADDR || is_flow_break(*store)) {
+      return false;
+    }
+
+    if (get_gsu_store_reg(*store) == reg) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void gsu_emu(const insn_t& insn) {
+  if (get_coprocessor_type() != (uint32_t)CoprocessorType::GSU) {
+    return;
+  }
+
+  uint16_t reg = get_gsu_store_reg(insn);
+  uint32_t value;
+
+  uint16_t r15;
+  insn_t prev;
+
+  if (reg == GSU_R15 && get_insn_data_width(insn) == 2 && find_stored_imm(insn, &value)) {
+    r15 = (uint16_t)value;
+  }
+  else if (reg == GSU_R15 + 1 && get_insn_data_width(insn) == 1 && find_stored_imm(insn, &value)) {
+    uint32_t low;
+
+    if (!find_prev_store(insn.ea, GSU_R15, &prev) || get_insn_data_width(prev) != 1 || !find_stored_imm(prev, &low)) {
+      return;
+    }
+
+    r15 = (uint16_t)(((value & 0xFF) << 8) | (low & 0xFF));
+  }
+  else {
+    return;
+  }
+
+  if (!find_prev_store(insn.ea, GSU_PBR, &prev) || !find_stored_imm(prev, &value)) {
+    return;
+  }
+
+  uint8_t pbr = (uint8_t)value;
+
+  // the GSU sees the 32KB of a LoROM bank in both halves of 00-3F
+  ea_t addr = ((ea_t)pbr << 16) | r15;
+
+  if (pbr < 0x40) {
+    addr |= 0x8000;
+  }
+
+  ea_t target = canon_ea(addr);
+
+  if (!is_mapped(target)) {
+    return;
+  }
+
+  add_dref(insn.ea, target, dr_O);
+
+  if (!has_name(get_flags(target))) {
+    qstring name;
+    name.sprnt("gsu_prog_%06X", (uint32_t)addr);
+    set_name(target, name.c_str(), SN_AUTO | SN_NOWARN | SN_NOCHECK);
+  }
+}
@@ -0,0 +1,255 @@
+#include "65816.hpp"
+#include "snes_cart.hpp"
+#include <kernwin.hpp>
+#include <lines.hpp>
+
+// Index of the instructions accessing hardware registers, maintained by emu:
+// forward: hwregs_node altval((reg << 32) | insn_ea, HWREG_TAG) = access bits, sorted by register for range queries
+// reverse: helper eaget(insn_ea, HWREG_TAG) = (reg << 8) | access bits, to drop stale keys when insn is reanalyzed
+// a 16-bit access is indexed under reg + 1 too, with the same access bits
+
+netnode hwregs_node;
+
+#define HWREG_TAG ('H')
+
+#define HWREG_READ 0x01
+#define HWREG_WRITE 0x02
+#define HWREG_WIDE 0x04 // 16-bit access, touches reg + 1 too
+
+static inline nodeidx_t hwreg_key(uint16_t reg, ea_t insn_ea) {
+  return ((nodeidx_t)reg << 32) | (nodeidx_t)(insn_ea & 0xFFFFFFFF);
+}
+
+uint16_t get_hwreg(ea_t addr) {
+  if (addr == BADADDR) {
+    return 0;
+  }
+
+  uint8_t bank = (uint8_t)(addr >> 16);
+  uint16_t offset = (uint16_t)addr;
+
+  // 40-7F and C0-FF have rom/wram there
+  if (bank & 0x40) {
+    return 0;
+  }
+
+  if ((offset >= 0x2100 && offset <= 0x21FF) || (offset >= 0x4000 && offset <= 0x43FF)) {
+    return offset;
+  }
+
+  // 2200-23FF: SA-1, open bus on the other carts
+  if (offset >= 0x2200 && offset <= 0x23FF && get_coprocessor_type() == (uint32_t)CoprocessorType::SA1) {
+    return offset;
+  }
+
+  // 3000-303F: GSU, it's I-RAM on SA-1
+  if (offset >= 0x3000 && offset <= 0x303F && get_coprocessor_type() == (uint32_t)CoprocessorType::GSU) {
+    return offset;
+  }
+
+  return 0;
+}
+
+static uint16_t get_insn_hwreg(const insn_t& insn, uint8_t* access) {
+  const op_t& x = insn.Op1;
+
+  if (x.type != o_mem) {
+    return 0;
+  }
+
+  ea_t addr;
+
+  switch (static_cast<M>(insn.insnpref)) {
+  case M::Absd:
+  case M::Abx:
+  case M::Aby:
+  case M::Abld:
+  case M::Alx: {
+    addr = x.addr;
+  } break;
+  case M::Dp:
+  case M::Dpx: {
+    // "pea $2100 / pld" makes the direct page point to the PPU registers
+    ea_t dpage = ea_get_dpage(insn.ea);
+
+    if (dpage == BADADDR) {
+      return 0;
+    }
+
+    addr = (dpage + (x.addr & 0xFF)) & 0xFFFF;
+  } break;
+  default:
+    return 0;
+  }
+
+  uint16_t reg = get_hwreg(addr);
+
+  if (reg == 0) {
+    return 0;
+  }
+
+  if (is_rmw_itype(insn.itype)) {
+    *access = HWREG_READ | HWREG_WRITE;
+  }
+  else if (has_insn_feature(insn.itype, CF_CHG1)) {
+    *access = HWREG_WRITE;
+  }
+  else {
+    *access = HWREG_READ;
+  }
+
+  if (get_insn_data_width(insn) == 2) {
+    *access |= HWREG_WIDE;
+  }
+
+  return reg;
+}
+
+void update_hwreg_index(const insn_t& insn) {
+  uint8_t access = 0;
+  uint16_t reg = get_insn_hwreg(insn, &access);
+  ea_t old = helper.eaget(insn.ea, HWREG_TAG);
+  ea_t cur = (reg != 0) ? (((ea_t)reg << 8) | access) : BADADDR;
+
+  if (old == cur) {
+    return;
+  }
+
+  if (old != BADADDR) {
+    hwregs_node.altdel(hwreg_key((uint16_t)(old >> 8), insn.ea), HWREG_TAG);
+
+    if (old & HWREG_WIDE) {
+      hwregs_node.altdel(hwreg_key((uint16_t)(old >> 8) + 1, insn.ea), HWREG_TAG);
+    }
+
+    helper.eadel(insn.ea, HWREG_TAG);
+  }
+
+  if (cur != BADADDR) {
+    hwregs_node.altset(hwreg_key(reg, insn.ea), access, HWREG_TAG);
+
+    if (access & HWREG_WIDE) {
+      hwregs_node.altset(hwreg_key(reg + 1, insn.ea), access, HWREG_TAG);
+    }
+
+    helper.easet(insn.ea, cur, HWREG_TAG);
+  }
+}
+
+bool has_hwreg_write(uint16_t reg) {
+  nodeidx_t last = hwreg_key(reg, 0xFFFFFFFF);
+
+  for (nodeidx_t idx = hwregs_node.altnext(hwreg_key(reg, 0) - 1, HWREG_TAG); idx != BADNODE && idx <= last; idx = hwregs_node.altnext(idx, HWREG_TAG)) {
+    if (hwregs_node.altval(idx, HWREG_TAG) & HWREG_WRITE) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+struct hwreg_row_t {
+  uint16_t reg;
+  uint8_t access;
+  ea_t ea;
+};
+
+static const int hwreg_widths[] = {
+  CHCOL_PLAIN | 12,
+  CHCOL_HEX | 6,
+  CHCOL_PLAIN | 4,
+  CHCOL_DEC | 5,
+  CHCOL_HEX | 8,
+  CHCOL_PLAIN | 32,
+};
+
+static const char* const hwreg_header[] = {
+  "Register", "Reg", "Access", "Width", "Address", "Instruction",
+};
+
+CASSERT(qnumber(hwreg_widths) == qnumber(hwreg_header));
+
+struct hwreg_chooser_t : public chooser_t {
+  qvector<hwreg_row_t> rows;
+  qstring caption;
+
+  hwreg_chooser_t(uint16_t reg, const qstring& _caption) : chooser_t(0, qnumber(hwreg_widths), hwreg_widths, hwreg_header), caption(_caption) {
+    title = caption.c_str();
+
+    // all the keys of one register are contiguous
+    nodeidx_t last = (reg != 0) ? hwreg_key(reg, 0xFFFFFFFF) : BADNODE;
+    nodeidx_t idx = (reg != 0) ? hwregs_node.altnext(hwreg_key(reg, 0) - 1, HWREG_TAG) : hwregs_node.altfirst(HWREG_TAG);
+
+    for (; idx != BADNODE && idx <= last; idx = hwregs_node.altnext(idx, HWREG_TAG)) {
+      hwreg_row_t row;
+      row.reg = (uint16_t)(idx >> 32);
+      row.ea = (ea_t)(idx & 0xFFFFFFFF);
+      row.access = (uint8_t)hwregs_node.altval(idx, HWREG_TAG);
+
+      // undefined instructions don't go through emu anymore
+      ea_t cur = helper.eaget(row.ea, HWREG_TAG);
+      bool wide_high = (row.access & HWREG_WIDE) && cur == ((((ea_t)row.reg - 1) << 8) | row.access);
+
+      if (!is_code(get_flags(row.ea)) || (cur != (((ea_t)row.reg << 8) | row.access) && !wide_high)) {
+        continue;
+      }
+
+      rows.push_back(row);
+    }
+  }
+
+  virtual size_t idaapi get_count() const override {
+    return rows.size();
+  }
+
+  virtual void idaapi get_row(qstrvec_t* cols, int* icon_, chooser_item_attrs_t* attrs, size_t n) const override {
+    const hwreg_row_t& row = rows[n];
+
+    if (get_name(&(*cols)[0], row.reg) <= 0) {
+      (*cols)[0].sprnt("$%04X", row.reg);
+    }
+
+    (*cols)[1].sprnt("%04X", row.reg);
+    (*cols)[2] = (row.access & HWREG_READ) ? ((row.access & HWREG_WRITE) ? "RW" : "R") : "W";
+    (*cols)[3] = (row.access & HWREG_WIDE) ? "16" : "8";
+    (*cols)[4].sprnt("%06a", row.ea);
+    generate_disasm_line(&(*cols)[5], row.ea, GENDSM_REMOVE_TAGS);
+  }
+
+  virtual ea_t idaapi get_ea(size_t n) const override {
+    return rows[n].ea;
+  }
+};
+
+int idaapi hwreg_accesses_action_t::activate(action_activation_ctx_t* ctx) {
+  // the register under the cursor, or the one accessed by the current instruction
+  uint16_t reg = get_hwreg(ctx->cur_ea);
+
+  if (reg == 0 && is_code(get_flags(ctx->cur_ea))) {
+    insn_t insn;
+    uint8_t access;
+
+    if (decode_insn(&insn, ctx->cur_ea) > 0) {
+      reg = get_insn_hwreg(insn, &access);
+    }
+  }
+
+  qstring title;
+
+  if (reg != 0) {
+    qstring name;
+
+    if (get_name(&name, reg) <= 0) {
+      name.sprnt("$%04X", reg);
+    }
+
+    title.sprnt("Accesses of %s", name.c_str());
+  }
+  else {
+    title = "Hardware register accesses";
+  }
+
+  hwreg_chooser_t* ch = new hwreg_chooser_t(reg, title);
+  ch->choose();
+  return 1;
+}
@@ -0,0 +1,515 @@
+#include "65816.hpp"
+#include <kernwin.hpp>
+#include <auto.hpp>
+#include <funcs.hpp>
+#include <segment.hpp>
+#include <atomic>
+#include <algorithm>
+
+// M/X and DB inference over a snapshot of the code segments, done on a worker thread.
+// The worker doesn't touch the database: the results are queued and committed by
+// execute_sync on the main thread, where ana decodes them as usual.
+
+#define INFER_BATCH_SIZE 4096
+#define INFER_NO_DB 0xFFFF
+#define INFER_UNVISITED 0xFF
+#define INFER_STACK_SIZE 4
+
+struct infer_region_t {
+  ea_t start;
+  bytevec_t bytes;
+  bytevec_t visited; // flags of the insn started there, INFER_UNVISITED if not reached
+};
+
+struct infer_mapping_t {
+  ea_t from;
+  ea_t to;
+  asize_t size;
+};
+
+struct infer_item_t {
+  ea_t ea;
+  uint8_t flags;
+  uint16_t db;
+};
+
+struct infer_result_t {
+  ea_t ea;
+  uint8_t flags;
+  uint8_t opcode;
+  uint16_t db;
+};
+
+template<class T>
+static inline const T* find_sorted(const qvector<std::pair<ea_t, T>>& vec, ea_t ea) {
+  auto it = std::lower_bound(vec.begin(), vec.end(), ea, [](const std::pair<ea_t, T>& a, ea_t b) {
+    return a.first < b;
+  });
+
+  return (it != vec.end() && it->first == ea) ? &it->second : nullptr;
+}
+
+struct inference_worker_t : public exec_request_t {
+  // snapshot, read only after start()
+  qvector<infer_region_t> regions;
+  qvector<infer_mapping_t> mappings;
+  qvector<std::pair<ea_t, uint8_t>> manual_flags;
+  qvector<std::pair<ea_t, ea_t>> banks;
+  qvector<infer_item_t> entries;
+  ushort idpflags = 0;
+
+  qthread_t thread = nullptr;
+  std::atomic<bool> cancel{ false };
+
+  // shared with the main thread
+  qmutex_t lock;
+  qvector<infer_result_t> queue;
+  int req_id = -1;
+  bool finished = false;
+
+  // main thread only
+  uint32_t committed = 0;
+  uint32_t seeded = 0;
+  int64 last_report = 0;
+
+  inference_worker_t() : lock(qmutex_create()) {}
+
+  ~inference_worker_t() {
+    qmutex_free(lock);
+  }
+
+  void take_snapshot(ushort _idpflags);
+  bool start();
+  void stop();
+
+  bool running() {
+    qmutex_lock(lock);
+    bool res = !finished;
+    qmutex_unlock(lock);
+    return res;
+  }
+
+  virtual ssize_t idaapi execute() override;
+
+private:
+  static int idaapi thread_proc(void* ud);
+
+  infer_region_t* find_region(ea_t ea, size_t* off);
+  ea_t canon(ea_t ea) const;
+  void run();
+  void walk(infer_item_t start, qvector<infer_item_t>& stack, qvector<infer_result_t>& batch);
+  void push_batch(qvector<infer_result_t>& batch, bool last);
+};
+
+static inference_worker_t* worker = nullptr;
+
+void inference_worker_t::take_snapshot(ushort _idpflags) {
+  idpflags = _idpflags;
+
+  for (segment_t* seg = get_first_seg(); seg != nullptr; seg = get_next_seg(seg->start_ea)) {
+    if (seg->type != SEG_CODE || seg->size() == 0 || is_upd_ea(seg->start_ea)) {
+      continue;
+    }
+
+    infer_region_t& r = regions.push_back();
+    r.start = seg->start_ea;
+    r.bytes.resize((size_t)seg->size());
+    r.visited.resize((size_t)seg->size(), INFER_UNVISITED);
+
+    if (get_bytes(&r.bytes[0], r.bytes.size(), seg->start_ea) != (ssize_t)r.bytes.size()) {
+      regions.pop_back();
+    }
+  }
+
+  std::sort(regions.begin(), regions.end(), [](const infer_region_t& a, const infer_region_t& b) {
+    return a.start < b.start;
+  });
+
+  for (size_t i = 0; i < get_mappings_qty(); ++i) {
+    infer_mapping_t m;
+
+    if (get_mapping(&m.from, &m.to, &m.size, i)) {
+      mappings.push_back(m);
+    }
+  }
+
+  std::sort(mappings.begin(), mappings.end(), [](const infer_mapping_t& a, const infer_mapping_t& b) {
+    return a.from < b.from;
+  });
+
+  for (nodeidx_t idx = helper.charfirst(MANUAL_BITMODE_TAG); idx != BADNODE; idx = helper.charnext(idx, MANUAL_BITMODE_TAG)) {
+    ea_t ea = node2ea(idx);
+
+    if (ea_is_manual_bitmode(ea)) {
+      manual_flags.push_back(std::make_pair(ea, ea_get_flags(ea)));
+    }
+  }
+
+  // the states seen at runtime are kept the same way
+  for (nodeidx_t idx = helper.charfirst(OBSERVED_BITMODE_TAG); idx != BADNODE; idx = helper.charnext(idx, OBSERVED_BITMODE_TAG)) {
+    ea_t ea = node2ea(idx);
+
+    if (ea_is_observed_bitmode(ea) && !ea_is_manual_bitmode(ea)) {
+      manual_flags.push_back(std::make_pair(ea, ea_get_flags(ea)));
+    }
+  }
+
+  for (nodeidx_t idx = helper.supfirst(BANK_TAG); idx != BADNODE; idx = helper.supnext(idx, BANK_TAG)) {
+    ea_t ea = node2ea(idx);
+    ea_t bank = ea_get_bank(ea);
+
+    if (bank != BADADDR) {
+      banks.push_back(std::make_pair(ea, bank));
+    }
+  }
+
+  // netnode keys are ordered, but not necessarily as ea
+  std::sort(manual_flags.begin(), manual_flags.end());
+  std::sort(banks.begin(), banks.end());
+
+  for (size_t i = 0; i < get_func_qty(); ++i) {
+    func_t* pfn = getn_func(i);
+    infer_item_t item = { pfn->start_ea, ea_get_flags(pfn->start_ea), INFER_NO_DB };
+    entries.push_back(item);
+  }
+}
+
+infer_region_t* inference_worker_t::find_region(ea_t ea, size_t* off) {
+  auto it = std::upper_bound(regions.begin(), regions.end(), ea, [](ea_t a, const infer_region_t& b) {
+    return a < b.start;
+  });
+
+  if (it == regions.begin()) {
+    return nullptr;
+  }
+
+  --it;
+
+  if (ea - it->start >= it->bytes.size()) {
+    return nullptr;
+  }
+
+  *off = (size_t)(ea - it->start);
+  return &*it;
+}
+
+// the same as canon_ea, but over the snapshot of the mappings
+ea_t inference_worker_t::canon(ea_t ea) const {
+  auto it = std::upper_bound(mappings.begin(), mappings.end(), ea, [](ea_t a, const infer_mapping_t& b) {
+    return a < b.from;
+  });
+
+  if (it != mappings.begin()) {
+    --it;
+
+    if (ea - it->from < it->size) {
+      return it->to + (ea - it->from);
+    }
+  }
+
+  return ea;
+}
+
+bool inference_worker_t::start() {
+  thread = qthread_create(thread_proc, this);
+  return thread != nullptr;
+}
+
+int idaapi inference_worker_t::thread_proc(void* ud) {
+  ((inference_worker_t*)ud)->run();
+  return 0;
+}
+
+void inference_worker_t::run() {
+  qvector<infer_item_t> stack;
+  qvector<infer_result_t> batch;
+  batch.reserve(INFER_BATCH_SIZE);
+
+  for (size_t i = 0; i < entries.size() && !cancel; ++i) {
+    walk(entries[i], stack, batch);
+  }
+
+  push_batch(batch, true);
+}
+
+void inference_worker_t::walk(infer_item_t start, qvector<infer_item_t>& stack, qvector<infer_result_t>& batch) {
+  stack.push_back(start);
+
+  while (!stack.empty() && !cancel) {
+    infer_item_t item = stack.back();
+    stack.pop_back();
+
+    ea_t ea = item.ea;
+    uint8_t flags = item.flags;
+    uint16_t db = item.db;
+
+    // bytes pushed by the current sequence of insns, -1 if unknown
+    int pushed[INFER_STACK_SIZE];
+    int pushed_count = 0;
+    int lda_imm = -1;
+
+    for (;;) {
+      size_t off;
+      infer_region_t* r = find_region(ea, &off);
+
+      // the first path to reach the insn decides its flags, as in the auto analysis
+      if (r == nullptr || r->visited[off] != INFER_UNVISITED) {
+        break;
+      }
+
+      const uint8_t* manual = find_sorted(manual_flags, ea);
+
+      if (manual != nullptr) {
+        flags = *manual;
+      }
+
+      uint8_t opCode = r->bytes[off];
+
+      if (((idpflags & ROM_NO_BRK) && opCode == 0x00) || ((idpflags & ROM_NO_COP) && opCode == 0x02) || ((idpflags & ROM_NO_WDM) && opCode == 0x42)) {
+        break;
+      }
+
+      M addrMode = m65816_OpMode[opCode];
+      uint8_t opSize = get_op_size(addrMode, flags);
+
+      if (off + opSize > r->bytes.size()) {
+        break;
+      }
+
+      uint32_t opAddr = 0;
+
+      for (uint8_t i = 1; i < opSize; ++i) {
+        opAddr |= (uint32_t)r->bytes[off + i] << (8 * (i - 1));
+      }
+
+      if (opCode == 0xE2) { // SEP
+        flags |= opAddr & (m65816_flags::MemoryMode8 | m65816_flags::IndexMode8);
+      }
+      else if (opCode == 0xC2) { // REP
+        flags &= ~(opAddr & (m65816_flags::MemoryMode8 | m65816_flags::IndexMode8));
+      }
+
+      r->visited[off] = flags;
+
+      infer_result_t res = { ea, flags, opCode, is_data_bank_mode(opCode) ? db : (uint16_t)INFER_NO_DB };
+      batch.push_back(res);
+
+      if (batch.size() >= INFER_BATCH_SIZE) {
+        push_batch(batch, false);
+      }
+
+      // DB is known after "phk / plb", "lda #$xx / pha / plb", "pea $xxxx / plb / plb" and "phb / ... / plb"
+      int prev_lda_imm = lda_imm;
+      lda_imm = -1;
+
+      switch (opCode) {
+      case 0x4B: { // PHK
+        if (pushed_count < INFER_STACK_SIZE) {
+          pushed[pushed_count++] = (int)((ea >> 16) & 0xFF);
+        }
+      } break;
+      case 0x8B: { // PHB
+        if (pushed_count < INFER_STACK_SIZE) {
+          pushed[pushed_count++] = (db != INFER_NO_DB) ? db : -1;
+        }
+      } break;
+      case 0xA9: { // LDA #
+        lda_imm = (flags & m65816_flags::MemoryMode8) ? (int)(opAddr & 0xFF) : -1;
+      } break;
+      case 0x48: { // PHA
+        if ((flags & m65816_flags::MemoryMode8) && pushed_count < INFER_STACK_SIZE) {
+          pushed[pushed_count++] = prev_lda_imm;
+        }
+        else {
+          pushed_count = 0;
+        }
+      } break;
+      case 0xF4: { // PEA
+        if (pushed_count + 2 <= INFER_STACK_SIZE) {
+          pushed[pushed_count++] = (int)((opAddr >> 8) & 0xFF);
+          pushed[pushed_count++] = (int)(opAddr & 0xFF);
+        }
+      } break;
+      case 0xAB: { // PLB
+        int val = (pushed_count > 0) ? pushed[--pushed_count] : -1;
+        db = (val >= 0) ? (uint16_t)val : (uint16_t)INFER_NO_DB;
+      } break;
+      default: {
+        pushed_count = 0;
+      } break;
+      }
+
+      ea_t target = BADADDR;
+      const ea_t* bank = find_sorted(banks, ea);
+
+      switch (addrMode) {
+      case M::Rel: {
+        target = (ea & 0xFF0000) | (((int8_t)opAddr + ea + 2) & 0xFFFF);
+      } break;
+      case M::Rell: {
+        // PER only pushes the address
+        if (opCode != 0x62) {
+          target = (ea & 0xFF0000) | (((int16_t)opAddr + ea + 3) & 0xFFFF);
+        }
+      } break;
+      case M::Absp: {
+        target = (bank != nullptr) ? (*bank | opAddr) : ((ea & 0xFF0000) | opAddr);
+      } break;
+      case M::Ablp: {
+        target = opAddr;
+      } break;
+      default:
+        break;
+      }
+
+      bool is_call = (opCode == 0x20 || opCode == 0x22 || opCode == 0xFC);
+
+      if (target != BADADDR) {
+        // the callee can't rely on the DB of this caller only
+        infer_item_t next = { canon(target), flags, is_call ? (uint16_t)INFER_NO_DB : db };
+        stack.push_back(next);
+      }
+
+      if (is_call) {
+        // ... and it may change it
+        db = INFER_NO_DB;
+        pushed_count = 0;
+      }
+
+      bool is_stop = false;
+
+      switch (opCode) {
+      case 0x80: // BRA
+      case 0x82: // BRL
+      case 0x4C: // JMP
+      case 0x6C: // JMP ()
+      case 0x7C: // JMP (,X)
+      case 0x5C: // JML
+      case 0xDC: // JML []
+      case 0x40: // RTI
+      case 0x60: // RTS
+      case 0x6B: // RTL
+      case 0xDB: // STP
+        is_stop = true;
+        break;
+      }
+
+      if (is_stop) {
+        break;
+      }
+
+      ea += opSize;
+    }
+  }
+}
+
+void inference_worker_t::push_batch(qvector<infer_result_t>& batch, bool last) {
+  qmutex_lock(lock);
+
+  queue.insert(queue.end(), batch.begin(), batch.end());
+  batch.qclear();
+
+  if (last) {
+    finished = true;
+  }
+
+  // the main thread takes everything queued so far at once
+  if (req_id == -1) {
+    req_id = execute_sync(*this, MFF_WRITE | MFF_NOWAIT);
+  }
+
+  qmutex_unlock(lock);
+}
+
+ssize_t idaapi inference_worker_t::execute() {
+  qvector<infer_result_t> results;
+
+  qmutex_lock(lock);
+  results.swap(queue);
+  req_id = -1;
+  bool done = finished;
+  qmutex_unlock(lock);
+
+  for (size_t i = 0; i < results.size(); ++i) {
+    const infer_result_t& res = results[i];
+    flags64_t F = get_flags(res.ea);
+
+    // already analyzed insns keep the flags ana has propagated
+    if (!is_code(F) && !is_tail(F) && !ea_is_fixed_bitmode(res.ea) && ea_get_flags(res.ea) != res.flags) {
+      ea_set_flags(res.ea, res.flags);
+    }
+
+    // DB the same way, and never over a bank set by the user
+    if (!is_code(F) && !is_tail(F) && res.db != INFER_NO_DB && res.db != 0x00 && ea_get_bank(res.ea) == BADADDR && is_data_bank_mode(res.opcode)) {
+      ea_set_bank(res.ea, (ea_t)res.db << 16);
+      seeded++;
+    }
+
+    if (!is_code(F)) {
+      auto_make_code(res.ea);
+    }
+  }
+
+  committed += (uint32_t)results.size();
+
+  int64 now = qtime64();
+
+  if (done) {
+    msg("M/X inference: %u instructions, %u data banks%s\n", committed, seeded, cancel ? " (cancelled)" : "");
+  }
+  else if (now - last_report >= 1000000) {
+    msg("M/X inference: %u instructions so far...\n", committed);
+    last_report = now;
+  }
+
+  return 0;
+}
+
+void inference_worker_t::stop() {
+  cancel = true;
+
+  if (thread != nullptr) {
+    qthread_join(thread);
+    qthread_free(thread);
+    thread = nullptr;
+  }
+
+  // the last batch is dropped, the thread can't post anymore
+  if (req_id != -1) {
+    cancel_exec_request(req_id);
+    req_id = -1;
+  }
+}
+
+void stop_inference() {
+  if (worker != nullptr) {
+    worker->stop();
+    delete worker;
+    worker = nullptr;
+  }
+}
+
+int idaapi infer_background_action_t::activate(action_activation_ctx_t* ctx) {
+  if (worker != nullptr && worker->running()) {
+    msg("M/X inference: cancelling...\n");
+    stop_inference();
+    return 1;
+  }
+
+  stop_inference();
+
+  worker = new inference_worker_t();
+
+  show_wait_box("Taking a snapshot of the code segments...");
+  worker->take_snapshot(*idpflags);
+  hide_wait_box();
+
+  if (!worker->start()) {
+    warning("Can't start the inference thread");
+    stop_inference();
+    return 1;
+  }
+
+  msg("M/X inference: started from %u functions\n", (uint32_t)worker->entries.size());
+  return 1;
+}
@@ -93,7 +93,14 @@ const instruc_t Instructions[] = {
   { "WAI",        0                               },      // Wait for interrupt
   { "WDM",        0                               },      // Reserved
   { "XBA",        0                               },      // Exchange A's bytes
-  { "XCE",        0                               }       // Exchange carry & emu bits
+  { "XCE",        0                               },      // Exchange carry & emu bits
+  { "OP",         0                               },      // ALU, IDB <- src, dst <- IDB
+  { "RT",         CF_STOP                         },      // OP, PC <- (Stack)
+  { "LD",         CF_USE1 | CF_CHG2               },      // dst <- imm
+  { "JMP",        CF_USE1 | CF_STOP               },      // PC <- Address
+  { "CALL",       CF_USE1 | CF_CALL               },      // Stack <- PC, PC <- Address
+  { "JMPSO",      CF_STOP | CF_JUMP               },      // PC <- SO
+  { "JCC",        CF_USE1                         }       // if cond, PC <- Address
 };
 
 CASSERT(qnumber(Instructions) == M65816_last);
\ No newline at end of file
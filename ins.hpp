@@ -96,5 +96,12 @@ enum m65816_opcode : uint16_t {
   M65816_wdm,    // Reserved
   M65816_xba,    // Exchange bytes in A
   M65816_xce,    // Exchange carry and emulation bits
+  UPD_op,        // uPD77C25/uPD96050 ALU op and move
+  UPD_rt,        // ALU op and move, then return
+  UPD_ld,        // Load immediate
+  UPD_jmp,       // Jump
+  UPD_call,      // Call
+  UPD_jmpso,     // Jump to SO
+  UPD_jcc,       // Conditional jump
   M65816_last
 };
@@ -0,0 +1,117 @@
+#include "mapped_file.hpp"
+
+#ifdef __NT__
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __NT__
+bool mapped_file_t::open(const char* path) {
+  close();
+
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  LARGE_INTEGER size;
+
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+  if (mapping == nullptr) {
+    CloseHandle(file);
+    return false;
+  }
+
+  void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+  if (view == nullptr) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+
+  _file = file;
+  _mapping = mapping;
+  _data = (const uint8_t*)view;
+  _size = (uint64_t)size.QuadPart;
+
+  return true;
+}
+
+void mapped_file_t::close() {
+  if (_data != nullptr) {
+    UnmapViewOfFile(_data);
+  }
+
+  if (_mapping != nullptr) {
+    CloseHandle((HANDLE)_mapping);
+  }
+
+  if (_file != nullptr) {
+    CloseHandle((HANDLE)_file);
+  }
+
+  _data = nullptr;
+  _mapping = nullptr;
+  _file = nullptr;
+  _size = 0;
+}
+#else
+bool mapped_file_t::open(const char* path) {
+  close();
+
+  int fd = ::open(path, O_RDONLY);
+
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+
+  void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (view == MAP_FAILED) {
+    ::close(fd);
+    return false;
+  }
+
+  madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+  _fd = fd;
+  _data = (const uint8_t*)view;
+  _size = (uint64_t)st.st_size;
+
+  return true;
+}
+
+void mapped_file_t::close() {
+  if (_data != nullptr) {
+    munmap((void*)_data, (size_t)_size);
+  }
+
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+
+  _data = nullptr;
+  _fd = -1;
+  _size = 0;
+}
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Read-only memory mapped file, used by the importers to avoid reading huge logs into memory
+class mapped_file_t {
+public:
+	mapped_file_t() = default;
+	mapped_file_t(const mapped_file_t&) = delete;
+	mapped_file_t& operator=(const mapped_file_t&) = delete;
+
+	~mapped_file_t() {
+		close();
+	}
+
+	bool open(const char* path);
+	void close();
+
+	const uint8_t* data() const {
+		return _data;
+	}
+
+	uint64_t size() const {
+		return _size;
+	}
+
+private:
+	const uint8_t* _data = nullptr;
+	uint64_t _size = 0;
+
+#ifdef __NT__
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#else
+	int _fd = -1;
+#endif
+};
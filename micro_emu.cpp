@@ -0,0 +1,1060 @@
+#include "65816.hpp"
+#include "trace.hpp"
+#include "ram_image.hpp"
+#include <bytes.hpp>
+#include <segment.hpp>
+#include <kernwin.hpp>
+#include <funcs.hpp>
+#include <name.hpp>
+#include <algorithm>
+#include <memory>
+
+// A small 65816 interpreter for the reset and init code. The 24-bit bus is a flat buffer whose 4KB pages
+// are read from the database on first touch through the loader's mirror mappings, so the mirrors of a page
+// share its bytes. There's no PPU: the registers init code polls answer like a running console and NMIs
+// come once a frame while they're enabled. The CPU state at the call targets and indirect jumps is
+// recorded like a trace log and applied to the database in one batch.
+
+#define EMU_BUS_SIZE 0x1000000
+#define EMU_PAGE_SHIFT 12
+#define EMU_PAGE_SIZE (1 << EMU_PAGE_SHIFT)
+#define EMU_PAGE_COUNT (EMU_BUS_SIZE >> EMU_PAGE_SHIFT)
+#define EMU_PAGE_UNMAPPED 0xFFFFFFFF // not touched yet
+#define EMU_PAGE_IO 0xFFFFFFFE // 2000-5FFF of banks 00-3F/80-BF
+
+#define EMU_PAGE_LOADED 0x01
+#define EMU_PAGE_WRITABLE 0x02
+
+#define EMU_DEFAULT_CYCLES 5000000
+#define EMU_FRAME_CYCLES 59561 // 1364 * 262 master clocks at 6 per cycle
+#define EMU_CANCEL_STEP 0x10000 // insns between the cancel checks
+
+enum emu_stop_t : uint8_t {
+  EMU_RUNNING,
+  EMU_BUDGET,
+  EMU_STP,
+  EMU_WAI,
+  EMU_BRK,
+  EMU_CANCELLED,
+  EMU_RETURNED,
+};
+
+static const char* const emu_stop_names[] = {
+  "running", "cycle budget spent", "STP", "WAI with NMI disabled", "BRK/COP", "cancelled", "returned",
+};
+
+// B bus offsets of the DMA transfer modes, 4 bytes per unit at most
+static const uint8_t dma_patterns[8][4] = {
+  { 0, 0, 0, 0 }, { 0, 1, 0, 1 }, { 0, 0, 0, 0 }, { 0, 0, 1, 1 },
+  { 0, 1, 2, 3 }, { 0, 1, 0, 1 }, { 0, 0, 0, 0 }, { 0, 0, 1, 1 },
+};
+
+struct micro_emu_t {
+  uint16_t a = 0;
+  uint16_t x = 0;
+  uint16_t y = 0;
+  uint16_t s = 0x1FF;
+  uint16_t d = 0;
+  uint16_t pc = 0;
+  uint8_t k = 0;
+  uint8_t db = 0;
+  uint8_t p = m65816_flags::MemoryMode8 | m65816_flags::IndexMode8 | m65816_flags::IrqDisable;
+  bool e = true;
+
+  bytevec_t mem; // by canonical address
+  qvector<uint32_t> pages; // canonical base of each bus page or EMU_PAGE_*
+  bytevec_t page_flags; // EMU_PAGE_* flags of the canonical pages
+
+  uint8_t io[0x4000] = {}; // the last values written to 2000-5FFF
+  uint16_t m7a = 0;
+  uint8_t m7_latch = 0;
+  uint32_t wram_addr = 0;
+  uint8_t polls = 0; // status bits flip on each read so the wait loops on both edges end
+
+  uint64_t cycles = 0;
+  uint64_t next_frame = EMU_FRAME_CYCLES;
+  uint64_t insns = 0;
+  emu_stop_t stop = EMU_RUNNING;
+
+  bool keep_wram = false; // code run from RAM is only recorded if its bytes go to the database
+  bool nmis = true;
+  uint16_t stack_top = 0; // a routine run alone returns when the stack goes above it
+  uint16_t stack_low = 0xFFFF; // the lowest address pushed to
+  bytevec_t wram_written; // a byte per WRAM byte when its writes are captured
+  trace_chunk_t res;
+
+  micro_emu_t() {
+    mem.resize(EMU_BUS_SIZE, 0);
+    pages.resize(EMU_PAGE_COUNT, EMU_PAGE_UNMAPPED);
+    page_flags.resize(EMU_PAGE_COUNT, 0);
+
+    // the IPL ROM of the SPC700 waits with AA BB on the first ports
+    io[0x2140 - 0x2000] = 0xAA;
+    io[0x2141 - 0x2000] = 0xBB;
+  }
+
+  uint32_t map_page(uint32_t page) {
+    uint32_t addr = page << EMU_PAGE_SHIFT;
+    uint8_t bank = (uint8_t)(addr >> 16);
+    uint16_t offset = (uint16_t)addr;
+
+    if ((bank & 0x40) == 0 && offset >= 0x2000 && offset < 0x6000) {
+      return pages[page] = EMU_PAGE_IO;
+    }
+
+    ea_t ea = canon_ea(addr);
+    uint32_t base = (ea < EMU_BUS_SIZE) ? ((uint32_t)ea & ~(EMU_PAGE_SIZE - 1)) : addr;
+    uint8_t& flags = page_flags[base >> EMU_PAGE_SHIFT];
+
+    if ((flags & EMU_PAGE_LOADED) == 0) {
+      flags |= EMU_PAGE_LOADED;
+      segment_t* seg = getseg(base);
+
+      if (seg != nullptr) {
+        get_bytes(&mem[base], EMU_PAGE_SIZE, base, GMB_READALL);
+
+        if (seg->perm & SEGPERM_WRITE) {
+          flags |= EMU_PAGE_WRITABLE;
+        }
+      }
+    }
+
+    return pages[page] = base;
+  }
+
+  uint32_t get_page(uint32_t addr) {
+    uint32_t base = pages[addr >> EMU_PAGE_SHIFT];
+    return (base == EMU_PAGE_UNMAPPED) ? map_page(addr >> EMU_PAGE_SHIFT) : base;
+  }
+
+  uint8_t read8(uint32_t addr) {
+    addr &= EMU_BUS_SIZE - 1;
+    uint32_t base = get_page(addr);
+
+    if (base == EMU_PAGE_IO) {
+      return read_io((uint16_t)addr);
+    }
+
+    return mem[base | (addr & (EMU_PAGE_SIZE - 1))];
+  }
+
+  void write8(uint32_t addr, uint8_t value) {
+    addr &= EMU_BUS_SIZE - 1;
+    uint32_t base = get_page(addr);
+
+    if (base == EMU_PAGE_IO) {
+      write_io((uint16_t)addr, value);
+    }
+    else if (page_flags[base >> EMU_PAGE_SHIFT] & EMU_PAGE_WRITABLE) {
+      uint32_t phys = base | (addr & (EMU_PAGE_SIZE - 1));
+      mem[phys] = value;
+
+      if (!wram_written.empty() && phys >= WRAM_EA && phys < WRAM_EA + WRAM_SIZE) {
+        wram_written[phys - WRAM_EA] = 1;
+      }
+    }
+  }
+
+  uint16_t read16(uint32_t addr) {
+    return read8(addr) | (read8(addr + 1) << 8);
+  }
+
+  uint32_t read24(uint32_t addr) {
+    return read16(addr) | (read8(addr + 2) << 16);
+  }
+
+  bool poll(int bit) {
+    polls ^= 1 << bit;
+    return (polls >> bit) & 1;
+  }
+
+  uint8_t read_io(uint16_t reg) {
+    if (reg >= 0x2140 && reg < 0x2180) {
+      // the SPC700 echoes the ports, which is what the upload handshakes wait for
+      return io[(0x2140 | (reg & 3)) - 0x2000];
+    }
+
+    switch (reg) {
+    case 0x2180: { // WMDATA
+      uint8_t value = read8(WRAM_EA + wram_addr);
+      wram_addr = (wram_addr + 1) & (WRAM_SIZE - 1);
+      return value;
+    }
+    case 0x4016:
+    case 0x4017: {
+      return 0; // no buttons
+    }
+    case 0x4210: { // RDNMI, CPU version 2
+      return (poll(0) ? 0x80 : 0) | 0x02;
+    }
+    case 0x4211: { // TIMEUP
+      return poll(1) ? 0x80 : 0;
+    }
+    case 0x4212: { // HVBJOY, the auto joypad read is never busy
+      return poll(2) ? 0xC0 : 0;
+    }
+    default: {
+      return io[reg - 0x2000];
+    }
+    }
+  }
+
+  void write_io(uint16_t reg, uint8_t value) {
+    if (reg >= 0x2140 && reg < 0x2180) {
+      reg = 0x2140 | (reg & 3);
+    }
+
+    io[reg - 0x2000] = value;
+
+    switch (reg) {
+    case 0x211B: { // M7A, written low then high
+      m7a = (uint16_t)((value << 8) | m7_latch);
+      m7_latch = value;
+    } break;
+    case 0x211C: { // M7B, the PPU multiplies M7A by its last byte into MPYL/M/H
+      int32_t product = (int16_t)m7a * (int8_t)value;
+      io[0x2134 - 0x2000] = (uint8_t)product;
+      io[0x2135 - 0x2000] = (uint8_t)(product >> 8);
+      io[0x2136 - 0x2000] = (uint8_t)(product >> 16);
+      m7_latch = value;
+    } break;
+    case 0x2180: { // WMDATA
+      write8(WRAM_EA + wram_addr, value);
+      wram_addr = (wram_addr + 1) & (WRAM_SIZE - 1);
+    } break;
+    case 0x2181: {
+      wram_addr = (wram_addr & 0x1FF00) | value;
+    } break;
+    case 0x2182: {
+      wram_addr = (wram_addr & 0x100FF) | (value << 8);
+    } break;
+    case 0x2183: {
+      wram_addr = (wram_addr & 0xFFFF) | ((value & 1) << 16);
+    } break;
+    case 0x4203: { // WRMPYB
+      uint16_t product = io[0x4202 - 0x2000] * value;
+      io[0x4216 - 0x2000] = (uint8_t)product;
+      io[0x4217 - 0x2000] = (uint8_t)(product >> 8);
+    } break;
+    case 0x4206: { // WRDIVB
+      uint16_t dividend = io[0x4204 - 0x2000] | (io[0x4205 - 0x2000] << 8);
+      uint16_t quotient = (value != 0) ? dividend / value : 0xFFFF;
+      uint16_t remainder = (value != 0) ? dividend % value : dividend;
+      io[0x4214 - 0x2000] = (uint8_t)quotient;
+      io[0x4215 - 0x2000] = (uint8_t)(quotient >> 8);
+      io[0x4216 - 0x2000] = (uint8_t)remainder;
+      io[0x4217 - 0x2000] = (uint8_t)(remainder >> 8);
+    } break;
+    case 0x420B: { // MDMAEN
+      run_dma(value);
+    } break;
+    }
+  }
+
+  // general purpose DMA, the B bus side only reaches the registers emulated here (WRAM port, APU ports)
+  void run_dma(uint8_t channels) {
+    for (int ch = 0; ch < 8; ++ch) {
+      if ((channels & (1 << ch)) == 0) {
+        continue;
+      }
+
+      uint8_t* regs = &io[0x4300 + ch * 0x10 - 0x2000];
+      uint8_t ctrl = regs[0];
+      uint16_t src = regs[2] | (regs[3] << 8);
+      uint32_t count = regs[5] | (regs[6] << 8);
+
+      if (count == 0) {
+        count = 0x10000;
+      }
+
+      for (uint32_t i = 0; i < count; ++i) {
+        uint32_t a_addr = ((uint32_t)regs[4] << 16) | src;
+        uint16_t b_addr = 0x2100 | (uint8_t)(regs[1] + dma_patterns[ctrl & 7][i & 3]);
+
+        if (ctrl & 0x80) {
+          write8(a_addr, read8(b_addr));
+        }
+        else {
+          write8(b_addr, read8(a_addr));
+        }
+
+        if ((ctrl & 0x08) == 0) {
+          src += (ctrl & 0x10) ? -1 : 1;
+        }
+      }
+
+      regs[2] = (uint8_t)src;
+      regs[3] = (uint8_t)(src >> 8);
+      regs[5] = regs[6] = 0;
+
+      // 8 master clocks a byte
+      cycles += count * 8 / 6;
+    }
+  }
+
+  bool m8() const {
+    return (p & m65816_flags::MemoryMode8) != 0;
+  }
+
+  bool x8() const {
+    return (p & m65816_flags::IndexMode8) != 0;
+  }
+
+  uint32_t cur_pc() const {
+    return ((uint32_t)k << 16) | pc;
+  }
+
+  uint32_t data_addr(uint16_t addr) const {
+    return ((uint32_t)db << 16) | addr;
+  }
+
+  uint32_t code_addr(uint16_t addr) const {
+    return ((uint32_t)k << 16) | addr;
+  }
+
+  uint8_t fetch8() {
+    uint8_t value = read8(cur_pc());
+    pc++;
+    return value;
+  }
+
+  uint16_t fetch16() {
+    uint16_t value = fetch8();
+    return value | (fetch8() << 8);
+  }
+
+  uint32_t fetch24() {
+    uint32_t value = fetch16();
+    return value | (fetch8() << 16);
+  }
+
+  void push8(uint8_t value) {
+    stack_low = std::min(stack_low, s);
+    write8(s, value);
+    s = e ? (0x100 | (uint8_t)(s - 1)) : (uint16_t)(s - 1);
+  }
+
+  uint8_t pull8() {
+    s = e ? (0x100 | (uint8_t)(s + 1)) : (uint16_t)(s + 1);
+    return read8(s);
+  }
+
+  void push16(uint16_t value) {
+    push8((uint8_t)(value >> 8));
+    push8((uint8_t)value);
+  }
+
+  uint16_t pull16() {
+    uint16_t value = pull8();
+    return value | (pull8() << 8);
+  }
+
+  void set_nz(uint16_t value, bool wide) {
+    setflag(p, (uint8_t)m65816_flags::Zero, (wide ? value : (uint8_t)value) == 0);
+    setflag(p, (uint8_t)m65816_flags::Negative, (value & (wide ? 0x8000 : 0x80)) != 0);
+  }
+
+  // the emulation mode forces 8-bit M/X, 8-bit indexes drop their high byte
+  void update_p() {
+    if (e) {
+      p |= m65816_flags::MemoryMode8 | m65816_flags::IndexMode8;
+    }
+
+    if (x8()) {
+      x &= 0xFF;
+      y &= 0xFF;
+    }
+  }
+
+  void set_a(uint16_t value) {
+    a = m8() ? (uint16_t)((a & 0xFF00) | (value & 0xFF)) : value;
+    set_nz(value, !m8());
+  }
+
+  void set_index(uint16_t* reg, uint16_t value) {
+    *reg = x8() ? (value & 0xFF) : value;
+    set_nz(value, !x8());
+  }
+
+  // ADC/SBC, the decimal mode adjusts nibble by nibble like bsnes
+  void add_sub(uint16_t data, bool sub) {
+    bool wide = !m8();
+    int nibbles = wide ? 4 : 2;
+    int32_t mask = wide ? 0xFFFF : 0xFF;
+    int32_t acc = a & mask;
+    int32_t operand = (sub ? ~data : data) & mask;
+    int32_t carry = (p & m65816_flags::Carry) ? 1 : 0;
+    int32_t result = 0;
+    bool decimal = (p & m65816_flags::Decimal) != 0;
+
+    if (!decimal) {
+      result = acc + operand + carry;
+    }
+    else {
+      for (int i = 0; i < nibbles; ++i) {
+        int shift = i * 4;
+        int32_t limit = (0x10 << shift) - 1;
+
+        result = (acc & (0xF << shift)) + (operand & (0xF << shift)) + (carry << shift) + (result & ((1 << shift) - 1));
+
+        if (i + 1 == nibbles) {
+          break;
+        }
+
+        if (!sub && result > (0xA << shift) - 1) {
+          result += 6 << shift;
+        }
+        else if (sub && result <= limit) {
+          result -= 6 << shift;
+        }
+
+        carry = result > limit ? 1 : 0;
+      }
+    }
+
+    setflag(p, (uint8_t)m65816_flags::Overflow, (~(acc ^ operand) & (acc ^ result) & (wide ? 0x8000 : 0x80)) != 0);
+
+    if (decimal) {
+      int shift = nibbles * 4 - 4;
+
+      if (!sub && result > (0xA << shift) - 1) {
+        result += 6 << shift;
+      }
+      else if (sub && result <= mask) {
+        result -= 6 << shift;
+      }
+    }
+
+    setflag(p, (uint8_t)m65816_flags::Carry, result > mask);
+    set_a((uint16_t)(result & mask));
+  }
+
+  void compare(uint16_t reg, uint16_t value, bool wide) {
+    uint16_t mask = wide ? 0xFFFF : 0xFF;
+    setflag(p, (uint8_t)m65816_flags::Carry, (reg & mask) >= (value & mask));
+    set_nz((uint16_t)((reg - value) & mask), wide);
+  }
+
+  // ASL/LSR/ROL/ROR/INC/DEC
+  uint16_t modify(uint16_t itype, uint16_t value, bool wide) {
+    uint16_t mask = wide ? 0xFFFF : 0xFF;
+    uint16_t msb = wide ? 0x8000 : 0x80;
+    bool carry = (p & m65816_flags::Carry) != 0;
+
+    value &= mask;
+
+    switch (itype) {
+    case M65816_asl: {
+      setflag(p, (uint8_t)m65816_flags::Carry, (value & msb) != 0);
+      value = (value << 1) & mask;
+    } break;
+    case M65816_lsr: {
+      setflag(p, (uint8_t)m65816_flags::Carry, (value & 1) != 0);
+      value >>= 1;
+    } break;
+    case M65816_rol: {
+      setflag(p, (uint8_t)m65816_flags::Carry, (value & msb) != 0);
+      value = ((value << 1) | (carry ? 1 : 0)) & mask;
+    } break;
+    case M65816_ror: {
+      setflag(p, (uint8_t)m65816_flags::Carry, (value & 1) != 0);
+      value = (value >> 1) | (carry ? msb : 0);
+    } break;
+    case M65816_inc: {
+      value = (value + 1) & mask;
+    } break;
+    case M65816_dec: {
+      value = (value - 1) & mask;
+    } break;
+    }
+
+    set_nz(value, wide);
+    return value;
+  }
+
+  trace_rec_t* record(uint32_t addr) {
+    addr &= EMU_BUS_SIZE - 1;
+    uint32_t base = get_page(addr);
+
+    if (base == EMU_PAGE_IO || (!keep_wram && (page_flags[base >> EMU_PAGE_SHIFT] & EMU_PAGE_WRITABLE))) {
+      return nullptr;
+    }
+
+    trace_rec_t& rec = res.recs[addr];
+    rec.modes |= m8() ? TRACE_M8 : TRACE_M16;
+    rec.modes |= x8() ? TRACE_X8 : TRACE_X16;
+    rec.set_db(db);
+    rec.set_d(d);
+    return &rec;
+  }
+
+  // the jump is done, M/X, D and DB are still those of the jump
+  void record_indirect(uint32_t from, uint8_t kind) {
+    trace_rec_t* rec = record(from);
+
+    if (rec != nullptr && record(cur_pc()) != nullptr) {
+      rec->modes |= kind;
+      res.targets.insert(((uint64_t)from << 24) | cur_pc());
+    }
+  }
+
+  void interrupt(uint16_t native_vector, uint16_t emu_vector) {
+    if (!e) {
+      push8(k);
+    }
+
+    push16(pc);
+    push8(p);
+
+    p |= m65816_flags::IrqDisable;
+    p &= ~m65816_flags::Decimal;
+    k = 0;
+    pc = read16(e ? emu_vector : native_vector);
+
+    record(cur_pc());
+  }
+
+  bool nmi_enabled() const {
+    return nmis && (io[0x4200 - 0x2000] & 0x80) != 0;
+  }
+
+  void check_return() {
+    if (stack_top != 0 && s > stack_top) {
+      stop = EMU_RETURNED;
+    }
+  }
+
+  void step() {
+    uint32_t op_pc = cur_pc();
+    uint8_t op = fetch8();
+    M mode = m65816_OpMode[op];
+    uint16_t itype = itype2opcode[op];
+    bool wide;
+
+    switch (itype) {
+    case M65816_ldx:
+    case M65816_ldy:
+    case M65816_stx:
+    case M65816_sty:
+    case M65816_cpx:
+    case M65816_cpy:
+      wide = !x8();
+      break;
+    default:
+      wide = !m8();
+      break;
+    }
+
+    cycles += m65816_OpCycles[op];
+
+    // operand address (or value) by the addressing mode of the opcode
+    uint32_t ea = 0;
+    uint16_t value = 0;
+    bool imm = false;
+
+    switch (mode) {
+    case M::Im8: value = fetch8(); imm = true; break;
+    case M::Imm:
+    case M::Imx: value = wide ? fetch16() : fetch8(); imm = true; break;
+    case M::Sr: ea = (uint16_t)(s + fetch8()); break;
+    case M::Dp:
+    case M::Dps: ea = (uint16_t)(d + fetch8()); break;
+    case M::Dpx: ea = (uint16_t)(d + fetch8() + x); break;
+    case M::Dpy: ea = (uint16_t)(d + fetch8() + y); break;
+    case M::Idp: ea = data_addr(read16((uint16_t)(d + fetch8()))); break;
+    case M::Idx: ea = data_addr(read16((uint16_t)(d + fetch8() + x))); break;
+    case M::Idy: ea = data_addr(read16((uint16_t)(d + fetch8()))) + y; break;
+    case M::Idl: ea = read24((uint16_t)(d + fetch8())); break;
+    case M::Idly: ea = read24((uint16_t)(d + fetch8())) + y; break;
+    case M::Isy: ea = data_addr(read16((uint16_t)(s + fetch8()))) + y; break;
+    case M::Absd: ea = data_addr(fetch16()); break;
+    case M::Abx: ea = data_addr(fetch16()) + x; break;
+    case M::Aby: ea = data_addr(fetch16()) + y; break;
+    case M::Absp: ea = code_addr(fetch16()); break;
+    case M::Ablp:
+    case M::Abld: ea = fetch24(); break;
+    case M::Alx: ea = fetch24() + x; break;
+    case M::Ind: ea = code_addr(read16(fetch16())); break;
+    case M::Iax: {
+      uint16_t ptr = fetch16();
+      ea = code_addr(read16(code_addr((uint16_t)(ptr + x))));
+    } break;
+    case M::Ial: ea = read24(fetch16()); break;
+    case M::Rel: {
+      int8_t rel = (int8_t)fetch8();
+      ea = code_addr((uint16_t)(pc + rel));
+    } break;
+    case M::Rell: {
+      int16_t rel = (int16_t)fetch16();
+      ea = code_addr((uint16_t)(pc + rel));
+    } break;
+    case M::Bm: value = fetch16(); break; // destination bank, source bank
+    default: break;
+    }
+
+    ea &= EMU_BUS_SIZE - 1;
+
+    auto load = [&]() -> uint16_t {
+      return imm ? value : (wide ? read16(ea) : read8(ea));
+    };
+
+    auto store = [&](uint16_t v) {
+      write8(ea, (uint8_t)v);
+
+      if (wide) {
+        write8(ea + 1, (uint8_t)(v >> 8));
+      }
+    };
+
+    auto branch = [&](bool cond) {
+      if (cond) {
+        pc = (uint16_t)ea;
+        cycles++;
+      }
+    };
+
+    switch (itype) {
+    case M65816_adc: add_sub(load(), false); break;
+    case M65816_sbc: add_sub(load(), true); break;
+    case M65816_and: set_a(a & load()); break;
+    case M65816_ora: set_a(a | load()); break;
+    case M65816_eor: set_a(a ^ load()); break;
+    case M65816_cmp: compare(a, load(), wide); break;
+    case M65816_cpx: compare(x, load(), wide); break;
+    case M65816_cpy: compare(y, load(), wide); break;
+    case M65816_bit: {
+      uint16_t v = load();
+      setflag(p, (uint8_t)m65816_flags::Zero, (a & v & (wide ? 0xFFFF : 0xFF)) == 0);
+
+      if (!imm) {
+        setflag(p, (uint8_t)m65816_flags::Negative, (v & (wide ? 0x8000 : 0x80)) != 0);
+        setflag(p, (uint8_t)m65816_flags::Overflow, (v & (wide ? 0x4000 : 0x40)) != 0);
+      }
+    } break;
+    case M65816_tsb:
+    case M65816_trb: {
+      uint16_t v = load();
+      setflag(p, (uint8_t)m65816_flags::Zero, (a & v & (wide ? 0xFFFF : 0xFF)) == 0);
+      store(itype == M65816_tsb ? (v | a) : (v & ~a));
+    } break;
+    case M65816_asl:
+    case M65816_lsr:
+    case M65816_rol:
+    case M65816_ror:
+    case M65816_inc:
+    case M65816_dec: {
+      if (mode == M::Regs) {
+        set_a(modify(itype, a, wide));
+      }
+      else {
+        store(modify(itype, load(), wide));
+      }
+    } break;
+    case M65816_lda: set_a(load()); break;
+    case M65816_ldx: set_index(&x, load()); break;
+    case M65816_ldy: set_index(&y, load()); break;
+    case M65816_sta: store(a); break;
+    case M65816_stx: store(x); break;
+    case M65816_sty: store(y); break;
+    case M65816_stz: store(0); break;
+    case M65816_inx: set_index(&x, x + 1); break;
+    case M65816_iny: set_index(&y, y + 1); break;
+    case M65816_dex: set_index(&x, x - 1); break;
+    case M65816_dey: set_index(&y, y - 1); break;
+    case M65816_tax: set_index(&x, a); break;
+    case M65816_tay: set_index(&y, a); break;
+    case M65816_tsx: set_index(&x, s); break;
+    case M65816_txy: set_index(&y, x); break;
+    case M65816_tyx: set_index(&x, y); break;
+    case M65816_txa: set_a(x); break;
+    case M65816_tya: set_a(y); break;
+    case M65816_txs: s = e ? (0x100 | (x & 0xFF)) : x; break;
+    case M65816_tcs: s = e ? (0x100 | (a & 0xFF)) : a; break;
+    case M65816_tsc: a = s; set_nz(a, true); break;
+    case M65816_tcd: d = a; set_nz(d, true); break;
+    case M65816_tdc: a = d; set_nz(a, true); break;
+    case M65816_xba: {
+      a = (uint16_t)((a >> 8) | (a << 8));
+      set_nz(a & 0xFF, false);
+    } break;
+    case M65816_pha: if (m8()) push8((uint8_t)a); else push16(a); break;
+    case M65816_phx: if (x8()) push8((uint8_t)x); else push16(x); break;
+    case M65816_phy: if (x8()) push8((uint8_t)y); else push16(y); break;
+    case M65816_php: push8(p); break;
+    case M65816_phb: push8(db); break;
+    case M65816_phk: push8(k); break;
+    case M65816_phd: push16(d); break;
+    case M65816_pea: push16((uint16_t)ea); break;
+    case M65816_pei: push16(read16(ea)); break;
+    case M65816_per: push16((uint16_t)ea); break;
+    case M65816_pla: set_a(m8() ? pull8() : pull16()); break;
+    case M65816_plx: set_index(&x, x8() ? pull8() : pull16()); break;
+    case M65816_ply: set_index(&y, x8() ? pull8() : pull16()); break;
+    case M65816_plp: p = pull8(); update_p(); break;
+    case M65816_plb: db = pull8(); set_nz(db, false); break;
+    case M65816_pld: d = pull16(); set_nz(d, true); break;
+    case M65816_clc: p &= ~m65816_flags::Carry; break;
+    case M65816_sec: p |= m65816_flags::Carry; break;
+    case M65816_cli: p &= ~m65816_flags::IrqDisable; break;
+    case M65816_sei: p |= m65816_flags::IrqDisable; break;
+    case M65816_cld: p &= ~m65816_flags::Decimal; break;
+    case M65816_sed: p |= m65816_flags::Decimal; break;
+    case M65816_clv: p &= ~m65816_flags::Overflow; break;
+    case M65816_rep: p &= ~value; update_p(); break;
+    case M65816_sep: p |= value; update_p(); break;
+    case M65816_xce: {
+      bool carry = (p & m65816_flags::Carry) != 0;
+      setflag(p, (uint8_t)m65816_flags::Carry, e);
+      e = carry;
+
+      if (e) {
+        s = 0x100 | (s & 0xFF);
+      }
+
+      update_p();
+    } break;
+    case M65816_bpl: branch((p & m65816_flags::Negative) == 0); break;
+    case M65816_bmi: branch((p & m65816_flags::Negative) != 0); break;
+    case M65816_bvc: branch((p & m65816_flags::Overflow) == 0); break;
+    case M65816_bvs: branch((p & m65816_flags::Overflow) != 0); break;
+    case M65816_bcc: branch((p & m65816_flags::Carry) == 0); break;
+    case M65816_bcs: branch((p & m65816_flags::Carry) != 0); break;
+    case M65816_bne: branch((p & m65816_flags::Zero) == 0); break;
+    case M65816_beq: branch((p & m65816_flags::Zero) != 0); break;
+    case M65816_bra:
+    case M65816_brl: branch(true); break;
+    case M65816_jmp: {
+      pc = (uint16_t)ea;
+
+      if (mode != M::Absp) {
+        record_indirect(op_pc, TRACE_IND_JUMP);
+      }
+    } break;
+    case M65816_jml: {
+      k = (uint8_t)(ea >> 16);
+      pc = (uint16_t)ea;
+
+      if (mode != M::Ablp) {
+        record_indirect(op_pc, TRACE_IND_JUMP);
+      }
+    } break;
+    case M65816_jsr: {
+      push16((uint16_t)(pc - 1));
+      pc = (uint16_t)ea;
+
+      if (mode != M::Absp) {
+        record_indirect(op_pc, TRACE_IND_CALL);
+      }
+      else {
+        record(cur_pc());
+      }
+    } break;
+    case M65816_jsl: {
+      push8(k);
+      push16((uint16_t)(pc - 1));
+      k = (uint8_t)(ea >> 16);
+      pc = (uint16_t)ea;
+      record(cur_pc());
+    } break;
+    case M65816_rts: {
+      pc = pull16() + 1;
+      check_return();
+    } break;
+    case M65816_rtl: {
+      pc = pull16() + 1;
+      k = pull8();
+      check_return();
+    } break;
+    case M65816_rti: {
+      p = pull8();
+      update_p();
+      pc = pull16();
+
+      if (!e) {
+        k = pull8();
+      }
+    } break;
+    case M65816_mvn:
+    case M65816_mvp: {
+      uint8_t dst = (uint8_t)value;
+      uint8_t src = (uint8_t)(value >> 8);
+      int16_t step = (itype == M65816_mvn) ? 1 : -1;
+      db = dst;
+
+      do {
+        write8(((uint32_t)dst << 16) | y, read8(((uint32_t)src << 16) | x));
+        x += step;
+        y += step;
+        update_p();
+        cycles += 7;
+      } while (a-- != 0);
+    } break;
+    case M65816_wai: {
+      // only an NMI wakes it up here
+      if (nmi_enabled()) {
+        cycles = std::max<uint64_t>(cycles, next_frame);
+      }
+      else {
+        stop = EMU_WAI;
+      }
+    } break;
+    case M65816_stp: stop = EMU_STP; break;
+    case M65816_brk:
+    case M65816_cop: stop = EMU_BRK; break;
+    default: break; // NOP, WDM
+    }
+
+    if (stop != EMU_RUNNING) {
+      pc = (uint16_t)op_pc;
+    }
+  }
+
+  void run(uint64_t max_cycles) {
+    record(cur_pc());
+
+    while (stop == EMU_RUNNING) {
+      if (cycles >= max_cycles) {
+        stop = EMU_BUDGET;
+        break;
+      }
+
+      if ((++insns % EMU_CANCEL_STEP) == 0 && user_cancelled()) {
+        stop = EMU_CANCELLED;
+        break;
+      }
+
+      if (cycles >= next_frame) {
+        next_frame += EMU_FRAME_CYCLES;
+
+        if (nmi_enabled()) {
+          interrupt(0xFFEA, 0xFFFA);
+        }
+      }
+
+      step();
+    }
+  }
+};
+
+int idaapi run_init_code_action_t::activate(action_activation_ctx_t* ctx) {
+  static const char form[] =
+    "Run init code\n"
+    "\n"
+    "Start at\n"
+    "<~R~eset vector:R>\n"
+    "<~C~ursor, native mode with its M/X, D and DB:R>>\n"
+    "<Cycle ~b~udget:D::12::>\n"
+    "<Write the ~W~RAM it built to the database:C>>\n"
+    "\n";
+
+  ushort start = 0;
+  sval_t budget = EMU_DEFAULT_CYCLES;
+  ushort keep = 0;
+
+  if (ask_form(form, &start, &budget, &keep) <= 0 || budget <= 0) {
+    return 1;
+  }
+
+  // 16MB of bus and the trace records
+  std::unique_ptr<micro_emu_t> emu(new micro_emu_t());
+  emu->keep_wram = (keep & 1) != 0;
+
+  if (start == 0) {
+    emu->pc = emu->read16(0xFFFC);
+  }
+  else {
+    ea_t ea = ctx->cur_ea;
+    uint8_t flags = ea_get_flags(ea);
+    ea_t dpage = ea_get_dpage(ea);
+    ea_t bank = ea_get_bank(ea);
+
+    emu->e = false;
+    emu->p = (flags & (m65816_flags::MemoryMode8 | m65816_flags::IndexMode8)) | m65816_flags::IrqDisable;
+    emu->k = (uint8_t)(ea >> 16);
+    emu->pc = (uint16_t)ea;
+    emu->d = (dpage != BADADDR) ? (uint16_t)dpage : 0;
+    emu->db = (uint8_t)(((bank != BADADDR) ? bank : ea) >> 16);
+  }
+
+  show_wait_box("Running init code...");
+
+  uint32_t start_pc = emu->cur_pc();
+  emu->run((uint64_t)budget);
+
+  replace_wait_box("Applying the harvested states...");
+  size_t applied = apply_trace(emu->res);
+
+  if (emu->keep_wram) {
+    for (uint32_t addr = WRAM_EA; addr < WRAM_EA + WRAM_SIZE; addr += EMU_PAGE_SIZE) {
+      emu->get_page(addr);
+    }
+
+    if (put_wram_image(&emu->mem[WRAM_EA], WRAM_SIZE)) {
+      // the cached insns of the RAM decoded the old bytes
+      cache->clear();
+      request_refresh(IWID_DISASMS);
+    }
+  }
+
+  hide_wait_box();
+
+  msg("Micro emulator: %06X, %" FMT_64 "u insns, %" FMT_64 "u cycles, stopped at %06X (%s), %u states applied, %u indirect targets\n",
+    start_pc, emu->insns, emu->cycles, emu->cur_pc(), emu_stop_names[emu->stop], (uint32_t)applied, (uint32_t)emu->res.targets.size());
+
+  return 1;
+}
+
+// the next free 64KB past the unpacked assets already there
+static ea_t find_unpacked_ea() {
+  ea_t ea = UNPACKED_EA;
+
+  for (segment_t* seg = get_first_seg(); seg != nullptr; seg = get_next_seg(seg->start_ea)) {
+    if (seg->start_ea >= UNPACKED_EA && seg->end_ea > ea) {
+      ea = (seg->end_ea + 0xFFFF) & ~(ea_t)0xFFFF;
+    }
+  }
+
+  return ea;
+}
+
+int idaapi run_decompressor_action_t::activate(action_activation_ctx_t* ctx) {
+  static const char form[] =
+    "Run decompressor\n"
+    "\n"
+    "Registers at the call\n"
+    "<~A~:N::8::>\n"
+    "<~X~:N::8::>\n"
+    "<~Y~:N::8::>\n"
+    "<~D~B:N::4::>\n"
+    "<~C~ompressed data, 0 for DB:X:$::16::>\n"
+    "<Cycle ~l~imit:D::12::>\n"
+    "\n";
+
+  func_t* func = get_func(ctx->cur_ea);
+  ea_t routine = (func != nullptr) ? func->start_ea : ctx->cur_ea;
+  ea_t bank = ea_get_bank(routine);
+
+  uval_t a = 0;
+  uval_t x = 0;
+  uval_t y = 0;
+  uval_t db = ((bank != BADADDR) ? bank : routine) >> 16;
+  ea_t source = 0;
+  sval_t budget = EMU_DEFAULT_CYCLES;
+
+  if (ask_form(form, &a, &x, &y, &db, &source, &budget) <= 0 || budget <= 0) {
+    return 1;
+  }
+
+  if (source == 0) {
+    source = ((db & 0xFF) << 16) | (x & 0xFFFF);
+  }
+
+  // a fresh bus: nothing the routine does reaches the database, only the WRAM it wrote is kept
+  std::unique_ptr<micro_emu_t> emu(new micro_emu_t());
+  uint8_t flags = ea_get_flags(routine);
+  ea_t dpage = ea_get_dpage(routine);
+
+  emu->e = false;
+  emu->p = (flags & (m65816_flags::MemoryMode8 | m65816_flags::IndexMode8)) | m65816_flags::IrqDisable;
+  emu->a = (uint16_t)a;
+  emu->x = (uint16_t)x;
+  emu->y = (uint16_t)y;
+  emu->db = (uint8_t)db;
+  emu->d = (dpage != BADADDR) ? (uint16_t)dpage : 0;
+  emu->k = (uint8_t)(routine >> 16);
+  emu->pc = (uint16_t)routine;
+  emu->update_p();
+  emu->nmis = false;
+  emu->stack_top = emu->s;
+  emu->wram_written.resize(WRAM_SIZE, 0);
+  uint16_t dp = emu->d;
+
+  show_wait_box("Running decompressor...");
+  emu->run((uint64_t)budget);
+  hide_wait_box();
+
+  if (emu->stop != EMU_RETURNED) {
+    warning("The routine at %06X didn't return: %s at %06X", (uint32_t)routine, emu_stop_names[emu->stop], emu->cur_pc());
+    return 1;
+  }
+
+  // the pushes and the direct page scratch aren't the asset, the bank 0 WRAM mirror is the first 8KB
+  uint8_t* written = &emu->wram_written[0];
+  uint32_t dp_end = std::min<uint32_t>(dp + 0x100, 0x2000);
+
+  if (emu->stack_low <= emu->stack_top && emu->stack_top < 0x2000) {
+    std::fill(written + emu->stack_low, written + emu->stack_top + 1, 0);
+  }
+
+  if (dp < dp_end) {
+    std::fill(written + dp, written + dp_end, 0);
+  }
+
+  // the largest run written, the buffer the asset went to
+  uint32_t start = 0;
+  uint32_t end = 0;
+
+  for (uint32_t i = 0; i < WRAM_SIZE;) {
+    if (written[i] == 0) {
+      i++;
+      continue;
+    }
+
+    uint32_t run = i;
+
+    while (i < WRAM_SIZE && written[i] != 0) {
+      i++;
+    }
+
+    if (i - run > end - start) {
+      start = run;
+      end = i;
+    }
+  }
+
+  if (end == start) {
+    warning("The routine at %06X wrote nothing to WRAM", (uint32_t)routine);
+    return 1;
+  }
+
+  ea_t ea = find_unpacked_ea();
+  qstring name;
+  name.sprnt("UNP_%06X", (uint32_t)source);
+
+  segment_t s;
+  s.start_ea = ea;
+  s.end_ea = ea + (end - start);
+  s.type = SEG_DATA;
+  s.bitness = 1;
+  s.perm = SEGPERM_READ;
+
+  if (!add_segm_ex(&s, name.c_str(), "CONST", ADDSEG_NOSREG | ADDSEG_QUIET)) {
+    warning("Can't create the %s segment", name.c_str());
+    return 1;
+  }
+
+  mem2base(&emu->mem[WRAM_EA + start], s.start_ea, s.end_ea, -1);
+
+  name.sprnt("unpacked_%06X", (uint32_t)source);
+  set_name(ea, name.c_str(), SN_AUTO | SN_NOWARN | SN_NOCHECK);
+
+  qstring cmt;
+  cmt.sprnt("unpacked from %06X by %06X into WRAM %06X-%06X", (uint32_t)source, (uint32_t)routine, WRAM_EA + start, WRAM_EA + end - 1);
+  set_cmt(ea, cmt.c_str(), true);
+
+  ea_t packed = canon_ea(source);
+
+  if (is_mapped(packed)) {
+    add_dref(ea, packed, dr_O);
+
+    if (!has_name(get_flags(packed))) {
+      name.sprnt("packed_%06X", (uint32_t)source);
+      set_name(packed, name.c_str(), SN_AUTO | SN_NOWARN | SN_NOCHECK);
+    }
+  }
+
+  msg("Decompressor %06X: %u bytes from %06X at %a, %" FMT_64 "u cycles\n", (uint32_t)routine, end - start, (uint32_t)source, ea, emu->cycles);
+  jumpto(ea);
+
+  return 1;
+}
@@ -22,7 +22,7 @@ void out_m65816_t::out_byte_word(const op_t& x, bool is_byte) {
 }
 
 void out_m65816_t::out_byte_or_off(const op_t& x, bool ref_anyway) {
-  ea_t ea = use_mapping(x.addr);
+  ea_t ea = canon_ea(x.addr);
   if ((ref_anyway && out_name_expr(x, ea)) || (op_adds_xrefs(F, x.n) && out_name_expr(x, ea))) {
     return;
   }
@@ -34,7 +34,7 @@ void out_m65816_t::out_byte_or_off(const op_t& x, bool ref_anyway) {
 void out_m65816_t::out_byteword_or_off(const op_t& x, bool ref_anyway) {
   bool is_byte = (insn.size == 2);
 
-  ea_t ea = use_mapping(x.addr);
+  ea_t ea = canon_ea(x.addr);
   if ((ref_anyway && out_name_expr(x, ea)) || (op_adds_xrefs(F, x.n) && out_name_expr(x, ea))) {
     return;
   }
@@ -44,7 +44,7 @@ void out_m65816_t::out_byteword_or_off(const op_t& x, bool ref_anyway) {
 }
 
 void out_m65816_t::out_word_or_off(const op_t& x, bool ref_anyway) {
-  ea_t ea = use_mapping(x.addr);
+  ea_t ea = canon_ea(x.addr);
   if ((ref_anyway && out_name_expr(x, ea)) || (op_adds_xrefs(F, x.n) && out_name_expr(x, ea))) {
     return;
   }
@@ -54,7 +54,7 @@ void out_m65816_t::out_word_or_off(const op_t& x, bool ref_anyway) {
 }
 
 void out_m65816_t::out_24bit_or_off(const op_t& x, bool ref_anyway) {
-  ea_t ea = use_mapping(x.addr);
+  ea_t ea = canon_ea(x.addr);
   if ((ref_anyway && out_name_expr(x, ea)) || (op_adds_xrefs(F, x.n) && out_name_expr(x, ea))) {
     return;
   }
@@ -64,6 +64,10 @@ void out_m65816_t::out_24bit_or_off(const op_t& x, bool ref_anyway) {
 }
 
 bool out_m65816_t::out_operand(const op_t& x) {
+  if (is_upd_ea(insn.ea)) {
+    return upd_out_operand(*this, x);
+  }
+
   M addrMode = static_cast<M>(insn.insnpref);
 
   uint32_t feature = insn.get_canon_feature(ph);
@@ -206,6 +210,11 @@ bool out_m65816_t::out_operand(const op_t& x) {
 }
 
 void out_m65816_t::out_proc_mnem(void) {
+  if (is_upd_ea(insn.ea)) {
+    upd_out_mnem(*this);
+    return;
+  }
+
   char postfix[3];
   postfix[0] = '\0';
 
@@ -237,6 +246,11 @@ void out_m65816_t::out_proc_mnem(void) {
 }
 
 void out_m65816_t::out_insn(void) {
+  if (is_upd_ea(insn.ea)) {
+    upd_out_insn(*this);
+    return;
+  }
+
   out_mnemonic();
   out_one_operand(0);
 
@@ -335,6 +349,17 @@ void out_m65816_t::out_insn(void) {
   } break;
   }
 
+  if (pm().idpflags & SHOW_CYCLES) {
+    insn_cycles_t cycles;
+    calc_insn_cycles(insn, &cycles);
+
+    qstring cyc;
+    format_cycles(&cyc, cycles);
+
+    qsnprintf(buf, sizeof(buf), COLSTR(" %s %s", SCOLOR_AUTOCMT), ash.cmnt, cyc.c_str());
+    out_line(buf);
+  }
+
   flush_outbuf();
 }
 
@@ -364,7 +389,7 @@ void m65816_t::out_banked_val(outctx_t& ctx, bool analyze_only) {
       value |= (uint32_t)ea_bank;
     }
 
-    value = use_mapping(value);
+    value = canon_ea(value);
 
     if (!is_mapped(value)) {
       ctx.out_data(analyze_only);
@@ -0,0 +1,47 @@
+#include "65816.hpp"
+#include "ram_image.hpp"
+#include <segment.hpp>
+#include <algorithm>
+
+bool put_sram_image(const uint8_t* data, size_t size) {
+  // the emulators may save their whole SRAM buffer, only the cart's part of it is seen
+  size_t sram_size = (size_t)helper.altval(SRAM_SIZE_IDX);
+
+  if (sram_size != 0 && sram_size < size) {
+    size = sram_size;
+  }
+
+  if (size == 0) {
+    return false;
+  }
+
+  size_t offset = 0;
+
+  for (segment_t* seg = get_first_seg(); seg != nullptr; seg = get_next_seg(seg->start_ea)) {
+    qstring name;
+
+    if (get_segm_name(&name, seg) <= 0 || strncmp(name.c_str(), "SRAM", 4) != 0) {
+      continue;
+    }
+
+    for (ea_t ea = seg->start_ea; ea < seg->end_ea;) {
+      size_t pos = offset % size;
+      asize_t chunk = std::min<asize_t>(size - pos, seg->end_ea - ea);
+
+      mem2base(&data[pos], ea, ea + chunk, -1);
+      ea += chunk;
+      offset += chunk;
+    }
+  }
+
+  return offset != 0;
+}
+
+bool put_wram_image(const uint8_t* data, size_t size) {
+  if (size != WRAM_SIZE || getseg(WRAM_EA) == nullptr) {
+    return false;
+  }
+
+  mem2base(data, WRAM_EA, WRAM_EA + WRAM_SIZE, -1);
+  return true;
+}
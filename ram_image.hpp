@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// RAM images from savestates written straight over the segments the loader made for the RAM,
+// without a file region
+
+// the save RAM is laid out over the SRAMxx segments in address order, a segment larger than the
+// save RAM mirrors it like the cart does (the other SRAM mirrors are mappings to these segments)
+bool put_sram_image(const uint8_t* data, size_t size);
+
+// 7E0000-7FFFFF, the low 8KB of the other banks are mappings to it
+bool put_wram_image(const uint8_t* data, size_t size);
@@ -3,6 +3,7 @@
 int data_id;
 
 netnode helper;
+netnode patches_node;
 
 const char* idaapi m65816_t::set_idp_options(const char* keyword, int value_type, const void* value, bool idb_loaded) {
   if (keyword == nullptr)
@@ -23,12 +24,19 @@ const char* idaapi m65816_t::set_idp_options(const char* keyword, int value_type
       "\n"
       "       If this option is on, IDA won't accept WDM opcode as a valid one\n"
       "\n"
+      " Show instruction cycles\n"
+      "\n"
+      "       If this option is on, every instruction gets an auto comment with\n"
+      "       its CPU cycles and master clocks (ranges depend on DP, page crossing,\n"
+      "       taken branches and memory speed)\n"
+      "\n"
       "ENDHELP\n"
       "ROM specific options\n"
       "%*\n"
       " <~B~RK isn't used in this ROM:C>\n"
       " <~C~OP isn't used in this ROM:C>\n"
-      " <~W~DM isn't used in this ROM:C>>\n"
+      " <~W~DM isn't used in this ROM:C>\n"
+      " <Show instruction c~y~cles:C>>\n"
       "\n"
       "\n";
     CASSERT(sizeof(idpflags) == sizeof(ushort));
@@ -68,6 +76,14 @@ const char* idaapi m65816_t::set_idp_options(const char* keyword, int value_type
         save_idpflags();
       }
 
+      return IDPOPT_OK;
+    } else if (streq(keyword, "SHOW_CYCLES")) {
+      setflag(idpflags, SHOW_CYCLES, *(int*)value != 0);
+
+      if (idb_loaded) {
+        save_idpflags();
+      }
+
       return IDPOPT_OK;
     }
 
@@ -104,7 +120,7 @@ static bool idaapi print_addr24(void* ud, qstring* out, const void* value, asize
     //uint32_t* _ud = (uint32_t*)ud;
 
     uint32_t val = (b3[2] << 16) | (b3[1] << 8) | (b3[0] << 0);
-    val = use_mapping(val);
+    val = canon_ea(val);
     //*_ud = val;
 
     qstring name;
@@ -171,6 +187,8 @@ ssize_t idaapi m65816_t::on_event(ssize_t msgid, va_list va) {
     inf_set_af2(0);
 
     bool exists = helper.create("$ 65816");
+    hwregs_node.create("$ 65816 hwregs");
+    patches_node.create(PATCHES_NODE_NAME);
 
     update_action_state("OpOffset", action_state_t::AST_DISABLE_ALWAYS);
     update_action_state("OpOffsetCs", action_state_t::AST_DISABLE_ALWAYS);
@@ -182,16 +200,49 @@ ssize_t idaapi m65816_t::on_event(ssize_t msgid, va_list va) {
     register_action(set_wram_offset_bank_action);
     register_action(set_zero_offset_bank_action);
     register_action(set_cust_offset_bank_action);
+    register_action(func_cycles_action);
+    register_action(block_cycles_action);
+    register_action(import_trace_action);
+    register_action(import_cdl_action);
+    register_action(import_symbols_action);
+    register_action(hwreg_accesses_action);
+    register_action(decode_cache_stats_action);
+    register_action(infer_background_action);
+    register_action(save_analysis_cache_action);
+    register_action(bank_view_action);
+    register_action(import_savestate_action);
+    register_action(run_init_code_action);
+    register_action(run_decompressor_action);
+    register_action(code_score_action);
+    register_action(region_map_action);
+    register_action(dup_funcs_action);
+    register_action(apply_sigs_action);
+    register_action(create_sigs_action);
+    register_action(export_diff_action);
+    register_action(rom_diff_action);
+
+    attach_action_to_menu("File/Load file/", import_trace_action_name, SETMENU_APP);
+    attach_action_to_menu("File/Load file/", import_cdl_action_name, SETMENU_APP);
+    attach_action_to_menu("File/Load file/", import_symbols_action_name, SETMENU_APP);
+    attach_action_to_menu("File/Load file/", import_savestate_action_name, SETMENU_APP);
+    attach_action_to_menu("File/Load file/", rom_diff_action_name, SETMENU_APP);
+    attach_action_to_menu("File/Produce file/", export_diff_action_name, SETMENU_APP);
 
     addr24_id = register_custom_data_type(&addr24_type);
     addr24_fid = register_custom_data_format(&addr24_format);
     attach_custom_data_format(addr24_id, addr24_fid);
 
     //hook_event_listener(HT_IDB, &idb_listener, &LPH);
+    hook_event_listener(HT_IDB, &decode_cache, &LPH);
+    hook_event_listener(HT_IDB, &analysis_cache_listener, &LPH);
+    hook_event_listener(HT_IDB, &sig_library, &LPH);
 
     recurse_ana = false;
   } break;
   case processor_t::ev_term: {
+    // the worker must not post to a closed database
+    stop_inference();
+
     clr_module_data(data_id);
 
     unregister_action(switch_bitmode_action_name);
@@ -200,6 +251,26 @@ ssize_t idaapi m65816_t::on_event(ssize_t msgid, va_list va) {
     unregister_action(set_wram_offset_bank_action_name);
     unregister_action(set_zero_offset_bank_action_name);
     unregister_action(set_cust_offset_bank_action_name);
+    unregister_action(func_cycles_action_name);
+    unregister_action(block_cycles_action_name);
+    unregister_action(import_trace_action_name);
+    unregister_action(import_cdl_action_name);
+    unregister_action(import_symbols_action_name);
+    unregister_action(hwreg_accesses_action_name);
+    unregister_action(decode_cache_stats_action_name);
+    unregister_action(infer_background_action_name);
+    unregister_action(save_analysis_cache_action_name);
+    unregister_action(bank_view_action_name);
+    unregister_action(import_savestate_action_name);
+    unregister_action(run_init_code_action_name);
+    unregister_action(run_decompressor_action_name);
+    unregister_action(code_score_action_name);
+    unregister_action(region_map_action_name);
+    unregister_action(dup_funcs_action_name);
+    unregister_action(apply_sigs_action_name);
+    unregister_action(create_sigs_action_name);
+    unregister_action(export_diff_action_name);
+    unregister_action(rom_diff_action_name);
 
     update_action_state("OpOffset", action_state_t::AST_ENABLE_ALWAYS);
     update_action_state("OpOffsetCs", action_state_t::AST_ENABLE_ALWAYS);
@@ -214,9 +285,16 @@ ssize_t idaapi m65816_t::on_event(ssize_t msgid, va_list va) {
     }
 
     //unhook_event_listener(HT_IDB, &idb_listener);
+    unhook_event_listener(HT_IDB, &decode_cache);
+    unhook_event_listener(HT_IDB, &analysis_cache_listener);
+    unhook_event_listener(HT_IDB, &sig_library);
   } break;
   case processor_t::ev_newfile: {
     auto* fname = va_arg(va, char*); // here we can load additional data from a current dir
+
+    if (sig_library.load_dirs() != 0) {
+      sig_library.pending = true;
+    }
   } break;
   case processor_t::ev_is_cond_insn: {
     const auto* insn = va_arg(va, const insn_t*);
@@ -228,7 +306,8 @@ ssize_t idaapi m65816_t::on_event(ssize_t msgid, va_list va) {
       insn->itype == M65816_bcc ||
       insn->itype == M65816_bcs ||
       insn->itype == M65816_bne ||
-      insn->itype == M65816_beq
+      insn->itype == M65816_beq ||
+      insn->itype == UPD_jcc
       ) ? 1 : -1;
   } break;
   case processor_t::ev_is_ret_insn: {
@@ -236,7 +315,8 @@ ssize_t idaapi m65816_t::on_event(ssize_t msgid, va_list va) {
     return (
       insn->itype == M65816_rts ||
       insn->itype == M65816_rtl ||
-      insn->itype == M65816_rti
+      insn->itype == M65816_rti ||
+      insn->itype == UPD_rt
       ) ? 1 : -1;
   } break;
   case processor_t::ev_is_call_insn: {
@@ -245,7 +325,8 @@ ssize_t idaapi m65816_t::on_event(ssize_t msgid, va_list va) {
       insn->itype == M65816_brk ||
       insn->itype == M65816_cop ||
       insn->itype == M65816_jsr ||
-      insn->itype == M65816_jsl
+      insn->itype == M65816_jsl ||
+      insn->itype == UPD_call
       ) ? 1 : -1;
   } break;
   case processor_t::ev_ana_insn: {
@@ -286,9 +367,27 @@ ssize_t idaapi m65816_t::on_event(ssize_t msgid, va_list va) {
   case processor_t::ev_ending_undo:
   case processor_t::ev_oldfile: {
     load_from_idb();
+    decode_cache.clear();
+  } break;
+  case EV_ROM_RELOADED: {
+    decode_cache.clear();
   } break;
   case processor_t::ev_privrange_changed: {
     helper.create("$ 65816");
+    hwregs_node.create("$ 65816 hwregs");
+    patches_node.create(PATCHES_NODE_NAME);
+  } break;
+  case processor_t::ev_get_bg_color: {
+    bgcolor_t* color = va_arg(va, bgcolor_t*);
+    ea_t ea = va_arg(va, ea_t);
+
+    // bytes changed by the patch applied at load
+    if (!is_rom_patched(ea)) {
+      return 0;
+    }
+
+    *color = PATCHED_BG_COLOR;
+    return 1;
   } break;
   case processor_t::ev_out_data: {
     outctx_t* ctx = va_arg(va, outctx_t*);
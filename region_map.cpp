@@ -0,0 +1,265 @@
+#include "65816.hpp"
+#include <bytes.hpp>
+#include <segment.hpp>
+#include <kernwin.hpp>
+#include <math.h>
+#include <algorithm>
+
+// First pass map of the ROM: every 1KB window of the rom segments is classified from its byte statistics
+// (entropy, equal bytes at the bitplane strides, BRR block headers) and a line per bank is printed.
+// Runs of confident data windows nobody has touched yet become byte arrays, which the tracer doesn't
+// turn into code.
+
+#define REGION_WINDOW 0x400
+#define REGION_CHUNK 16 // the two bitplanes of a tile row pair
+
+#define REGION_FILL_ENTROPY 1.0
+#define REGION_PACKED_ENTROPY 7.6
+#define REGION_BRR_ENTROPY 5.0
+#define REGION_TILE_EQ2 0.3 // same bitplane on the next row
+#define REGION_MODE7_EQ1 0.4 // the next pixel of a chunky tile
+#define REGION_PLANES_MARGIN 0.08
+#define REGION_BRR_HEADERS 0.95
+
+enum region_class_t : uint8_t {
+  REGION_OTHER,
+  REGION_FILL,
+  REGION_2BPP,
+  REGION_4BPP,
+  REGION_8BPP,
+  REGION_MODE7,
+  REGION_BRR,
+  REGION_PACKED,
+  REGION_LAST,
+};
+
+static const char region_chars[REGION_LAST] = { '-', '.', '2', '4', '8', '7', 'B', 'Z' };
+
+static const char* const region_names[REGION_LAST] = {
+  "code/tables", "fill", "2bpp tiles", "4bpp tiles", "8bpp tiles", "mode 7 data", "BRR samples", "compressed",
+};
+
+struct region_stats_t {
+  double nlog2n[REGION_WINDOW + 1]; // n * log2(n) of the byte counts
+
+  region_stats_t() {
+    nlog2n[0] = 0;
+
+    for (int n = 1; n <= REGION_WINDOW; ++n) {
+      nlog2n[n] = n * log2((double)n);
+    }
+  }
+
+  double entropy(const uint8_t* data) const {
+    uint32_t counts[256] = {};
+
+    for (int i = 0; i < REGION_WINDOW; ++i) {
+      counts[data[i]]++;
+    }
+
+    double sum = 0;
+
+    for (int i = 0; i < 256; ++i) {
+      sum += nlog2n[counts[i]];
+    }
+
+    return log2((double)REGION_WINDOW) - sum / REGION_WINDOW;
+  }
+};
+
+static double equal_at(const uint8_t* data, int stride) {
+  uint32_t equal = 0;
+
+  for (int i = 0; i + stride < REGION_WINDOW; ++i) {
+    equal += (data[i] == data[i + stride]) ? 1 : 0;
+  }
+
+  return (double)equal / (REGION_WINDOW - stride);
+}
+
+// the 16 byte chunks of one tile (planes 0/1, 2/3, ...) look alike, the chunks of the next tile less
+static region_class_t classify_planes(const uint8_t* data) {
+  double sims[4] = {};
+  uint32_t counts[4] = {};
+
+  for (int k = 0; (k + 2) * REGION_CHUNK <= REGION_WINDOW; ++k) {
+    const uint8_t* a = &data[k * REGION_CHUNK];
+    const uint8_t* b = a + REGION_CHUNK;
+    uint32_t equal_bits = 0;
+
+    for (int i = 0; i < REGION_CHUNK; ++i) {
+      uint8_t same = (uint8_t)~(a[i] ^ b[i]);
+
+      while (same != 0) {
+        same &= same - 1;
+        equal_bits++;
+      }
+    }
+
+    sims[k & 3] += equal_bits / (REGION_CHUNK * 8.0);
+    counts[k & 3]++;
+  }
+
+  for (int i = 0; i < 4; ++i) {
+    sims[i] /= counts[i];
+  }
+
+  if (sims[0] - sims[3] > REGION_PLANES_MARGIN && sims[1] - sims[3] > REGION_PLANES_MARGIN && sims[2] - sims[3] > REGION_PLANES_MARGIN) {
+    return REGION_8BPP;
+  }
+
+  if ((sims[0] + sims[2]) / 2 - (sims[1] + sims[3]) / 2 > REGION_PLANES_MARGIN) {
+    return REGION_4BPP;
+  }
+
+  return REGION_2BPP;
+}
+
+// 9 byte blocks whose headers all have a valid shift and no end flag, at the best phase
+static double brr_headers(const uint8_t* data) {
+  double best = 0;
+
+  for (int phase = 0; phase < 9; ++phase) {
+    uint32_t valid = 0;
+    uint32_t blocks = 0;
+
+    for (int i = phase; i + 9 <= REGION_WINDOW; i += 9) {
+      uint8_t header = data[i];
+      valid += ((header >> 4) <= 12 && (header & 1) == 0) ? 1 : 0;
+      blocks++;
+    }
+
+    best = std::max(best, (double)valid / blocks);
+  }
+
+  return best;
+}
+
+static region_class_t classify_window(const region_stats_t& stats, const uint8_t* data) {
+  double entropy = stats.entropy(data);
+
+  if (entropy < REGION_FILL_ENTROPY) {
+    return REGION_FILL;
+  }
+
+  double eq1 = equal_at(data, 1);
+  double eq2 = equal_at(data, 2);
+
+  // planar tiles repeat at the bitplane stride, chunky mode 7 pixels at the next byte
+  if (eq2 >= REGION_TILE_EQ2 && eq2 > eq1 + 0.05) {
+    return classify_planes(data);
+  }
+
+  if (eq1 >= REGION_MODE7_EQ1 && entropy >= 2.0) {
+    return REGION_MODE7;
+  }
+
+  if (entropy >= REGION_BRR_ENTROPY && brr_headers(data) >= REGION_BRR_HEADERS) {
+    return REGION_BRR;
+  }
+
+  if (entropy >= REGION_PACKED_ENTROPY) {
+    return REGION_PACKED;
+  }
+
+  return REGION_OTHER;
+}
+
+static bool is_untouched(ea_t start, ea_t end) {
+  return is_unknown(get_flags(start)) && next_head(start, end) == BADADDR;
+}
+
+int idaapi region_map_action_t::activate(action_activation_ctx_t* ctx) {
+  static const char form[] =
+    "ROM region map\n"
+    "\n"
+    "<~M~ake byte arrays of the data regions nothing was traced into:C>>\n"
+    "\n";
+
+  ushort mark = 1;
+
+  if (ask_form(form, &mark) <= 0) {
+    return 1;
+  }
+
+  show_wait_box("Classifying ROM regions...");
+
+  region_stats_t stats;
+  uint32_t totals[REGION_LAST] = {};
+  uint32_t marked = 0;
+  bytevec_t bytes;
+  qstring line;
+
+  msg("Region map, a char per %u bytes:", REGION_WINDOW);
+
+  for (int i = 0; i < REGION_LAST; ++i) {
+    msg(" %c %s%s", region_chars[i], region_names[i], (i + 1 < REGION_LAST) ? "," : "\n");
+  }
+
+  for (segment_t* seg = get_first_seg(); seg != nullptr; seg = get_next_seg(seg->start_ea)) {
+    if (seg->type != SEG_CODE || is_upd_ea(seg->start_ea) || seg->size() < REGION_WINDOW) {
+      continue;
+    }
+
+    asize_t size = seg->size() & ~(asize_t)(REGION_WINDOW - 1);
+    bytes.resize(size, 0);
+    get_bytes(&bytes[0], size, seg->start_ea, GMB_READALL);
+
+    line.sprnt("%06X: ", (uint32_t)seg->start_ea);
+
+    ea_t run_start = BADADDR;
+    region_class_t run_class = REGION_OTHER;
+
+    auto close_run = [&](ea_t end) {
+      if (run_start != BADADDR && create_byte(run_start, end - run_start)) {
+        qstring cmt;
+        cmt.sprnt("region: %s", region_names[run_class]);
+        set_cmt(run_start, cmt.c_str(), true);
+        marked++;
+      }
+
+      run_start = BADADDR;
+    };
+
+    for (asize_t offset = 0; offset < size; offset += REGION_WINDOW) {
+      region_class_t cls = classify_window(stats, &bytes[offset]);
+      ea_t ea = seg->start_ea + offset;
+
+      line += region_chars[cls];
+      totals[cls]++;
+
+      if (!mark) {
+        continue;
+      }
+
+      bool data = (cls != REGION_OTHER) && is_untouched(ea, ea + REGION_WINDOW);
+
+      if (run_start != BADADDR && (!data || cls != run_class)) {
+        close_run(ea);
+      }
+
+      if (data && run_start == BADADDR) {
+        run_start = ea;
+        run_class = cls;
+      }
+    }
+
+    close_run(seg->start_ea + size);
+    msg("%s\n", line.c_str());
+
+    if (user_cancelled()) {
+      break;
+    }
+  }
+
+  hide_wait_box();
+
+  msg("Region map:");
+
+  for (int i = 0; i < REGION_LAST; ++i) {
+    msg(" %u KB %s%s", totals[i] * REGION_WINDOW / 1024, region_names[i], (i + 1 < REGION_LAST) ? "," : "");
+  }
+
+  msg(", %u data runs marked\n", marked);
+  return 1;
+}
@@ -0,0 +1,905 @@
+#include "65816.hpp"
+#include <bytes.hpp>
+#include <funcs.hpp>
+#include <name.hpp>
+#include <gdl.hpp>
+#include <kernwin.hpp>
+#include <diskio.hpp>
+#include <algorithm>
+#include <unordered_map>
+
+// Moves the annotations of one revision of a game (JP -> US, v1.0 -> v1.1) to another. The annotated
+// database exports its functions to a .snd file: position independent hashes of the function and of its
+// basic blocks, the callees, the names, comments, M/X, bank and DP overrides. The other database aligns its
+// functions with them by the exact hash, then along the call graph of the aligned pairs, then by the basic
+// blocks they share (a hash index of the rare block hashes), and takes the annotations of the pairs.
+
+#define DIFF_VERSION 1
+#define DIFF_BLOCK_BUCKET_MAX 8 // a block hash of more functions (RTS, a lone JSR) says nothing
+#define DIFF_MIN_SIMILARITY 50 // percent of the blocks shared
+
+static const char diff_magic[4] = { 'S', 'N', 'D', 'F' };
+
+enum diff_note_kind_t : uint8_t {
+  DIFF_NOTE_NAME,
+  DIFF_NOTE_CMT,
+  DIFF_NOTE_RPT_CMT,
+  DIFF_NOTE_FUNC_CMT,
+  DIFF_NOTE_FUNC_RPT_CMT,
+  DIFF_NOTE_MX,
+  DIFF_NOTE_BANK,
+  DIFF_NOTE_DPAGE,
+};
+
+enum diff_how_t : uint8_t {
+  DIFF_UNMATCHED,
+  DIFF_EXACT,
+  DIFF_CALLS,
+  DIFF_BLOCKS,
+};
+
+static const char* const diff_how_names[] = { "unmatched", "exact", "calls", "blocks" };
+
+struct diff_block_t {
+  int32_t start; // from the function start, chunks may be before it
+  uint32_t size;
+  uint64_t hash;
+};
+
+struct diff_note_t {
+  int32_t offset;
+  uint8_t kind;
+  uint32_t value;
+  qstring text;
+};
+
+struct diff_func_t {
+  ea_t start_ea;
+  uint32_t insns;
+  uint64_t exact;
+  qstring name; // user names only
+  qvector<diff_block_t> blocks; // ascending
+  qvector<uint32_t> callees; // start eas in the order of the calls, indexes once loaded
+  qvector<diff_note_t> notes;
+  uint32_t match; // index on the other side + 1, 0 if none
+  diff_how_t how;
+};
+
+static inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDULL;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static void collect_notes(func_t* pfn, diff_func_t* res) {
+  qstring text;
+
+  for (int rpt = 0; rpt < 2; ++rpt) {
+    if (get_func_cmt(&text, pfn, rpt != 0) > 0) {
+      diff_note_t& note = res->notes.push_back();
+      note.offset = 0;
+      note.kind = rpt ? DIFF_NOTE_FUNC_RPT_CMT : DIFF_NOTE_FUNC_CMT;
+      note.value = 0;
+      note.text = text;
+    }
+  }
+
+  func_item_iterator_t fii;
+
+  for (bool ok = fii.set(pfn); ok; ok = fii.next_code()) {
+    ea_t ea = fii.current();
+    flags64_t flags = get_flags(ea);
+    int32_t offset = (int32_t)(ea - pfn->start_ea);
+
+    auto add_note = [&](uint8_t kind, uint32_t value, const qstring& str) {
+      diff_note_t& note = res->notes.push_back();
+      note.offset = offset;
+      note.kind = kind;
+      note.value = value;
+      note.text = str;
+    };
+
+    if (ea != pfn->start_ea && has_user_name(flags)) {
+      add_note(DIFF_NOTE_NAME, 0, get_name(ea));
+    }
+
+    if (get_cmt(&text, ea, false) > 0) {
+      add_note(DIFF_NOTE_CMT, 0, text);
+    }
+
+    if (get_cmt(&text, ea, true) > 0) {
+      add_note(DIFF_NOTE_RPT_CMT, 0, text);
+    }
+
+    if (ea_is_manual_bitmode(ea)) {
+      add_note(DIFF_NOTE_MX, ea_get_flags(ea), qstring());
+    }
+
+    if (ea_get_bank(ea) != BADADDR) {
+      add_note(DIFF_NOTE_BANK, (uint32_t)ea_get_bank(ea), qstring());
+    }
+
+    if (ea_get_dpage(ea) != BADADDR) {
+      add_note(DIFF_NOTE_DPAGE, (uint32_t)ea_get_dpage(ea), qstring());
+    }
+  }
+}
+
+static void collect_func(func_t* pfn, bool notes, diff_func_t* res) {
+  res->start_ea = pfn->start_ea;
+  res->insns = 0;
+  res->exact = 0;
+  res->match = 0;
+  res->how = DIFF_UNMATCHED;
+
+  if (has_user_name(get_flags(pfn->start_ea))) {
+    res->name = get_name(pfn->start_ea);
+  }
+
+  func_item_iterator_t fii;
+  xrefblk_t xb;
+
+  for (bool ok = fii.set(pfn); ok; ok = fii.next_code()) {
+    ea_t ea = fii.current();
+    res->exact = mix64(res->exact ^ get_insn_token(ea, get_item_size(ea)));
+    res->insns++;
+
+    for (bool ok_xref = xb.first_from(ea, XREF_FAR); ok_xref; ok_xref = xb.next_from()) {
+      if (xb.iscode && (xb.type == fl_CN || xb.type == fl_CF)) {
+        res->callees.push_back((uint32_t)xb.to);
+      }
+    }
+  }
+
+  res->exact ^= res->insns;
+
+  qflow_chart_t fc("", pfn, BADADDR, BADADDR, FC_NOEXT);
+
+  for (int i = 0; i < fc.size(); ++i) {
+    const qbasic_block_t& bb = fc.blocks[i];
+    diff_block_t& block = res->blocks.push_back();
+    block.start = (int32_t)(bb.start_ea - pfn->start_ea);
+    block.size = (uint32_t)(bb.end_ea - bb.start_ea);
+    block.hash = block.size;
+
+    for (ea_t ea = bb.start_ea; ea < bb.end_ea && ea != BADADDR; ea = next_head(ea, bb.end_ea)) {
+      block.hash = mix64(block.hash ^ get_insn_token(ea, get_item_size(ea)));
+    }
+  }
+
+  std::sort(res->blocks.begin(), res->blocks.end(), [](const diff_block_t& a, const diff_block_t& b) {
+    return a.start < b.start;
+  });
+
+  if (notes) {
+    collect_notes(pfn, res);
+  }
+}
+
+static bool collect_funcs(qvector<diff_func_t>& funcs, bool notes) {
+  size_t qty = get_func_qty();
+  funcs.reserve(qty);
+
+  for (size_t i = 0; i < qty; ++i) {
+    func_t* pfn = getn_func(i);
+
+    if (pfn == nullptr || is_upd_ea(pfn->start_ea)) {
+      continue;
+    }
+
+    collect_func(pfn, notes, &funcs.push_back());
+
+    if ((i & 0xFF) == 0 && user_cancelled()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+struct diff_writer_t {
+  bytevec_t buf;
+
+  void put(const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    buf.insert(buf.end(), p, p + size);
+  }
+
+  void put_u32(uint32_t value) {
+    put(&value, sizeof(value));
+  }
+
+  void put_str(const qstring& str) {
+    uint16_t len = (uint16_t)std::min<size_t>(str.length(), 0xFFFF);
+    put(&len, sizeof(len));
+    put(str.c_str(), len);
+  }
+};
+
+struct diff_reader_t {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool ok = true;
+
+  diff_reader_t(const bytevec_t& buf) : p(buf.empty() ? nullptr : &buf[0]), end(p + buf.size()) {}
+
+  void get(void* data, size_t size) {
+    if (!ok || (size_t)(end - p) < size) {
+      ok = false;
+      memset(data, 0, size);
+      return;
+    }
+
+    memcpy(data, p, size);
+    p += size;
+  }
+
+  uint32_t get_u32() {
+    uint32_t value;
+    get(&value, sizeof(value));
+    return value;
+  }
+
+  void get_str(qstring* str) {
+    uint16_t len;
+    get(&len, sizeof(len));
+
+    if (!ok || (size_t)(end - p) < len) {
+      ok = false;
+      return;
+    }
+
+    str->qclear();
+    str->append((const char*)p, len);
+    p += len;
+  }
+};
+
+static bool save_diff(const char* path, const qvector<diff_func_t>& funcs) {
+  diff_writer_t w;
+  w.put(diff_magic, sizeof(diff_magic));
+  w.put_u32(DIFF_VERSION);
+  w.put_u32((uint32_t)funcs.size());
+
+  for (const diff_func_t& func : funcs) {
+    w.put_u32((uint32_t)func.start_ea);
+    w.put_u32(func.insns);
+    w.put(&func.exact, sizeof(func.exact));
+    w.put_str(func.name);
+
+    w.put_u32((uint32_t)func.blocks.size());
+
+    for (const diff_block_t& block : func.blocks) {
+      w.put(&block.start, sizeof(block.start));
+      w.put_u32(block.size);
+      w.put(&block.hash, sizeof(block.hash));
+    }
+
+    w.put_u32((uint32_t)func.callees.size());
+
+    for (uint32_t callee : func.callees) {
+      w.put_u32(callee);
+    }
+
+    w.put_u32((uint32_t)func.notes.size());
+
+    for (const diff_note_t& note : func.notes) {
+      w.put(&note.offset, sizeof(note.offset));
+      w.put(&note.kind, sizeof(note.kind));
+      w.put_u32(note.value);
+      w.put_str(note.text);
+    }
+  }
+
+  FILE* fp = fopenWB(path);
+
+  if (fp == nullptr) {
+    return false;
+  }
+
+  bool ok = qfwrite(fp, &w.buf[0], w.buf.size()) == (ssize_t)w.buf.size();
+  qfclose(fp);
+
+  if (!ok) {
+    qunlink(path);
+  }
+
+  return ok;
+}
+
+static bool load_diff(const char* path, qvector<diff_func_t>& funcs) {
+  FILE* fp = fopenRB(path);
+
+  if (fp == nullptr) {
+    return false;
+  }
+
+  bytevec_t buf;
+  buf.resize((size_t)qfsize(fp), 0);
+  bool ok = buf.empty() || qfread(fp, &buf[0], buf.size()) == (ssize_t)buf.size();
+  qfclose(fp);
+
+  if (!ok) {
+    return false;
+  }
+
+  diff_reader_t r(buf);
+  char magic[sizeof(diff_magic)];
+  r.get(magic, sizeof(magic));
+
+  if (!r.ok || memcmp(magic, diff_magic, sizeof(magic)) != 0 || r.get_u32() != DIFF_VERSION) {
+    return false;
+  }
+
+  uint32_t count = r.get_u32();
+
+  for (uint32_t i = 0; i < count && r.ok; ++i) {
+    diff_func_t& func = funcs.push_back();
+    func.start_ea = r.get_u32();
+    func.insns = r.get_u32();
+    r.get(&func.exact, sizeof(func.exact));
+    r.get_str(&func.name);
+    func.match = 0;
+    func.how = DIFF_UNMATCHED;
+
+    // every record is 16 bytes at least, a damaged count doesn't allocate gigabytes
+    uint32_t blocks = r.get_u32();
+
+    if (blocks > (uint32_t)(r.end - r.p) / 16) {
+      return false;
+    }
+
+    func.blocks.resize(blocks);
+
+    for (diff_block_t& block : func.blocks) {
+      r.get(&block.start, sizeof(block.start));
+      block.size = r.get_u32();
+      r.get(&block.hash, sizeof(block.hash));
+    }
+
+    uint32_t callees = r.get_u32();
+
+    if (callees > (uint32_t)(r.end - r.p) / 4) {
+      return false;
+    }
+
+    func.callees.resize(callees);
+
+    for (uint32_t& callee : func.callees) {
+      callee = r.get_u32();
+    }
+
+    uint32_t notes = r.get_u32();
+
+    if (notes > (uint32_t)(r.end - r.p) / 11) {
+      return false;
+    }
+
+    func.notes.resize(notes);
+
+    for (diff_note_t& note : func.notes) {
+      r.get(&note.offset, sizeof(note.offset));
+      r.get(&note.kind, sizeof(note.kind));
+      note.value = r.get_u32();
+      r.get_str(&note.text);
+    }
+  }
+
+  return r.ok;
+}
+
+// callee eas become indexes, the calls of code outside the functions are dropped
+static void index_callees(qvector<diff_func_t>& funcs) {
+  std::unordered_map<uint32_t, uint32_t> indexes;
+
+  for (uint32_t i = 0; i < funcs.size(); ++i) {
+    indexes[(uint32_t)funcs[i].start_ea] = i;
+  }
+
+  for (diff_func_t& func : funcs) {
+    qvector<uint32_t> callees;
+
+    for (uint32_t callee : func.callees) {
+      auto it = indexes.find(callee);
+
+      if (it != indexes.end()) {
+        callees.push_back(it->second);
+      }
+    }
+
+    func.callees.swap(callees);
+  }
+}
+
+struct diff_t {
+  qvector<diff_func_t> olds; // from the file
+  qvector<diff_func_t> news; // this database
+  qvector<uint32_t> worklist; // matched olds whose callees weren't paired yet
+
+  void pair(uint32_t o, uint32_t n, diff_how_t how) {
+    olds[o].match = n + 1;
+    olds[o].how = how;
+    news[n].match = o + 1;
+    news[n].how = how;
+    worklist.push_back(o);
+  }
+
+  // percent of the blocks the two share, each block counted once
+  static uint32_t similarity(const diff_func_t& a, const diff_func_t& b) {
+    qvector<uint64_t> ha;
+    qvector<uint64_t> hb;
+
+    for (const diff_block_t& block : a.blocks) {
+      ha.push_back(block.hash);
+    }
+
+    for (const diff_block_t& block : b.blocks) {
+      hb.push_back(block.hash);
+    }
+
+    std::sort(ha.begin(), ha.end());
+    std::sort(hb.begin(), hb.end());
+
+    uint32_t shared = 0;
+
+    for (size_t i = 0, j = 0; i < ha.size() && j < hb.size();) {
+      if (ha[i] < hb[j]) {
+        i++;
+      }
+      else if (hb[j] < ha[i]) {
+        j++;
+      }
+      else {
+        shared++;
+        i++;
+        j++;
+      }
+    }
+
+    size_t total = ha.size() + hb.size();
+    return (total != 0) ? (uint32_t)(shared * 200 / total) : 0;
+  }
+
+  void match_exact() {
+    // key -> count and index of the last function, on each side
+    std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> by_old;
+    std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> by_new;
+
+    for (uint32_t i = 0; i < olds.size(); ++i) {
+      auto& slot = by_old[olds[i].exact];
+      slot.first++;
+      slot.second = i;
+    }
+
+    for (uint32_t i = 0; i < news.size(); ++i) {
+      auto& slot = by_new[news[i].exact];
+      slot.first++;
+      slot.second = i;
+    }
+
+    // copies of the same routine are left to the call graph, the pairs are made in the old functions' order
+    // so the call graph walks them the same way on each run
+    for (uint32_t i = 0; i < olds.size(); ++i) {
+      auto it = by_new.find(olds[i].exact);
+
+      if (by_old[olds[i].exact].first == 1 && it != by_new.end() && it->second.first == 1) {
+        pair(i, it->second.second, DIFF_EXACT);
+      }
+    }
+  }
+
+  // the n-th call of a pair calls the same routine on both sides
+  void match_calls() {
+    while (!worklist.empty()) {
+      uint32_t o = worklist.back();
+      worklist.pop_back();
+
+      const diff_func_t& old_func = olds[o];
+      const diff_func_t& new_func = news[old_func.match - 1];
+
+      if (old_func.callees.size() != new_func.callees.size()) {
+        continue;
+      }
+
+      for (size_t i = 0; i < old_func.callees.size(); ++i) {
+        uint32_t co = old_func.callees[i];
+        uint32_t cn = new_func.callees[i];
+
+        if (olds[co].match != 0 || news[cn].match != 0) {
+          continue;
+        }
+
+        if (olds[co].exact == news[cn].exact || similarity(olds[co], news[cn]) >= DIFF_MIN_SIMILARITY) {
+          pair(co, cn, DIFF_CALLS);
+        }
+      }
+    }
+  }
+
+  // the rare block hashes of the unmatched new functions are indexed, each unmatched old function
+  // counts the blocks it shares with the candidates, the best pairs are taken first
+  void match_blocks() {
+    std::unordered_map<uint64_t, qvector<uint32_t>> index;
+
+    for (uint32_t n = 0; n < news.size(); ++n) {
+      if (news[n].match != 0) {
+        continue;
+      }
+
+      for (const diff_block_t& block : news[n].blocks) {
+        qvector<uint32_t>& bucket = index[block.hash];
+
+        if (bucket.size() <= DIFF_BLOCK_BUCKET_MAX && (bucket.empty() || bucket.back() != n)) {
+          bucket.push_back(n);
+        }
+      }
+    }
+
+    struct candidate_t {
+      uint32_t score;
+      uint32_t o;
+      uint32_t n;
+    };
+
+    qvector<candidate_t> candidates;
+    std::unordered_map<uint32_t, uint32_t> counts;
+
+    for (uint32_t o = 0; o < olds.size(); ++o) {
+      if (olds[o].match != 0) {
+        continue;
+      }
+
+      counts.clear();
+
+      for (const diff_block_t& block : olds[o].blocks) {
+        auto it = index.find(block.hash);
+
+        if (it == index.end() || it->second.size() > DIFF_BLOCK_BUCKET_MAX) {
+          continue;
+        }
+
+        for (uint32_t n : it->second) {
+          counts[n]++;
+        }
+      }
+
+      for (const auto& kv : counts) {
+        uint32_t score = (uint32_t)(kv.second * 200 / (olds[o].blocks.size() + news[kv.first].blocks.size()));
+
+        if (score >= DIFF_MIN_SIMILARITY) {
+          candidates.push_back({ score, o, kv.first });
+        }
+      }
+    }
+
+    // the counts come in hash order, the ties go by index so the same pairs win on each run
+    std::sort(candidates.begin(), candidates.end(), [](const candidate_t& a, const candidate_t& b) {
+      if (a.score != b.score) {
+        return a.score > b.score;
+      }
+
+      return (a.o != b.o) ? a.o < b.o : a.n < b.n;
+    });
+
+    for (const candidate_t& c : candidates) {
+      if (olds[c.o].match == 0 && news[c.n].match == 0) {
+        pair(c.o, c.n, DIFF_BLOCKS);
+      }
+    }
+  }
+};
+
+struct diff_stats_t {
+  uint32_t names = 0;
+  uint32_t cmts = 0;
+  uint32_t modes = 0; // M/X, bank and DP overrides
+  uint32_t lost = 0; // notes in blocks that changed
+};
+
+static const diff_block_t* find_block(const qvector<diff_block_t>& blocks, int32_t offset) {
+  for (const diff_block_t& block : blocks) {
+    if (offset >= block.start && offset < block.start + (int32_t)block.size) {
+      return &block;
+    }
+  }
+
+  return nullptr;
+}
+
+// a block of the new function with the hash, if it has only one
+static const diff_block_t* find_same_block(const qvector<diff_block_t>& blocks, uint64_t hash) {
+  const diff_block_t* res = nullptr;
+
+  for (const diff_block_t& block : blocks) {
+    if (block.hash == hash) {
+      if (res != nullptr) {
+        return nullptr;
+      }
+
+      res = &block;
+    }
+  }
+
+  return res;
+}
+
+static bool set_missing_name(ea_t ea, const qstring& name) {
+  if (has_user_name(get_flags(ea))) {
+    return false;
+  }
+
+  if (set_name(ea, name.c_str(), SN_NOWARN | SN_NOCHECK)) {
+    return true;
+  }
+
+  qstring other;
+  other.sprnt("%s_%06X", name.c_str(), (uint32_t)ea);
+  return set_name(ea, other.c_str(), SN_NOWARN | SN_NOCHECK);
+}
+
+static void apply_note(func_t* pfn, ea_t ea, const diff_note_t& note, diff_stats_t* stats) {
+  qstring text;
+
+  switch (note.kind) {
+  case DIFF_NOTE_NAME:
+    stats->names += set_missing_name(ea, note.text) ? 1 : 0;
+    break;
+  case DIFF_NOTE_CMT:
+  case DIFF_NOTE_RPT_CMT: {
+    bool rpt = (note.kind == DIFF_NOTE_RPT_CMT);
+
+    if (get_cmt(&text, ea, rpt) <= 0 && set_cmt(ea, note.text.c_str(), rpt)) {
+      stats->cmts++;
+    }
+  } break;
+  case DIFF_NOTE_FUNC_CMT:
+  case DIFF_NOTE_FUNC_RPT_CMT: {
+    bool rpt = (note.kind == DIFF_NOTE_FUNC_RPT_CMT);
+
+    if (get_func_cmt(&text, pfn, rpt) <= 0 && set_func_cmt(pfn, note.text.c_str(), rpt)) {
+      stats->cmts++;
+    }
+  } break;
+  case DIFF_NOTE_MX:
+    if (!ea_is_manual_bitmode(ea)) {
+      bool redo = (ea_get_flags(ea) != (uint8_t)note.value);
+      ea_set_flags(ea, (uint8_t)note.value);
+      ea_set_manual_bitmode(ea, true);
+
+      // the immediates may have another size now
+      if (redo) {
+        del_items(ea, DELIT_SIMPLE);
+        auto_make_code(ea);
+      }
+
+      stats->modes++;
+    }
+    break;
+  case DIFF_NOTE_BANK:
+    if (ea_get_bank(ea) == BADADDR) {
+      ea_set_bank(ea, note.value);
+      stats->modes++;
+    }
+    break;
+  case DIFF_NOTE_DPAGE:
+    if (ea_get_dpage(ea) == BADADDR) {
+      ea_set_dpage(ea, (uint16_t)note.value);
+      stats->modes++;
+    }
+    break;
+  }
+}
+
+// a DB of the routine's own bank moves with it, WRAM and bank 0 stay, other ROM banks are unknown there
+static bool rebase_bank(const diff_func_t& old_func, const diff_func_t& new_func, diff_note_t* note) {
+  ea_t old_bank = old_func.start_ea & 0xFF0000;
+  ea_t new_bank = new_func.start_ea & 0xFF0000;
+  ea_t bank = note->value & 0xFF0000;
+
+  if (old_bank == new_bank || bank == 0x000000 || bank == 0x7E0000 || bank == 0x7F0000) {
+    return true;
+  }
+
+  if (bank == old_bank) {
+    note->value = (uint32_t)new_bank;
+    return true;
+  }
+
+  return false;
+}
+
+static void transfer(const diff_func_t& old_func, const diff_func_t& new_func, diff_stats_t* stats) {
+  func_t* pfn = get_func(new_func.start_ea);
+
+  if (pfn == nullptr) {
+    return;
+  }
+
+  if (!old_func.name.empty() && set_missing_name(new_func.start_ea, old_func.name)) {
+    stats->names++;
+  }
+
+  bool same = (old_func.exact == new_func.exact);
+
+  // the other notes move with their block, the blocks that changed keep theirs
+  for (const diff_note_t& note : old_func.notes) {
+    int32_t offset = note.offset;
+
+    if (!same && note.kind != DIFF_NOTE_FUNC_CMT && note.kind != DIFF_NOTE_FUNC_RPT_CMT) {
+      const diff_block_t* old_block = find_block(old_func.blocks, offset);
+      const diff_block_t* new_block = (old_block != nullptr) ? find_same_block(new_func.blocks, old_block->hash) : nullptr;
+
+      if (new_block == nullptr) {
+        stats->lost++;
+        continue;
+      }
+
+      offset = new_block->start + (offset - old_block->start);
+    }
+
+    if (note.kind == DIFF_NOTE_BANK) {
+      diff_note_t bank_note = note;
+
+      if (!rebase_bank(old_func, new_func, &bank_note)) {
+        stats->lost++;
+        continue;
+      }
+
+      apply_note(pfn, new_func.start_ea + offset, bank_note, stats);
+      continue;
+    }
+
+    apply_note(pfn, new_func.start_ea + offset, note, stats);
+  }
+}
+
+static const int diff_widths[] = {
+  CHCOL_HEX | 8,
+  CHCOL_PLAIN | 24,
+  CHCOL_PLAIN | 10,
+  CHCOL_HEX | 8,
+  CHCOL_PLAIN | 24,
+};
+
+static const char* const diff_header[] = {
+  "Address", "Function", "Match", "Other", "Other name",
+};
+
+CASSERT(qnumber(diff_widths) == qnumber(diff_header));
+
+struct diff_row_t {
+  ea_t start_ea;
+  diff_how_t how;
+  ea_t other_ea;
+  qstring other_name;
+};
+
+struct rom_diff_chooser_t : public chooser_t {
+  qvector<diff_row_t> rows;
+
+  rom_diff_chooser_t() : chooser_t(0, qnumber(diff_widths), diff_widths, diff_header, "ROM diff") {}
+
+  virtual size_t idaapi get_count() const override {
+    return rows.size();
+  }
+
+  virtual void idaapi get_row(qstrvec_t* cols, int* icon_, chooser_item_attrs_t* attrs, size_t n) const override {
+    const diff_row_t& row = rows[n];
+    (*cols)[0].sprnt("%06a", row.start_ea);
+    get_func_name(&(*cols)[1], row.start_ea);
+    (*cols)[2] = diff_how_names[row.how];
+
+    if (row.how != DIFF_UNMATCHED) {
+      (*cols)[3].sprnt("%06a", row.other_ea);
+      (*cols)[4] = row.other_name;
+    }
+  }
+
+  virtual ea_t idaapi get_ea(size_t n) const override {
+    return rows[n].start_ea;
+  }
+};
+
+int idaapi export_diff_action_t::activate(action_activation_ctx_t* ctx) {
+  const char* path = ask_file(true, "*.snd", "Save the analysis to diff another revision against");
+
+  if (path == nullptr) {
+    return 1;
+  }
+
+  show_wait_box("Hashing functions...");
+
+  qvector<diff_func_t> funcs;
+  bool ok = collect_funcs(funcs, true);
+
+  hide_wait_box();
+
+  if (!ok) {
+    return 1;
+  }
+
+  if (!save_diff(path, funcs)) {
+    warning("Can't write %s", path);
+    return 1;
+  }
+
+  msg("ROM diff: %u functions saved to %s\n", (uint32_t)funcs.size(), path);
+  return 1;
+}
+
+int idaapi rom_diff_action_t::activate(action_activation_ctx_t* ctx) {
+  const char* path = ask_file(false, "*.snd", "Select the analysis of the other revision");
+
+  if (path == nullptr) {
+    return 1;
+  }
+
+  diff_t diff;
+
+  if (!load_diff(path, diff.olds)) {
+    warning("%s isn't a ROM diff file of this version", path);
+    return 1;
+  }
+
+  show_wait_box("Hashing functions...");
+
+  if (!collect_funcs(diff.news, false)) {
+    hide_wait_box();
+    return 1;
+  }
+
+  replace_wait_box("Aligning functions...");
+
+  index_callees(diff.olds);
+  index_callees(diff.news);
+
+  diff.match_exact();
+  diff.match_calls();
+  diff.match_blocks();
+  diff.match_calls();
+
+  replace_wait_box("Transferring the analysis...");
+
+  diff_stats_t stats;
+  uint32_t counts[qnumber(diff_how_names)] = {};
+  rom_diff_chooser_t* ch = new rom_diff_chooser_t();
+
+  for (const diff_func_t& func : diff.news) {
+    diff_row_t& row = ch->rows.push_back();
+    row.start_ea = func.start_ea;
+    row.how = func.how;
+    row.other_ea = BADADDR;
+    counts[func.how]++;
+
+    if (func.match != 0) {
+      const diff_func_t& old_func = diff.olds[func.match - 1];
+      row.other_ea = old_func.start_ea;
+      row.other_name = old_func.name;
+      transfer(old_func, func, &stats);
+    }
+  }
+
+  hide_wait_box();
+
+  // what's left of the other revision: removed or rewritten code
+  uint32_t old_unmatched = 0;
+
+  for (const diff_func_t& func : diff.olds) {
+    if (func.match == 0) {
+      msg("ROM diff: %06X %s has no counterpart here\n", (uint32_t)func.start_ea, func.name.empty() ? "" : func.name.c_str());
+      old_unmatched++;
+    }
+  }
+
+  msg("ROM diff: %u of %u functions matched (%u exact, %u by calls, %u by blocks), %u unmatched here, %u unmatched there\n",
+    (uint32_t)diff.news.size() - counts[DIFF_UNMATCHED], (uint32_t)diff.news.size(), counts[DIFF_EXACT], counts[DIFF_CALLS],
+    counts[DIFF_BLOCKS], counts[DIFF_UNMATCHED], old_unmatched);
+  msg("ROM diff: %u names, %u comments, %u M/X, bank and DP overrides transferred, %u left in changed blocks\n",
+    stats.names, stats.cmts, stats.modes, stats.lost);
+
+  ch->choose();
+  return 1;
+}
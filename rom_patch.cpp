@@ -0,0 +1,405 @@
+#include "rom_patch.hpp"
+#include <algorithm>
+
+// one pass over the patch for each format, the records are applied as they are read
+
+#define PATCH_FOOTER_SIZE 12 // source, target and patch CRC32
+
+class patch_reader_t {
+public:
+	patch_reader_t(const bytevec_t& patch, size_t end) : _data(patch.empty() ? nullptr : &patch[0]), _end(end) {}
+
+	bool eof() const {
+		return _pos >= _end;
+	}
+
+	bool read(uint8_t* value) {
+		if (_pos >= _end) {
+			return false;
+		}
+
+		*value = _data[_pos++];
+		return true;
+	}
+
+	bool read_be(uint32_t* value, int bytes) {
+		uint32_t res = 0;
+
+		for (int i = 0; i < bytes; i++) {
+			uint8_t b;
+
+			if (!read(&b)) {
+				return false;
+			}
+
+			res = (res << 8) | b;
+		}
+
+		*value = res;
+		return true;
+	}
+
+	// BPS/UPS variable length number: 7 bits per byte, the last one has bit 7 set
+	bool read_number(uint64_t* value) {
+		uint64_t res = 0;
+		uint64_t shift = 1;
+
+		for (int i = 0; i < 10; i++) {
+			uint8_t b;
+
+			if (!read(&b)) {
+				return false;
+			}
+
+			res += (b & 0x7F) * shift;
+
+			if (b & 0x80) {
+				*value = res;
+				return true;
+			}
+
+			shift <<= 7;
+			res += shift;
+		}
+
+		return false;
+	}
+
+	const uint8_t* take(size_t size) {
+		if (_end - _pos < size) {
+			return nullptr;
+		}
+
+		const uint8_t* res = &_data[_pos];
+		_pos += size;
+		return res;
+	}
+
+private:
+	const uint8_t* _data;
+	size_t _pos = 0;
+	size_t _end;
+};
+
+static inline uint32_t read_le32(const uint8_t* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void add_range(rom_patch_ranges_t& ranges, uint64_t offset, uint64_t size) {
+	if (size == 0) {
+		return;
+	}
+
+	// the records are mostly ascending, so the adjacent ones merge here already
+	if (!ranges.empty()) {
+		rom_patch_range_t& last = ranges.back();
+
+		if (offset >= last.offset && offset <= (uint64_t)last.offset + last.size) {
+			last.size = (uint32_t)std::max<uint64_t>(last.size, offset + size - last.offset);
+			return;
+		}
+	}
+
+	rom_patch_range_t r = { (uint32_t)offset, (uint32_t)size };
+	ranges.push_back(r);
+}
+
+static void merge_ranges(rom_patch_ranges_t& ranges) {
+	std::sort(ranges.begin(), ranges.end(), [](const rom_patch_range_t& a, const rom_patch_range_t& b) {
+		return a.offset < b.offset;
+	});
+
+	rom_patch_ranges_t res;
+
+	for (const rom_patch_range_t& r : ranges) {
+		add_range(res, r.offset, r.size);
+	}
+
+	ranges.swap(res);
+}
+
+static bool apply_ips(const bytevec_t& patch, bytevec_t& rom, rom_patch_ranges_t& ranges, qstring* error) {
+	patch_reader_t rd(patch, patch.size());
+	rd.take(5); // PATCH
+
+	for (;;) {
+		uint32_t offset;
+
+		if (!rd.read_be(&offset, 3)) {
+			*error = "IPS: no EOF marker";
+			return false;
+		}
+
+		if (offset == 0x454F46) { // EOF
+			break;
+		}
+
+		uint32_t size;
+
+		if (!rd.read_be(&size, 2)) {
+			*error = "IPS: truncated record";
+			return false;
+		}
+
+		const uint8_t* data = nullptr;
+		uint8_t fill = 0;
+
+		if (size == 0) { // RLE
+			if (!rd.read_be(&size, 2) || !rd.read(&fill)) {
+				*error = "IPS: truncated RLE record";
+				return false;
+			}
+		}
+		else if ((data = rd.take(size)) == nullptr) {
+			*error = "IPS: truncated record";
+			return false;
+		}
+
+		if (offset + size > rom.size()) {
+			rom.resize(offset + size, 0);
+		}
+
+		if (data != nullptr) {
+			memcpy(&rom[offset], data, size);
+		}
+		else {
+			memset(&rom[offset], fill, size);
+		}
+
+		add_range(ranges, offset, size);
+	}
+
+	// Lunar IPS extension: the size to truncate to
+	uint32_t truncate;
+
+	if (rd.read_be(&truncate, 3) && truncate < rom.size()) {
+		rom.resize(truncate);
+	}
+
+	return true;
+}
+
+static bool check_footer(const bytevec_t& patch, const char* format, qstring* error) {
+	if (patch.size() < 4 + PATCH_FOOTER_SIZE) {
+		error->sprnt("%s: patch is too small", format);
+		return false;
+	}
+
+	if (calc_crc32(0, &patch[0], patch.size() - 4) != read_le32(&patch[patch.size() - 4])) {
+		error->sprnt("%s: patch CRC32 mismatch", format);
+		return false;
+	}
+
+	return true;
+}
+
+static bool check_crc(const bytevec_t& data, uint32_t crc, const char* format, const char* what, qstring* error) {
+	if (calc_crc32(0, data.empty() ? nullptr : &data[0], data.size()) != crc) {
+		error->sprnt("%s: %s CRC32 mismatch, wrong ROM?", format, what);
+		return false;
+	}
+
+	return true;
+}
+
+static bool apply_bps(const bytevec_t& patch, bytevec_t& rom, rom_patch_ranges_t& ranges, qstring* error) {
+	if (!check_footer(patch, "BPS", error)) {
+		return false;
+	}
+
+	const uint8_t* footer = &patch[patch.size() - PATCH_FOOTER_SIZE];
+
+	if (!check_crc(rom, read_le32(footer), "BPS", "source", error)) {
+		return false;
+	}
+
+	patch_reader_t rd(patch, patch.size() - PATCH_FOOTER_SIZE);
+	rd.take(4); // BPS1
+
+	uint64_t source_size, target_size, metadata_size;
+
+	if (!rd.read_number(&source_size) || !rd.read_number(&target_size) || !rd.read_number(&metadata_size) || rd.take((size_t)metadata_size) == nullptr) {
+		*error = "BPS: bad header";
+		return false;
+	}
+
+	if (source_size != rom.size() || target_size > 0x2000000) {
+		*error = "BPS: the ROM size doesn't match";
+		return false;
+	}
+
+	bytevec_t target;
+	target.resize((size_t)target_size, 0);
+
+	uint64_t out = 0;
+	int64_t source_rel = 0;
+	int64_t target_rel = 0;
+
+	while (!rd.eof()) {
+		uint64_t data;
+
+		if (!rd.read_number(&data)) {
+			*error = "BPS: truncated action";
+			return false;
+		}
+
+		uint64_t length = (data >> 2) + 1;
+
+		if (out + length > target_size) {
+			*error = "BPS: action past the end of the target";
+			return false;
+		}
+
+		switch (data & 3) {
+		case 0: { // SourceRead
+			if (out + length > source_size) {
+				*error = "BPS: SourceRead past the end of the source";
+				return false;
+			}
+
+			memcpy(&target[(size_t)out], &rom[(size_t)out], (size_t)length);
+		} break;
+		case 1: { // TargetRead
+			const uint8_t* bytes = rd.take((size_t)length);
+
+			if (bytes == nullptr) {
+				*error = "BPS: truncated TargetRead";
+				return false;
+			}
+
+			memcpy(&target[(size_t)out], bytes, (size_t)length);
+			add_range(ranges, out, length);
+		} break;
+		case 2: // SourceCopy
+		case 3: { // TargetCopy
+			uint64_t rel;
+
+			if (!rd.read_number(&rel)) {
+				*error = "BPS: truncated copy";
+				return false;
+			}
+
+			bool from_source = (data & 3) == 2;
+			int64_t& base = from_source ? source_rel : target_rel;
+			base += (rel & 1) ? -(int64_t)(rel >> 1) : (int64_t)(rel >> 1);
+
+			// TargetCopy may overlap the output, it's a byte by byte copy (RLE)
+			const bytevec_t& from = from_source ? rom : target;
+			bool in_range = from_source ? (base >= 0 && (uint64_t)base + length <= source_size) : (base >= 0 && (uint64_t)base < out);
+
+			if (!in_range) {
+				*error = "BPS: copy out of range";
+				return false;
+			}
+
+			for (uint64_t i = 0; i < length; i++) {
+				target[(size_t)(out + i)] = from[(size_t)base++];
+			}
+
+			add_range(ranges, out, length);
+		} break;
+		}
+
+		out += length;
+	}
+
+	if (!check_crc(target, read_le32(footer + 4), "BPS", "target", error)) {
+		return false;
+	}
+
+	rom.swap(target);
+	return true;
+}
+
+static bool apply_ups(const bytevec_t& patch, bytevec_t& rom, rom_patch_ranges_t& ranges, qstring* error) {
+	if (!check_footer(patch, "UPS", error)) {
+		return false;
+	}
+
+	const uint8_t* footer = &patch[patch.size() - PATCH_FOOTER_SIZE];
+	patch_reader_t rd(patch, patch.size() - PATCH_FOOTER_SIZE);
+	rd.take(4); // UPS1
+
+	uint64_t input_size, output_size;
+
+	if (!rd.read_number(&input_size) || !rd.read_number(&output_size) || output_size > 0x2000000) {
+		*error = "UPS: bad header";
+		return false;
+	}
+
+	// UPS patches work both ways
+	bool reverse = (rom.size() == output_size && input_size != output_size);
+
+	if (rom.size() != (reverse ? output_size : input_size)) {
+		*error = "UPS: the ROM size doesn't match";
+		return false;
+	}
+
+	if (!check_crc(rom, read_le32(footer + (reverse ? 4 : 0)), "UPS", "source", error)) {
+		return false;
+	}
+
+	rom.resize((size_t)(reverse ? input_size : output_size), 0);
+
+	uint64_t pos = 0;
+
+	while (!rd.eof()) {
+		uint64_t skip;
+
+		if (!rd.read_number(&skip)) {
+			*error = "UPS: truncated record";
+			return false;
+		}
+
+		pos += skip;
+		uint64_t start = pos;
+
+		for (;;) {
+			uint8_t x;
+
+			if (!rd.read(&x)) {
+				*error = "UPS: truncated record";
+				return false;
+			}
+
+			if (x == 0) {
+				break;
+			}
+
+			if (pos < rom.size()) {
+				rom[(size_t)pos] ^= x;
+			}
+
+			pos++;
+		}
+
+		add_range(ranges, start, std::min<uint64_t>(pos, rom.size()) - std::min<uint64_t>(start, rom.size()));
+		pos++;
+	}
+
+	return check_crc(rom, read_le32(footer + (reverse ? 0 : 4)), "UPS", "target", error);
+}
+
+bool apply_rom_patch(const bytevec_t& patch, bytevec_t& rom, rom_patch_ranges_t& ranges, qstring* error) {
+	bool ok;
+
+	if (patch.size() >= 8 && memcmp(&patch[0], "PATCH", 5) == 0) {
+		ok = apply_ips(patch, rom, ranges, error);
+	}
+	else if (patch.size() >= 4 && memcmp(&patch[0], "BPS1", 4) == 0) {
+		ok = apply_bps(patch, rom, ranges, error);
+	}
+	else if (patch.size() >= 4 && memcmp(&patch[0], "UPS1", 4) == 0) {
+		ok = apply_ups(patch, rom, ranges, error);
+	}
+	else {
+		*error = "unknown patch format (not IPS, BPS or UPS)";
+		return false;
+	}
+
+	if (ok) {
+		merge_ranges(ranges);
+	}
+
+	return ok;
+}
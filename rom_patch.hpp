@@ -0,0 +1,15 @@
+#pragma once
+
+#include <pro.h>
+
+// IPS/BPS/UPS patches applied by the loader to the ROM file image before it's mapped
+
+struct rom_patch_range_t {
+	uint32_t offset; // in the patched file, with the copier header if any
+	uint32_t size;
+};
+
+typedef qvector<rom_patch_range_t> rom_patch_ranges_t;
+
+// the patched image replaces rom, the bytes it changed are merged into ranges
+bool apply_rom_patch(const bytevec_t& patch, bytevec_t& rom, rom_patch_ranges_t& ranges, qstring* error);
@@ -0,0 +1,460 @@
+#include "65816.hpp"
+#include "ram_image.hpp"
+#include "mapped_file.hpp"
+#include <kernwin.hpp>
+#include <auto.hpp>
+#include <segment.hpp>
+#include <compress.hpp>
+#include <ctype.h>
+
+// snes9x savestates are gzip'd "#!s9xsnp" files of "NAM:000123:" blocks, Mesen ones an "MSS" header,
+// a screenshot and the rom name before a zlib'd stream of "key\0", uint32_t size, value records.
+// bsnes states are a raw dump of its components that changes with each version, they aren't supported.
+// The state is inflated once, the RAM images are written to the database from that buffer.
+
+#define SS_WRAM 0x01
+#define SS_SRAM 0x02
+#define SS_PPU 0x04
+#define SS_CPU 0x08
+
+#define S9X_HEADER_SIZE 14 // "#!s9xsnp:0011\n"
+#define S9X_BLOCK_HEADER_SIZE 11 // "RAM:131072:"
+#define S9X_REGS_SIZE 16 // PB, DB, P, A, D, S, X, Y, PC big endian
+
+struct ss_block_t {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+};
+
+struct savestate_t {
+  ss_block_t wram;
+  ss_block_t sram;
+  ss_block_t vram;
+  ss_block_t cgram;
+  ss_block_t oam;
+
+  bool has_cpu = false;
+  uint32_t pc = 0; // with the program bank
+  uint8_t db = 0;
+  uint16_t d = 0;
+  uint8_t p = 0;
+  bool emulation = false;
+};
+
+struct inflate_ctx_t {
+  const uint8_t* in;
+  size_t size;
+  size_t pos;
+  bytevec_t* out;
+};
+
+static ssize_t idaapi inflate_reader(void* ud, void* buf, size_t size) {
+  inflate_ctx_t* ctx = (inflate_ctx_t*)ud;
+  size_t n = std::min(size, ctx->size - ctx->pos);
+
+  memcpy(buf, ctx->in + ctx->pos, n);
+  ctx->pos += n;
+  return (ssize_t)n;
+}
+
+static ssize_t idaapi inflate_writer(void* ud, const void* buf, size_t size) {
+  inflate_ctx_t* ctx = (inflate_ctx_t*)ud;
+  const uint8_t* p = (const uint8_t*)buf;
+
+  ctx->out->insert(ctx->out->end(), p, p + size);
+  return (ssize_t)size;
+}
+
+// raw deflate, the gzip/zlib header is skipped by the callers
+static bool inflate_raw(const uint8_t* in, size_t size, bytevec_t* out) {
+  inflate_ctx_t ctx = { in, size, 0, out };
+  return zip_inflate(&ctx, inflate_reader, inflate_writer) == PKZ_OK && !out->empty();
+}
+
+static bool skip_gzip_header(const uint8_t* p, size_t size, size_t* pos) {
+  if (size < 18 || p[0] != 0x1F || p[1] != 0x8B || p[2] != 8) {
+    return false;
+  }
+
+  uint8_t flags = p[3];
+  size_t i = 10;
+
+  if (flags & 0x04) { // FEXTRA
+    i += 2 + (p[i] | (p[i + 1] << 8));
+  }
+
+  for (uint8_t zstr = 0x08; zstr <= 0x10; zstr <<= 1) { // FNAME, FCOMMENT
+    if (flags & zstr) {
+      while (i < size && p[i] != 0) {
+        i++;
+      }
+      i++;
+    }
+  }
+
+  if (flags & 0x02) { // FHCRC
+    i += 2;
+  }
+
+  *pos = i;
+  return i < size;
+}
+
+static bool skip_zlib_header(const uint8_t* p, size_t size, size_t* pos) {
+  if (size < 6 || (p[0] & 0x0F) != 8 || ((p[0] << 8) | p[1]) % 31 != 0) {
+    return false;
+  }
+
+  *pos = (p[1] & 0x20) ? 6 : 2; // FDICT
+  return *pos < size;
+}
+
+static inline uint32_t read_u32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool parse_s9x_len(const uint8_t* p, uint32_t* len) {
+  uint32_t res = 0;
+
+  for (int i = 0; i < 6; ++i) {
+    if (p[i] < '0' || p[i] > '9') {
+      return false;
+    }
+
+    res = res * 10 + (p[i] - '0');
+  }
+
+  *len = res;
+  return true;
+}
+
+static bool parse_snes9x(const uint8_t* data, size_t size, savestate_t* st) {
+  static const char magic[] = "#!s9xsnp:";
+
+  if (size < S9X_HEADER_SIZE || memcmp(data, magic, sizeof(magic) - 1) != 0) {
+    return false;
+  }
+
+  size_t pos = S9X_HEADER_SIZE;
+
+  while (pos + S9X_BLOCK_HEADER_SIZE <= size) {
+    const uint8_t* hdr = &data[pos];
+    uint32_t len;
+
+    if (hdr[3] != ':' || hdr[10] != ':' || !parse_s9x_len(hdr + 4, &len) || pos + S9X_BLOCK_HEADER_SIZE + len > size) {
+      break;
+    }
+
+    ss_block_t block;
+    block.data = hdr + S9X_BLOCK_HEADER_SIZE;
+    block.size = len;
+
+    if (memcmp(hdr, "RAM", 3) == 0) {
+      st->wram = block;
+    }
+    else if (memcmp(hdr, "SRA", 3) == 0) {
+      st->sram = block;
+    }
+    else if (memcmp(hdr, "VRA", 3) == 0) {
+      st->vram = block;
+    }
+    else if (memcmp(hdr, "REG", 3) == 0 && len >= S9X_REGS_SIZE) {
+      const uint8_t* r = block.data;
+
+      st->pc = (r[0] << 16) | (r[14] << 8) | r[15];
+      st->db = r[1];
+      st->p = r[3];
+      st->emulation = (r[2] & 0x01) != 0; // bit 8 of P.W
+      st->d = (uint16_t)((r[6] << 8) | r[7]);
+      st->has_cpu = true;
+    }
+
+    pos += S9X_BLOCK_HEADER_SIZE + len;
+  }
+
+  return st->wram.data != nullptr || st->has_cpu;
+}
+
+// "cpu._state.PC" -> "cpu", "pc": lower case, no underscores, "state" parts skipped
+static void split_mss_key(const char* key, qstring* owner, qstring* field) {
+  qstring parts[2];
+  qstring part;
+
+  for (const char* p = key;; ++p) {
+    if (*p == '.' || *p == '\0') {
+      if (!part.empty() && part != "state") {
+        parts[0] = parts[1];
+        parts[1] = part;
+      }
+
+      part.qclear();
+
+      if (*p == '\0') {
+        break;
+      }
+    }
+    else if (*p != '_') {
+      part.append((char)tolower((uchar)*p));
+    }
+  }
+
+  *owner = parts[0];
+  *field = parts[1];
+}
+
+static uint32_t mss_value(const ss_block_t& value) {
+  uint32_t res = 0;
+
+  for (size_t i = 0; i < value.size && i < 4; ++i) {
+    res |= value.data[i] << (i * 8);
+  }
+
+  return res;
+}
+
+static bool parse_mss_records(const bytevec_t& data, savestate_t* st) {
+  size_t pos = 0;
+  bool has_pc = false;
+  bool has_regs[5] = {};
+
+  while (pos < data.size()) {
+    const char* key = (const char*)&data[pos];
+    const char* key_end = (const char*)memchr(key, 0, data.size() - pos);
+
+    if (key_end == nullptr || pos + (key_end - key) + 1 + 4 > data.size()) {
+      return false;
+    }
+
+    size_t key_len = key_end - key;
+
+    pos += key_len + 1;
+
+    ss_block_t value;
+    value.size = read_u32(&data[pos]);
+    value.data = &data[pos + 4];
+    pos += 4;
+
+    if (pos + value.size > data.size()) {
+      return false;
+    }
+
+    pos += value.size;
+
+    qstring owner, field;
+    split_mss_key(key, &owner, &field);
+
+    if (owner == "memorymanager" && field == "workram") {
+      st->wram = value;
+    }
+    else if (owner == "cart" && field == "saveram") {
+      st->sram = value;
+    }
+    else if (owner == "ppu" && field == "vram") {
+      st->vram = value;
+    }
+    else if (owner == "ppu" && field == "cgram") {
+      st->cgram = value;
+    }
+    else if (owner == "ppu" && (field == "oamram" || field == "oam")) {
+      st->oam = value;
+    }
+    else if (owner == "cpu") {
+      // the SNES CPU is saved before the coprocessors with a "cpu" of their own
+      static const char* const regs[] = { "pc", "k", "dbr", "d", "ps" };
+
+      for (size_t i = 0; i < qnumber(regs); ++i) {
+        if (field != regs[i] || has_regs[i]) {
+          continue;
+        }
+
+        uint32_t val = mss_value(value);
+        has_regs[i] = true;
+
+        switch (i) {
+        case 0: st->pc |= val & 0xFFFF; has_pc = true; break;
+        case 1: st->pc |= (val & 0xFF) << 16; break;
+        case 2: st->db = (uint8_t)val; break;
+        case 3: st->d = (uint16_t)val; break;
+        case 4: st->p = (uint8_t)val; break;
+        }
+      }
+
+      if (field == "emulationmode") {
+        st->emulation = mss_value(value) != 0;
+      }
+    }
+  }
+
+  st->has_cpu = has_pc;
+  return true;
+}
+
+static bool parse_mesen(const uint8_t* file, size_t size, bytevec_t* data, savestate_t* st) {
+  if (size < 16 || memcmp(file, "MSS", 3) != 0) {
+    return false;
+  }
+
+  // the screenshot and rom name before the state changed across the versions, the state is the tail of
+  // the file: uint32_t inflated size, uint32_t deflated size, the zlib stream
+  for (size_t pos = 15; pos + 8 < size; ++pos) {
+    uint32_t inflated = read_u32(&file[pos]);
+    uint32_t deflated = read_u32(&file[pos + 4]);
+    size_t zpos;
+
+    if ((size_t)deflated != size - pos - 8 || !skip_zlib_header(&file[pos + 8], deflated, &zpos)) {
+      continue;
+    }
+
+    data->qclear();
+    data->reserve(inflated);
+
+    if (inflate_raw(&file[pos + 8 + zpos], deflated - zpos, data) && data->size() == inflated) {
+      return parse_mss_records(*data, st);
+    }
+  }
+
+  return false;
+}
+
+static bool put_ppu_segment(ea_t ea, const char* name, const ss_block_t& block) {
+  if (block.data == nullptr || block.size == 0) {
+    return false;
+  }
+
+  segment_t* seg = getseg(ea);
+
+  if (seg == nullptr) {
+    segment_t s;
+    s.start_ea = ea;
+    s.end_ea = ea + block.size;
+    s.type = SEG_DATA;
+    s.bitness = 1;
+    s.perm = SEGPERM_READ | SEGPERM_WRITE;
+
+    if (!add_segm_ex(&s, name, "DATA", ADDSEG_NOSREG | ADDSEG_QUIET)) {
+      return false;
+    }
+
+    seg = getseg(ea);
+  }
+
+  mem2base(block.data, ea, ea + std::min<asize_t>(block.size, seg->size()), -1);
+  return true;
+}
+
+// the saved PC is an address the CPU ran at with these registers, like a trace record
+static bool seed_saved_pc(const savestate_t& st) {
+  ea_t ea = canon_ea(st.pc);
+
+  if (!is_mapped(ea)) {
+    return false;
+  }
+
+  // the user's M/X stay
+  if (!ea_is_manual_bitmode(ea)) {
+    uint8_t flags = ea_get_flags(ea);
+    setflag(flags, (uint8_t)m65816_flags::MemoryMode8, st.emulation || (st.p & m65816_flags::MemoryMode8) != 0);
+    setflag(flags, (uint8_t)m65816_flags::IndexMode8, st.emulation || (st.p & m65816_flags::IndexMode8) != 0);
+
+    ea_set_flags(ea, flags);
+    ea_set_observed_bitmode(ea, true);
+  }
+
+  ea_set_dpage(ea, st.d);
+
+  if (ea_get_bank(ea) == BADADDR && is_data_bank_mode(get_byte(ea))) {
+    ea_set_bank(ea, (ea_t)st.db << 16);
+  }
+
+  auto_make_code(ea);
+  return true;
+}
+
+int idaapi import_savestate_action_t::activate(action_activation_ctx_t* ctx) {
+  static const char form[] =
+    "Savestate import\n"
+    "\n"
+    "<~W~RAM:C>\n"
+    "<~S~RAM:C>\n"
+    "<~V~RAM, CGRAM and OAM segments:C>\n"
+    "<~C~PU registers, analyze at the saved PC:C>>\n"
+    "\n";
+
+  const char* path = ask_file(false, "*.000;*.001;*.002;*.003;*.004;*.005;*.006;*.007;*.008;*.009;*.frz;*.mss", "Select snes9x/Mesen savestate");
+
+  if (path == nullptr) {
+    return 1;
+  }
+
+  ushort what = SS_WRAM | SS_SRAM | SS_CPU;
+
+  if (ask_form(form, &what) <= 0) {
+    return 1;
+  }
+
+  mapped_file_t file;
+
+  if (!file.open(path)) {
+    warning("Can't open savestate %s", path);
+    return 1;
+  }
+
+  show_wait_box("Reading savestate...");
+
+  const uint8_t* raw = file.data();
+  size_t size = (size_t)file.size();
+  bytevec_t data;
+  savestate_t st;
+  size_t zpos;
+  bool ok;
+
+  if (skip_gzip_header(raw, size, &zpos)) {
+    ok = inflate_raw(raw + zpos, size - zpos, &data) && parse_snes9x(data.data(), data.size(), &st);
+  }
+  else if (size >= 3 && memcmp(raw, "MSS", 3) == 0) {
+    ok = parse_mesen(raw, size, &data, &st);
+  }
+  else {
+    ok = parse_snes9x(raw, size, &st);
+  }
+
+  if (!ok) {
+    hide_wait_box();
+    warning("%s isn't a snes9x or Mesen savestate", path);
+    return 1;
+  }
+
+  qstring loaded;
+
+  if ((what & SS_WRAM) && st.wram.data != nullptr && put_wram_image(st.wram.data, st.wram.size)) {
+    loaded += " WRAM";
+  }
+
+  if ((what & SS_SRAM) && st.sram.data != nullptr && put_sram_image(st.sram.data, st.sram.size)) {
+    loaded += " SRAM";
+  }
+
+  if (what & SS_PPU) {
+    loaded += put_ppu_segment(PPU_VRAM_EA, "VRAM", st.vram) ? " VRAM" : "";
+    loaded += put_ppu_segment(PPU_CGRAM_EA, "CGRAM", st.cgram) ? " CGRAM" : "";
+    loaded += put_ppu_segment(PPU_OAM_EA, "OAM", st.oam) ? " OAM" : "";
+  }
+
+  // the cached insns of the RAM decoded the old bytes
+  cache->clear();
+
+  if ((what & SS_CPU) && st.has_cpu && seed_saved_pc(st)) {
+    loaded.cat_sprnt(" PC=%06X", st.pc);
+  }
+
+  hide_wait_box();
+  request_refresh(IWID_DISASMS);
+
+  msg("Savestate:%s\n", loaded.empty() ? " nothing loaded" : loaded.c_str());
+
+  if ((what & SS_CPU) && st.has_cpu) {
+    jumpto(canon_ea(st.pc));
+  }
+
+  return 1;
+}
@@ -0,0 +1,454 @@
+#include "65816.hpp"
+#include <bytes.hpp>
+#include <funcs.hpp>
+#include <name.hpp>
+#include <segment.hpp>
+#include <kernwin.hpp>
+#include <diskio.hpp>
+#include "mapped_file.hpp"
+#include <algorithm>
+
+static inline uint32_t fnv1a(uint32_t hash, uint8_t byte) {
+  return (hash ^ byte) * 0x01000193;
+}
+
+static uint32_t hash_key(const uint8_t* data, uint16_t key_mask) {
+  uint32_t hash = 0x811C9DC5 ^ key_mask;
+
+  for (int i = 0; i < SIG_KEY_SIZE; ++i) {
+    hash = fnv1a(hash, (key_mask & (1 << i)) ? data[i] : 0);
+  }
+
+  return hash;
+}
+
+static inline int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+
+  return -1;
+}
+
+// operand bytes another game has different: its variables, its banks and code addresses. Immediates,
+// branches, stack offsets and the hardware registers stay
+static uint32_t get_sig_operand_mask(const uint8_t* bytes, asize_t size) {
+  uint16_t offset = (size >= 3) ? (uint16_t)(bytes[1] | (bytes[2] << 8)) : 0;
+  ea_t addr = (size >= 4) ? ((bytes[3] << 16) | offset) : offset;
+
+  switch (m65816_OpMode[bytes[0]]) {
+  case M::Dp:
+  case M::Dps:
+  case M::Dpx:
+  case M::Dpy:
+  case M::Idp:
+  case M::Idx:
+  case M::Idy:
+  case M::Idl:
+  case M::Idly:
+  case M::Absp:
+  case M::Ablp:
+  case M::Ind:
+  case M::Iax:
+  case M::Ial:
+  case M::Bm:
+    return 0x7;
+  case M::Absd:
+  case M::Abx:
+  case M::Aby:
+  case M::Abld:
+  case M::Alx:
+    return (get_hwreg(addr) != 0) ? 0 : 0x7;
+  default:
+    return 0;
+  }
+}
+
+void sig_library_t::clear() {
+  sigs.clear();
+  bytes.clear();
+  names.clear();
+  key_masks.clear();
+  buckets.clear();
+  chain.clear();
+  files = 0;
+}
+
+// <pattern> <name>, ';' or '#' starts a comment
+bool sig_library_t::load_file(const char* path) {
+  mapped_file_t file;
+
+  if (!file.open(path)) {
+    return false;
+  }
+
+  const char* p = (const char*)file.data();
+  const char* end = p + file.size();
+  uint8_t pattern[SIG_MAX_SIZE];
+  uint8_t mask[SIG_MAX_SIZE];
+
+  while (p < end) {
+    const char* line_end = (const char*)memchr(p, '\n', end - p);
+
+    if (line_end == nullptr) {
+      line_end = end;
+    }
+
+    const char* s = p;
+    p = line_end + 1;
+
+    while (s < line_end && qisspace(*s)) {
+      s++;
+    }
+
+    if (s == line_end || *s == ';' || *s == '#') {
+      continue;
+    }
+
+    int size = 0;
+    bool ok = true;
+
+    for (; s + 1 < line_end && !qisspace(*s); s += 2) {
+      if (size == SIG_MAX_SIZE) {
+        ok = false;
+        break;
+      }
+
+      if (s[0] == '.' && s[1] == '.') {
+        pattern[size] = 0;
+        mask[size++] = 0;
+        continue;
+      }
+
+      int hi = hex_value(s[0]);
+      int lo = hex_value(s[1]);
+
+      if (hi < 0 || lo < 0) {
+        ok = false;
+        break;
+      }
+
+      pattern[size] = (uint8_t)((hi << 4) | lo);
+      mask[size++] = 0xFF;
+    }
+
+    while (s < line_end && qisspace(*s)) {
+      s++;
+    }
+
+    const char* name = s;
+
+    while (s < line_end && !qisspace(*s) && *s != ';') {
+      s++;
+    }
+
+    if (!ok || size < SIG_KEY_SIZE || s == name) {
+      continue;
+    }
+
+    sig_entry_t sig = {};
+    sig.pattern_off = (uint32_t)bytes.size();
+    sig.name_off = (uint32_t)names.size();
+    sig.size = (uint8_t)size;
+
+    for (int i = 0; i < SIG_KEY_SIZE; ++i) {
+      sig.key_mask |= (uint16_t)((mask[i] != 0) ? (1 << i) : 0);
+    }
+
+    // a key of wildcards only would be looked up for every function
+    if (sig.key_mask == 0) {
+      continue;
+    }
+
+    bytes.insert(bytes.end(), pattern, pattern + size);
+    bytes.insert(bytes.end(), mask, mask + size);
+    names.insert(names.end(), name, s);
+    names.push_back('\0');
+    sigs.push_back(sig);
+  }
+
+  files++;
+  return true;
+}
+
+struct sig_file_visitor_t : public file_enumerator_t {
+  sig_library_t* library;
+
+  sig_file_visitor_t(sig_library_t* _library) : library(_library) {}
+
+  virtual int visit_file(const char* file) override {
+    library->load_file(file);
+    return 0;
+  }
+};
+
+uint32_t sig_library_t::load_dirs() {
+  clear();
+
+  char dir[QMAXPATH];
+  sig_file_visitor_t visitor(this);
+
+  qmakepath(dir, sizeof(dir), idadir("sig"), "snes", nullptr);
+  enumerate_files(nullptr, 0, dir, "*.snsig", visitor);
+
+  qmakepath(dir, sizeof(dir), get_user_idadir(), "sig", "snes", nullptr);
+  enumerate_files(nullptr, 0, dir, "*.snsig", visitor);
+
+  build_index();
+
+  if (!sigs.empty()) {
+    msg("Signatures: %u loaded from %u files\n", (uint32_t)sigs.size(), files);
+  }
+
+  return (uint32_t)sigs.size();
+}
+
+void sig_library_t::build_index() {
+  size_t count = 64;
+
+  while (count < sigs.size() * 2) {
+    count *= 2;
+  }
+
+  buckets.clear();
+  buckets.resize(count, 0);
+  chain.resize(sigs.size(), 0);
+  key_masks.clear();
+
+  for (uint32_t i = 0; i < sigs.size(); ++i) {
+    const sig_entry_t& sig = sigs[i];
+    uint32_t bucket = hash_key(&bytes[sig.pattern_off], sig.key_mask) & (count - 1);
+    chain[i] = buckets[bucket];
+    buckets[bucket] = i + 1;
+    key_masks.push_back(sig.key_mask);
+  }
+
+  std::sort(key_masks.begin(), key_masks.end());
+  key_masks.resize(std::unique(key_masks.begin(), key_masks.end()) - key_masks.begin());
+}
+
+static bool matches(const uint8_t* pattern, const uint8_t* data, size_t size) {
+  const uint8_t* mask = pattern + size;
+
+  for (size_t i = 0; i < size; ++i) {
+    if ((data[i] & mask[i]) != pattern[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+uint32_t sig_library_t::apply() {
+  if (sigs.empty()) {
+    return 0;
+  }
+
+  show_wait_box("Matching signatures...");
+
+  uint8_t data[SIG_MAX_SIZE];
+  uint32_t named = 0;
+  size_t qty = get_func_qty();
+  qstring name;
+
+  for (size_t i = 0; i < qty; ++i) {
+    func_t* pfn = getn_func(i);
+
+    if ((i & 0xFF) == 0 && user_cancelled()) {
+      break;
+    }
+
+    // the user names and the earlier matches stay
+    if (pfn == nullptr || is_upd_ea(pfn->start_ea) || (pfn->flags & FUNC_LIB) != 0 || has_user_name(get_flags(pfn->start_ea))) {
+      continue;
+    }
+
+    segment_t* seg = getseg(pfn->start_ea);
+    size_t avail = (seg != nullptr) ? (size_t)std::min<asize_t>(SIG_MAX_SIZE, seg->end_ea - pfn->start_ea) : 0;
+
+    if (avail < SIG_KEY_SIZE) {
+      continue;
+    }
+
+    get_bytes(data, avail, pfn->start_ea, GMB_READALL);
+
+    // the longest pattern wins, two names of the same length leave the function alone
+    const sig_entry_t* best = nullptr;
+    bool ambiguous = false;
+
+    for (uint16_t key_mask : key_masks) {
+      uint32_t bucket = hash_key(data, key_mask) & (buckets.size() - 1);
+
+      for (uint32_t s = buckets[bucket]; s != 0; s = chain[s - 1]) {
+        const sig_entry_t& sig = sigs[s - 1];
+
+        if (sig.key_mask != key_mask || sig.size > avail || !matches(&bytes[sig.pattern_off], data, sig.size)) {
+          continue;
+        }
+
+        if (best == nullptr || sig.size > best->size) {
+          best = &sig;
+          ambiguous = false;
+        }
+        else if (sig.size == best->size && !streq(&names[sig.name_off], &names[best->name_off])) {
+          ambiguous = true;
+        }
+      }
+    }
+
+    if (best == nullptr || ambiguous) {
+      continue;
+    }
+
+    // the copies of a routine in other banks get the same name with the address
+    name = &names[best->name_off];
+
+    if (!set_name(pfn->start_ea, name.c_str(), SN_NOWARN | SN_NOCHECK)) {
+      name.cat_sprnt("_%06X", (uint32_t)pfn->start_ea);
+
+      if (!set_name(pfn->start_ea, name.c_str(), SN_NOWARN | SN_NOCHECK)) {
+        continue;
+      }
+    }
+
+    pfn->flags |= FUNC_LIB;
+    update_func(pfn);
+    named++;
+  }
+
+  hide_wait_box();
+  return named;
+}
+
+ssize_t idaapi sig_library_t::on_event(ssize_t code, va_list va) {
+  if (code != idb_event::auto_empty_finally || !pending) {
+    return 0;
+  }
+
+  pending = false;
+  uint32_t named = apply();
+  msg("Signatures: %u library functions named\n", named);
+  return 0;
+}
+
+int idaapi apply_sigs_action_t::activate(action_activation_ctx_t* ctx) {
+  // the files may have changed since the database was created
+  if (library->load_dirs() == 0) {
+    warning("No signatures in %s/sig/snes or %s/sig/snes", idadir(nullptr), get_user_idadir());
+    return 1;
+  }
+
+  uint32_t named = library->apply();
+  msg("Signatures: %u library functions named\n", named);
+  return 1;
+}
+
+// the first insns of the function, up to its first return or jump
+static int make_pattern(const func_t* pfn, uint8_t* pattern, uint8_t* mask) {
+  int size = 0;
+
+  for (ea_t ea = pfn->start_ea; ea < pfn->end_ea;) {
+    if (!is_code(get_flags(ea))) {
+      break;
+    }
+
+    asize_t insn_size = get_item_size(ea);
+
+    if (insn_size > 4 || size + insn_size > SIG_MAX_SIZE) {
+      break;
+    }
+
+    uint8_t* insn = &pattern[size];
+    get_bytes(insn, insn_size, ea, GMB_READALL);
+    uint32_t masked = get_sig_operand_mask(insn, insn_size);
+
+    for (asize_t i = 0; i < insn_size; ++i) {
+      bool wildcard = (i > 0 && (masked & (1 << (i - 1))));
+      mask[size + i] = wildcard ? 0 : 0xFF;
+      insn[i] = wildcard ? 0 : insn[i];
+    }
+
+    uint8_t op = insn[0];
+    size += (int)insn_size;
+    ea += insn_size;
+
+    if (has_insn_feature(itype2opcode[op], CF_STOP)) {
+      break;
+    }
+  }
+
+  return size;
+}
+
+int idaapi create_sigs_action_t::activate(action_activation_ctx_t* ctx) {
+  const char* path = ask_file(true, "*.snsig", "Save signatures of the named functions");
+
+  if (path == nullptr) {
+    return 1;
+  }
+
+  FILE* fp = fopenWT(path);
+
+  if (fp == nullptr) {
+    warning("Can't create %s", path);
+    return 1;
+  }
+
+  char root[QMAXPATH];
+  get_root_filename(root, sizeof(root));
+  qfprintf(fp, "; %s\n", root);
+
+  uint8_t pattern[SIG_MAX_SIZE];
+  uint8_t mask[SIG_MAX_SIZE];
+  uint32_t written = 0;
+  uint32_t short_funcs = 0;
+  size_t qty = get_func_qty();
+  qstring line;
+
+  for (size_t i = 0; i < qty; ++i) {
+    func_t* pfn = getn_func(i);
+
+    if (pfn == nullptr || is_upd_ea(pfn->start_ea) || !has_user_name(get_flags(pfn->start_ea))) {
+      continue;
+    }
+
+    int size = make_pattern(pfn, pattern, mask);
+    int fixed = 0;
+
+    for (int k = 0; k < SIG_KEY_SIZE && k < size; ++k) {
+      fixed += (mask[k] != 0) ? 1 : 0;
+    }
+
+    // too short or too generic to tell one routine from another
+    if (size < SIG_KEY_SIZE || fixed < SIG_KEY_SIZE / 2) {
+      short_funcs++;
+      continue;
+    }
+
+    line.qclear();
+
+    for (int k = 0; k < size; ++k) {
+      if (mask[k] != 0) {
+        line.cat_sprnt("%02X", pattern[k]);
+      }
+      else {
+        line += "..";
+      }
+    }
+
+    qfprintf(fp, "%s %s\n", line.c_str(), get_name(pfn->start_ea).c_str());
+    written++;
+  }
+
+  qfclose(fp);
+  msg("Signatures: %u written to %s, %u named functions too short\n", written, path, short_funcs);
+  return 1;
+}
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include "snes_cart.hpp"
+
+// Board mapping database of the loader: every cart is mapped by the rows of its board,
+// the carts that don't follow their header are matched by the game code or the title
+
+enum class BoardId : uint8_t {
+	LoRom,
+	HiRom,
+	ExLoRom,
+	ExHiRom,
+	Dezaemon,
+	Bsc1A5M,
+	Sa1,
+	Sdd1,
+	Spc7110,
+	Gsu,
+	Cx4,
+};
+
+enum class BoardRegion : uint8_t {
+	Prg,
+	Sram,
+	Ram, // coprocessor RAM, code may run there
+	Regs, // coprocessor registers, XTRN segments
+	Window, // every bank shows the start of the target bank, a bank switched view
+	Home, // the rom pages no range has mapped yet, so a switched window can show any of them
+};
+
+// the ranges of the canon side register first, so they get the segments
+enum class BoardSide : uint8_t {
+	Any,
+	Low,
+	High,
+};
+
+enum class BoardCond : uint8_t {
+	Always,
+	SramPresent,
+	RomBelow2M, // and SRAM present
+	RomFrom2M, // and SRAM present
+};
+
+struct BoardRange {
+	BoardRegion region;
+	uint8_t group; // the ranges of a group share the segments, the first registered one creates them
+	BoardSide side;
+	BoardCond cond;
+	uint8_t startBank;
+	uint8_t endBank;
+	uint16_t startAddr;
+	uint16_t endAddr;
+	uint16_t pageIncrement; // Prg: pages added at each bank
+	uint16_t startPage; // Prg: 4KB rom page of the first bank; Window: the target bank
+	const char* name; // Ram/Regs: segment prefix
+};
+
+struct Board {
+	BoardId id;
+	const char* name;
+	const BoardRange* ranges;
+	size_t count;
+};
+
+#define BOARD_PRG(group, side, sb, eb, sa, ea, inc, page) { BoardRegion::Prg, group, BoardSide::side, BoardCond::Always, sb, eb, sa, ea, inc, page, nullptr }
+#define BOARD_SRAM(group, cond, sb, eb, sa, ea) { BoardRegion::Sram, group, BoardSide::Any, BoardCond::cond, sb, eb, sa, ea, 0, 0, nullptr }
+#define BOARD_RAM(group, sb, eb, sa, ea, name) { BoardRegion::Ram, group, BoardSide::Any, BoardCond::Always, sb, eb, sa, ea, 0, 0, name }
+#define BOARD_REGS(group, sb, eb, sa, ea, name) { BoardRegion::Regs, group, BoardSide::Any, BoardCond::Always, sb, eb, sa, ea, 0, 0, name }
+#define BOARD_WINDOW(group, cond, sb, eb, sa, ea, target) { BoardRegion::Window, group, BoardSide::Any, BoardCond::cond, sb, eb, sa, ea, 0, target, nullptr }
+#define BOARD_HOME(group, sb, eb, sa, ea) { BoardRegion::Home, group, BoardSide::Any, BoardCond::Always, sb, eb, sa, ea, 0, 0, nullptr }
+
+static constexpr BoardRange BOARD_LOROM[] = {
+	BOARD_PRG(0, Low, 0x00, 0x7D, 0x8000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, High, 0x80, 0xFF, 0x8000, 0xFFFF, 0, 0),
+	//For games >= 2mb in size, put SRAM at 70-7D/F0-FF:0000-7FFF (e.g: Fire Emblem: Thracia 776)
+	BOARD_SRAM(1, RomFrom2M, 0x70, 0x7D, 0x0000, 0x7FFF),
+	BOARD_SRAM(1, RomFrom2M, 0xF0, 0xFF, 0x0000, 0x7FFF),
+	//For games < 2mb in size, put save RAM at 70-7D/F0-FF:0000-FFFF (e.g: Wanderers from Ys)
+	BOARD_SRAM(2, RomBelow2M, 0x70, 0x7D, 0x0000, 0xFFFF),
+	BOARD_SRAM(2, RomBelow2M, 0xF0, 0xFF, 0x0000, 0xFFFF),
+};
+
+static constexpr BoardRange BOARD_HIROM[] = {
+	//7E-7F are WRAM, so the last banks of a 4MB rom still get their segments at FE-FF
+	BOARD_PRG(0, High, 0xC0, 0xFF, 0x0000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, Low, 0x40, 0x7D, 0x0000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, Any, 0x00, 0x3F, 0x8000, 0xFFFF, 8, 0),
+	BOARD_PRG(0, Any, 0x80, 0xBF, 0x8000, 0xFFFF, 8, 0),
+	BOARD_SRAM(1, Always, 0x20, 0x3F, 0x6000, 0x7FFF),
+	BOARD_SRAM(1, Always, 0xA0, 0xBF, 0x6000, 0x7FFF),
+};
+
+static constexpr BoardRange BOARD_EXLOROM[] = {
+	//The first 4MB are in the upper banks
+	BOARD_PRG(0, High, 0x80, 0xFF, 0x8000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, Low, 0x00, 0x7D, 0x8000, 0xFFFF, 0, 0x400),
+	BOARD_SRAM(1, SramPresent, 0x70, 0x7D, 0x0000, 0x7FFF),
+	BOARD_SRAM(1, SramPresent, 0xF0, 0xFF, 0x0000, 0x7FFF),
+};
+
+static constexpr BoardRange BOARD_EXHIROM[] = {
+	//First half is at the end
+	BOARD_PRG(0, Any, 0xC0, 0xFF, 0x0000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, Any, 0x80, 0xBF, 0x8000, 0xFFFF, 8, 0), //mirror
+	//Last part of the ROM is at the start
+	BOARD_PRG(1, Any, 0x40, 0x7D, 0x0000, 0xFFFF, 0, 0x400),
+	BOARD_PRG(1, Any, 0x00, 0x3F, 0x8000, 0xFFFF, 8, 0x400), //mirror
+	//This shouldn't be mapped on ExHiROM boards, but some old romhacks seem to depend on this
+	BOARD_SRAM(2, Always, 0x20, 0x3F, 0x6000, 0x7FFF),
+	BOARD_SRAM(2, Always, 0x80, 0xBF, 0x6000, 0x7FFF),
+};
+
+//LOROM with mirrored SRAM?
+static constexpr BoardRange BOARD_DEZAEMON[] = {
+	BOARD_PRG(0, Any, 0x00, 0x7D, 0x8000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, Any, 0x80, 0xFF, 0x8000, 0xFFFF, 0, 0),
+	BOARD_SRAM(1, Always, 0x70, 0x7D, 0x0000, 0x7FFF),
+	BOARD_SRAM(1, Always, 0x70, 0x7D, 0x8000, 0xFFFF),
+	BOARD_SRAM(2, Always, 0xF0, 0xFF, 0x8000, 0xFFFF),
+	BOARD_SRAM(2, Always, 0xF0, 0xFF, 0x0000, 0x7FFF),
+};
+
+//BSC-1A5M-02, BSC-1A7M-01
+static constexpr BoardRange BOARD_BSC_1A5M[] = {
+	BOARD_PRG(0, Any, 0x00, 0x3F, 0x8000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, Any, 0x80, 0x9F, 0x8000, 0xFFFF, 0, 0x200),
+	BOARD_PRG(0, Any, 0xA0, 0xBF, 0x8000, 0xFFFF, 0, 0x100),
+	BOARD_SRAM(1, SramPresent, 0x70, 0x7D, 0x0000, 0x7FFF),
+	BOARD_SRAM(1, SramPresent, 0xF0, 0xFF, 0x0000, 0x7FFF),
+};
+
+//The power-on state of the SA-1 MMC: 1MB blocks 0-3 in 00-1F/20-3F/80-9F/A0-BF, C0-FF is the whole rom.
+//C0-FF always gets the segments, so the other MMC views (CXB-FXB) are only a switch of the mappings.
+static constexpr BoardRange BOARD_SA1[] = {
+	BOARD_PRG(0, Any, 0xC0, 0xFF, 0x0000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, Any, 0x00, 0x3F, 0x8000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, Any, 0x80, 0xBF, 0x8000, 0xFFFF, 0, 0x200),
+	//BW-RAM, its first 8KB block is seen at 6000-7FFF too (BMAPS)
+	BOARD_SRAM(1, SramPresent, 0x40, 0x43, 0x0000, 0xFFFF),
+	BOARD_WINDOW(3, SramPresent, 0x00, 0x3F, 0x6000, 0x7FFF, 0x40),
+	BOARD_WINDOW(3, SramPresent, 0x80, 0xBF, 0x6000, 0x7FFF, 0x40),
+	//I-RAM
+	BOARD_RAM(2, 0x00, 0x3F, 0x3000, 0x3FFF, "IRAM"),
+	BOARD_RAM(2, 0x80, 0xBF, 0x3000, 0x3FFF, "IRAM"),
+};
+
+//00-3F/80-BF are the fixed first 2MB (LoROM), C0-FF are four 1MB windows of the MMC (4804-4807, power-on: blocks 0-3).
+//The rest of the rom gets its segments in the rom area banks the board leaves open (up to 3MB more in 40-6F),
+//the windows are only mappings.
+static constexpr BoardRange BOARD_SDD1[] = {
+	BOARD_PRG(0, Low, 0x00, 0x3F, 0x8000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, High, 0x80, 0xBF, 0x8000, 0xFFFF, 0, 0),
+	BOARD_HOME(0, 0x40, 0x6F, 0x0000, 0xFFFF),
+	BOARD_HOME(0, 0x74, 0x7D, 0x0000, 0xFFFF),
+	BOARD_PRG(0, Any, 0xC0, 0xFF, 0x0000, 0xFFFF, 0, 0),
+	BOARD_SRAM(1, SramPresent, 0x70, 0x73, 0x0000, 0x7FFF),
+};
+
+//1MB of program rom in C0-CF, the data rom after it is banked into D0-FF by 4831-4833 (power-on: blocks 0-2).
+//The data rom gets its segments in the rom area banks the board leaves open, the windows are only mappings.
+//00-3F/80-BF:8000-FFFF are the MCU's mirror of C0-FF, so no data rom page gets a home there.
+static constexpr BoardRange BOARD_SPC7110[] = {
+	BOARD_PRG(0, Any, 0xC0, 0xCF, 0x0000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, Any, 0x00, 0x0F, 0x8000, 0xFFFF, 8, 0),
+	BOARD_PRG(0, Any, 0x80, 0x8F, 0x8000, 0xFFFF, 8, 0),
+	BOARD_HOME(0, 0x40, 0x4F, 0x0000, 0xFFFF),
+	BOARD_HOME(0, 0x51, 0x7D, 0x0000, 0xFFFF),
+	BOARD_PRG(0, Any, 0xD0, 0xFF, 0x0000, 0xFFFF, 0, 0x100),
+	BOARD_SRAM(1, SramPresent, 0x00, 0x3F, 0x6000, 0x7FFF),
+	BOARD_SRAM(1, SramPresent, 0x80, 0xBF, 0x6000, 0x7FFF),
+	//Decompressed data port
+	BOARD_REGS(2, 0x50, 0x50, 0x0000, 0xFFFF, "DCMP"),
+};
+
+//The same rom is seen as LoROM in 00-3F and as HiROM in 40-5F, the game pak RAM is at 70-71, the backup RAM at 78-79
+static constexpr BoardRange BOARD_GSU[] = {
+	BOARD_PRG(0, Low, 0x00, 0x3F, 0x8000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, High, 0x80, 0xBF, 0x8000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, Any, 0x40, 0x5F, 0x0000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, Any, 0xC0, 0xDF, 0x0000, 0xFFFF, 0, 0),
+	BOARD_SRAM(1, Always, 0x70, 0x71, 0x0000, 0xFFFF),
+	BOARD_SRAM(1, Always, 0xF0, 0xF1, 0x0000, 0xFFFF),
+	BOARD_REGS(2, 0x00, 0x3F, 0x3000, 0x3FFF, "GSU"),
+	BOARD_REGS(2, 0x80, 0xBF, 0x3000, 0x3FFF, "GSU"),
+	BOARD_SRAM(3, SramPresent, 0x78, 0x79, 0x0000, 0xFFFF),
+};
+
+static constexpr BoardRange BOARD_CX4[] = {
+	BOARD_PRG(0, Low, 0x00, 0x3F, 0x8000, 0xFFFF, 0, 0),
+	BOARD_PRG(0, High, 0x80, 0xBF, 0x8000, 0xFFFF, 0, 0),
+	BOARD_SRAM(1, SramPresent, 0x70, 0x77, 0x0000, 0x7FFF),
+	BOARD_SRAM(1, SramPresent, 0xF0, 0xF7, 0x0000, 0x7FFF),
+	BOARD_REGS(2, 0x00, 0x3F, 0x6000, 0x7FFF, "CX4_"),
+	BOARD_REGS(2, 0x80, 0xBF, 0x6000, 0x7FFF, "CX4_"),
+};
+
+#undef BOARD_PRG
+#undef BOARD_SRAM
+#undef BOARD_RAM
+#undef BOARD_REGS
+#undef BOARD_WINDOW
+#undef BOARD_HOME
+
+#define BOARD_ROWS(id, name, rows) { BoardId::id, name, rows, sizeof(rows) / sizeof(rows[0]) }
+
+// indexed by BoardId
+static constexpr Board BOARDS[] = {
+	BOARD_ROWS(LoRom, "LoROM", BOARD_LOROM),
+	BOARD_ROWS(HiRom, "HiROM", BOARD_HIROM),
+	BOARD_ROWS(ExLoRom, "ExLoROM", BOARD_EXLOROM),
+	BOARD_ROWS(ExHiRom, "ExHiROM", BOARD_EXHIROM),
+	BOARD_ROWS(Dezaemon, "DEZAEMON", BOARD_DEZAEMON),
+	BOARD_ROWS(Bsc1A5M, "BSC-1A5M", BOARD_BSC_1A5M),
+	BOARD_ROWS(Sa1, "SA-1", BOARD_SA1),
+	BOARD_ROWS(Sdd1, "SDD-1", BOARD_SDD1),
+	BOARD_ROWS(Spc7110, "SPC7110", BOARD_SPC7110),
+	BOARD_ROWS(Gsu, "GSU", BOARD_GSU),
+	BOARD_ROWS(Cx4, "CX4", BOARD_CX4),
+};
+
+#undef BOARD_ROWS
+
+constexpr bool BoardsInIdOrder() {
+	for (size_t i = 0; i < sizeof(BOARDS) / sizeof(BOARDS[0]); i++) {
+		if ((size_t)BOARDS[i].id != i) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static_assert(BoardsInIdOrder(), "BOARDS must be indexed by BoardId");
+
+// Carts that the header doesn't describe
+enum class BoardKey : uint8_t {
+	Title, // the cart name without the trailing spaces
+	GameCode,
+};
+
+struct BoardQuirk {
+	BoardKey keyType;
+	const char* key;
+	bool hasBoard;
+	BoardId board;
+	CoprocessorType coprocessor; // None: the one of the header
+};
+
+#define QUIRK_BOARD(type, key, board) { BoardKey::type, key, true, BoardId::board, CoprocessorType::None }
+#define QUIRK_COPROCESSOR(type, key, coprocessor) { BoardKey::type, key, false, BoardId::LoRom, CoprocessorType::coprocessor }
+
+static constexpr BoardQuirk BOARD_QUIRKS[] = {
+	QUIRK_BOARD(Title, "DEZAEMON", Dezaemon),
+	//Games: Sound Novel Tsukuuru, RPG Tsukuuru, Derby Stallion 96
+	QUIRK_BOARD(GameCode, "ZDBJ", Bsc1A5M),
+	QUIRK_BOARD(GameCode, "ZR2J", Bsc1A5M),
+	QUIRK_BOARD(GameCode, "ZSNJ", Bsc1A5M),
+	QUIRK_COPROCESSOR(Title, "DUNGEON MASTER", DSP2),
+	QUIRK_COPROCESSOR(Title, "PILOTWINGS", DSP1),
+	QUIRK_COPROCESSOR(Title, "SD\xB6\xDE\xDD\xC0\xDE\xD1GX", DSP3), //SD Gundam GX
+	QUIRK_COPROCESSOR(Title, "PLANETS CHAMP TG3000", DSP4),
+	QUIRK_COPROCESSOR(Title, "TOP GEAR 3000", DSP4),
+	QUIRK_COPROCESSOR(Title, "2DAN MORITA SHOUGI", ST011),
+	QUIRK_COPROCESSOR(GameCode, "042J", SGB),
+};
+
+#undef QUIRK_BOARD
+#undef QUIRK_COPROCESSOR
+
+constexpr uint32_t BoardKeyHash(BoardKey keyType, const char* key) {
+	uint32_t hash = 0x811C9DC5 ^ (uint32_t)keyType;
+
+	for (; *key != 0; key++) {
+		hash = (hash ^ (uint8_t)*key) * 0x01000193;
+	}
+
+	return hash;
+}
+
+// open addressing, at most a quarter full so a lookup is a probe or two
+#define BOARD_INDEX_SIZE 64
+
+struct BoardIndex {
+	uint8_t slots[BOARD_INDEX_SIZE]; // BOARD_QUIRKS index + 1, 0 is empty
+};
+
+static_assert(sizeof(BOARD_QUIRKS) / sizeof(BOARD_QUIRKS[0]) * 4 <= BOARD_INDEX_SIZE, "BOARD_INDEX_SIZE is too small");
+
+constexpr BoardIndex BuildBoardIndex() {
+	BoardIndex index = {};
+
+	for (size_t i = 0; i < sizeof(BOARD_QUIRKS) / sizeof(BOARD_QUIRKS[0]); i++) {
+		uint32_t slot = BoardKeyHash(BOARD_QUIRKS[i].keyType, BOARD_QUIRKS[i].key) & (BOARD_INDEX_SIZE - 1);
+
+		while (index.slots[slot] != 0) {
+			slot = (slot + 1) & (BOARD_INDEX_SIZE - 1);
+		}
+
+		index.slots[slot] = (uint8_t)(i + 1);
+	}
+
+	return index;
+}
+
+static constexpr BoardIndex BOARD_INDEX = BuildBoardIndex();
+
+static inline const BoardQuirk* FindBoardQuirk(BoardKey keyType, const char* key) {
+	uint32_t slot = BoardKeyHash(keyType, key) & (BOARD_INDEX_SIZE - 1);
+
+	for (; BOARD_INDEX.slots[slot] != 0; slot = (slot + 1) & (BOARD_INDEX_SIZE - 1)) {
+		const BoardQuirk& quirk = BOARD_QUIRKS[BOARD_INDEX.slots[slot] - 1];
+
+		if (quirk.keyType == keyType && strcmp(quirk.key, key) == 0) {
+			return &quirk;
+		}
+	}
+
+	return nullptr;
+}
@@ -5,11 +5,23 @@
 #include <name.hpp>
 #include <segregs.hpp>
 #include <vector>
+#include <map>
 #include <cmath>
 #include <tuple>
+#include <algorithm>
 
 #include "snes_cart.hpp"
+#include "snes_boards.hpp"
 #include "65816.hpp"
+#include "analysis_cache.hpp"
+#include "rom_patch.hpp"
+
+// the accessors of 65816.hpp, for applying the analysis cache
+netnode helper;
+
+// FNV-1a of each 4KB page of the ROM, to find the changed ones on reload
+#define PAGE_HASH_TAG ('h')
+#define PAGE_SIZE 0x1000
 
 static const std::vector<std::tuple<uint16_t, const char*, const char*>> SNES_REGS = {
 	{ 0x2100, "INIDISP", "Screen Display Register" },
@@ -218,15 +230,111 @@ static const std::vector<std::tuple<uint16_t, const char*, const char*>> SNES_RE
 
 };
 
-static int32_t GetHeaderScore(linput_t* li, uint32_t addr, uint32_t _prgRomSize) {
+//SA-1 registers, only on SA-1 carts
+static const std::vector<std::tuple<uint16_t, const char*, const char*>> SA1_REGS = {
+	{ 0x2200, "CCNT", "SA-1 CPU Control" },
+	{ 0x2201, "SIE", "SNES CPU Interrupt Enable" },
+	{ 0x2202, "SIC", "SNES CPU Interrupt Clear" },
+	{ 0x2203, "CRV", "SA-1 CPU Reset Vector" },
+	{ 0x2205, "CNV", "SA-1 CPU NMI Vector" },
+	{ 0x2207, "CIV", "SA-1 CPU IRQ Vector" },
+	{ 0x2209, "SCNT", "SNES CPU Control" },
+	{ 0x220A, "CIE", "SA-1 CPU Interrupt Enable" },
+	{ 0x220B, "CIC", "SA-1 CPU Interrupt Clear" },
+	{ 0x220C, "SNV", "SNES CPU NMI Vector" },
+	{ 0x220E, "SIV", "SNES CPU IRQ Vector" },
+	{ 0x2210, "TMC", "H/V Timer Control" },
+	{ 0x2211, "CTR", "SA-1 CPU Timer Restart" },
+	{ 0x2212, "HCNT", "Set H-Count" },
+	{ 0x2214, "VCNT", "Set V-Count" },
+	{ 0x2220, "CXB", "Set Super MMC Bank C (00-1F:8000, C0-CF)" },
+	{ 0x2221, "DXB", "Set Super MMC Bank D (20-3F:8000, D0-DF)" },
+	{ 0x2222, "EXB", "Set Super MMC Bank E (80-9F:8000, E0-EF)" },
+	{ 0x2223, "FXB", "Set Super MMC Bank F (A0-BF:8000, F0-FF)" },
+	{ 0x2224, "BMAPS", "SNES CPU BW-RAM Address Mapping" },
+	{ 0x2225, "BMAP", "SA-1 CPU BW-RAM Address Mapping" },
+	{ 0x2226, "SBWE", "SNES CPU BW-RAM Write Enable" },
+	{ 0x2227, "CBWE", "SA-1 CPU BW-RAM Write Enable" },
+	{ 0x2228, "BWPA", "BW-RAM Write-Protected Area" },
+	{ 0x2229, "SIWP", "SNES CPU I-RAM Write Protection" },
+	{ 0x222A, "CIWP", "SA-1 CPU I-RAM Write Protection" },
+	{ 0x2230, "DCNT", "DMA Control" },
+	{ 0x2231, "CDMA", "Character Conversion DMA Parameters" },
+	{ 0x2232, "SDA", "DMA Source Device Start Address" },
+	{ 0x2235, "DDA", "DMA Destination Start Address" },
+	{ 0x2238, "DTC", "DMA Terminal Counter" },
+	{ 0x223F, "BBF", "BW-RAM Bit Map Format" },
+	{ 0x2240, "BRF", "Bit Map Register File" },
+	{ 0x2250, "MCNT", "Arithmetic Control" },
+	{ 0x2251, "MA", "Arithmetic Parameters: Multiplicand/Dividend" },
+	{ 0x2253, "MB", "Arithmetic Parameters: Multiplier/Divisor" },
+	{ 0x2258, "VBD", "Variable-Length Bit Processing" },
+	{ 0x2259, "VDA", "Variable-Length Bit Game Pak ROM Start Address" },
+	{ 0x2300, "SFR", "SNES CPU Flag Read" },
+	{ 0x2301, "CFR", "SA-1 CPU Flag Read" },
+	{ 0x2302, "HCR", "H-Count Read" },
+	{ 0x2304, "VCR", "V-Count Read" },
+	{ 0x2306, "MR", "Arithmetic Result" },
+	{ 0x230B, "OF", "Arithmetic Overflow Flag" },
+	{ 0x230C, "VDP", "Variable-Length Data Read Port" },
+	{ 0x230E, "VC", "Version Code Register" },
+};
+
+//GSU registers, only on GSU carts
+static const std::vector<std::tuple<uint16_t, const char*, const char*>> GSU_REGS = {
+	{ 0x3000, "GSU_R0", "GSU Default Source/Destination Register" },
+	{ 0x3002, "GSU_R1", "GSU PLOT X Register" },
+	{ 0x3004, "GSU_R2", "GSU PLOT Y Register" },
+	{ 0x3006, "GSU_R3", "GSU General Register 3" },
+	{ 0x3008, "GSU_R4", "GSU LMULT Lower 16 Bits Register" },
+	{ 0x300A, "GSU_R5", "GSU General Register 5" },
+	{ 0x300C, "GSU_R6", "GSU FMULT/LMULT Multiplier Register" },
+	{ 0x300E, "GSU_R7", "GSU MERGE Source Register 1" },
+	{ 0x3010, "GSU_R8", "GSU MERGE Source Register 2" },
+	{ 0x3012, "GSU_R9", "GSU General Register 9" },
+	{ 0x3014, "GSU_R10", "GSU General Register 10" },
+	{ 0x3016, "GSU_R11", "GSU LINK Destination Register" },
+	{ 0x3018, "GSU_R12", "GSU LOOP Counter Register" },
+	{ 0x301A, "GSU_R13", "GSU LOOP Branch Address Register" },
+	{ 0x301C, "GSU_R14", "GSU ROM Address Pointer Register" },
+	{ 0x301E, "GSU_R15", "GSU Program Counter (writing the high byte starts the GSU)" },
+	{ 0x3030, "GSU_SFR", "GSU Status/Flag Register" },
+	{ 0x3033, "GSU_BRAMR", "GSU Backup RAM Register" },
+	{ 0x3034, "GSU_PBR", "GSU Program Bank Register" },
+	{ 0x3036, "GSU_ROMBR", "GSU ROM Bank Register" },
+	{ 0x3037, "GSU_CFGR", "GSU Config Register" },
+	{ 0x3038, "GSU_SCBR", "GSU Screen Base Register" },
+	{ 0x3039, "GSU_CLSR", "GSU Clock Select Register" },
+	{ 0x303A, "GSU_SCMR", "GSU Screen Mode Register" },
+	{ 0x303B, "GSU_VCR", "GSU Version Code Register" },
+	{ 0x303C, "GSU_RAMBR", "GSU RAM Bank Register" },
+	{ 0x303E, "GSU_CBR", "GSU Cache Base Register" },
+};
+
+//A patched rom is already in memory, an unpatched one is read from the file
+static void ReadRom(linput_t* li, const bytevec_t* _image, uint32_t offset, void* buffer, size_t size) {
+	if (_image == nullptr) {
+		qlseek(li, offset, SEEK_SET);
+		qlread(li, buffer, size);
+		return;
+	}
+
+	size_t avail = offset < _image->size() ? std::min(size, _image->size() - offset) : 0;
+	memset(buffer, 0, size);
+
+	if (avail != 0) {
+		memcpy(buffer, &(*_image)[offset], avail);
+	}
+}
+
+static int32_t GetHeaderScore(linput_t* li, const bytevec_t* _image, uint32_t addr, uint32_t _prgRomSize) {
 	//Try to figure out where the header is by using a scoring system
 	if (_prgRomSize < addr + 0x7FFF) {
 		return -1;
 	}
 
 	SnesCartInformation cartInfo;
-	qlseek(li, addr + 0x7FB0, SEEK_SET);
-	qlread(li, &cartInfo, sizeof(SnesCartInformation));
+	ReadRom(li, _image, addr + 0x7FB0, &cartInfo, sizeof(SnesCartInformation));
 
 	uint32_t score = 0;
 	uint8_t mode = (cartInfo.MapMode & ~0x10);
@@ -255,16 +363,14 @@ static int32_t GetHeaderScore(linput_t* li, uint32_t addr, uint32_t _prgRomSize)
 
 	uint32_t resetVectorAddr = addr + 0x7FFC;
 	uint8_t resetVectorAddr_bytes[2];
-	qlseek(li, resetVectorAddr, SEEK_SET);
-	qlread(li, &resetVectorAddr_bytes, sizeof(resetVectorAddr_bytes));
+	ReadRom(li, _image, resetVectorAddr, &resetVectorAddr_bytes, sizeof(resetVectorAddr_bytes));
 	uint32_t resetVector = resetVectorAddr_bytes[0] | (resetVectorAddr_bytes[1] << 8);
 	if (resetVector < 0x8000) {
 		return -1;
 	}
 
 	uint8_t op;
-	qlseek(li, addr + (resetVector & 0x7FFF), SEEK_SET);
-	qlread(li, &op, sizeof(op));
+	ReadRom(li, _image, addr + (resetVector & 0x7FFF), &op, sizeof(op));
 
 	if (op == 0x18 || op == 0x78 || op == 0x4C || op == 0x5C || op == 0x20 || op == 0x22 || op == 0x9C) {
 		//CLI, SEI, JMP, JML, JSR, JSl, STZ
@@ -347,38 +453,38 @@ static std::string GetCartName(const SnesCartInformation& _cartInfo) {
 	}
 }
 
-static CoprocessorType GetSt01xVersion(const SnesCartInformation& _cartInfo) {
-	std::string cartName = GetCartName(_cartInfo);
-	if (cartName == "2DAN MORITA SHOUGI") {
+//The cart name or the game code of the carts the header doesn't describe, looked up once
+static const BoardQuirk* FindCartQuirk(const SnesCartInformation& _cartInfo) {
+	const BoardQuirk* quirk = FindBoardQuirk(BoardKey::GameCode, GetGameCode(_cartInfo).c_str());
+
+	if (quirk == nullptr) {
+		quirk = FindBoardQuirk(BoardKey::Title, GetCartName(_cartInfo).c_str());
+	}
+
+	return quirk;
+}
+
+static CoprocessorType GetSt01xVersion(const BoardQuirk* _quirk) {
+	if (_quirk != nullptr && _quirk->coprocessor == CoprocessorType::ST011) {
 		return CoprocessorType::ST011;
 	}
 
 	return CoprocessorType::ST010;
 }
 
-static CoprocessorType GetDspVersion(const SnesCartInformation& _cartInfo) {
-	std::string cartName = GetCartName(_cartInfo);
-	if (cartName == "DUNGEON MASTER") {
-		return CoprocessorType::DSP2;
-	} if (cartName == "PILOTWINGS") {
-		return CoprocessorType::DSP1;
-	}
-	else if (cartName == "SD\xB6\xDE\xDD\xC0\xDE\xD1GX") {
-		//SD Gundam GX
-		return CoprocessorType::DSP3;
-	}
-	else if (cartName == "PLANETS CHAMP TG3000" || cartName == "TOP GEAR 3000") {
-		return CoprocessorType::DSP4;
+static CoprocessorType GetDspVersion(const BoardQuirk* _quirk) {
+	if (_quirk != nullptr && _quirk->coprocessor >= CoprocessorType::DSP1 && _quirk->coprocessor <= CoprocessorType::DSP4) {
+		return _quirk->coprocessor;
 	}
 
 	//Default to DSP1B
 	return CoprocessorType::DSP1B;
 }
 
-static CoprocessorType GetCoprocessorType(const SnesCartInformation& _cartInfo, bool *_hasBattery, bool *_hasRtc) {
+static CoprocessorType GetCoprocessorType(const SnesCartInformation& _cartInfo, const BoardQuirk* _quirk, bool *_hasBattery, bool *_hasRtc) {
 	if ((_cartInfo.RomType & 0x0F) >= 0x03) {
 		switch ((_cartInfo.RomType & 0xF0) >> 4) {
-		case 0x00: return GetDspVersion(_cartInfo);
+		case 0x00: return GetDspVersion(_quirk);
 		case 0x01: return CoprocessorType::GSU;
 		case 0x02: return CoprocessorType::OBC1;
 		case 0x03: return CoprocessorType::SA1;
@@ -401,7 +507,7 @@ static CoprocessorType GetCoprocessorType(const SnesCartInformation& _cartInfo,
 
 			case 0x01:
 				*_hasBattery = true;
-				return GetSt01xVersion(_cartInfo);
+				return GetSt01xVersion(_quirk);
 
 			case 0x02:
 				*_hasBattery = true;
@@ -412,41 +518,64 @@ static CoprocessorType GetCoprocessorType(const SnesCartInformation& _cartInfo,
 			break;
 		}
 	}
-	else if (GetGameCode(_cartInfo) == "042J") {
+	else if (_quirk != nullptr && _quirk->coprocessor == CoprocessorType::SGB) {
 		return CoprocessorType::SGB;
 	}
 
 	return CoprocessorType::None;
 }
 
-static void LoadEmbeddedFirmware(CoprocessorType _coprocessorType, uint8_t* _prgRom, uint32_t _prgRomSize, std::vector<uint8_t> & _embeddedFirmware) {
-	//Attempt to detect/load the firmware from the end of the rom file, if it exists
+static uint32_t GetEmbeddedFirmwareSize(CoprocessorType _coprocessorType, uint32_t _prgRomSize) {
+	//Attempt to detect the firmware at the end of the rom file, if it exists
 	if ((_coprocessorType >= CoprocessorType::DSP1 && _coprocessorType <= CoprocessorType::DSP4) || (_coprocessorType >= CoprocessorType::ST010 && _coprocessorType <= CoprocessorType::ST011)) {
-		uint32_t firmwareSize = 0;
 		if ((_prgRomSize & 0x7FFF) == 0x2000) {
-			firmwareSize = 0x2000;
+			return 0x2000;
 		}
 		else if ((_prgRomSize & 0xFFFF) == 0xD000) {
-			firmwareSize = 0xD000;
+			return 0xD000;
 		}
-
-		_embeddedFirmware.resize(firmwareSize);
-		memcpy(_embeddedFirmware.data(), _prgRom + (_prgRomSize - firmwareSize), firmwareSize);
-		_prgRomSize -= firmwareSize;
 	}
+
+	return 0;
+}
+
+//The program rom (24-bit words) then the data rom (16-bit words), mapped straight from the rom image
+static void MapEmbeddedFirmware(const uint8_t* _prgRom, uint32_t _firmwareOffset, uint32_t _firmwareSize) {
+	uint32_t programSize = (_firmwareSize == 0xD000) ? 0xC000 : 0x1800;
+
+	segment_t s;
+	s.start_ea = UPD_PROGRAM_EA;
+	s.end_ea = UPD_PROGRAM_EA + programSize;
+	s.type = SEG_CODE;
+	s.bitness = 1;
+	s.perm = SEGPERM_EXEC | SEGPERM_READ;
+	add_segm_ex(&s, "DSP_PRG", "CODE", ADDSEG_NOSREG | ADDSEG_OR_DIE);
+	mem2base(&_prgRom[_firmwareOffset], s.start_ea, s.end_ea, _firmwareOffset);
+
+	segment_t d;
+	d.start_ea = UPD_DATA_EA;
+	d.end_ea = UPD_DATA_EA + (_firmwareSize - programSize);
+	d.type = SEG_DATA;
+	d.bitness = 1;
+	d.perm = SEGPERM_READ;
+	add_segm_ex(&d, "DSP_DATA", "CONST", ADDSEG_NOSREG | ADDSEG_OR_DIE);
+	mem2base(&_prgRom[_firmwareOffset + programSize], d.start_ea, d.end_ea, _firmwareOffset + programSize);
+
+	//The DSP starts at 0 on reset
+	set_name(UPD_PROGRAM_EA, "dsp_reset", SN_NOWARN);
+	auto_make_code(UPD_PROGRAM_EA);
+	msg("DSP firmware: %u bytes at %X\n", _firmwareSize, _firmwareOffset);
 }
 
-static void EnsureValidPrgRomSize(uint32_t& size, uint8_t*& rom) {
+static void EnsureValidPrgRomSize(uint32_t& size, bytevec_t& rom) {
+	//Drops what's left past the end once the copier header is removed
+	rom.resize(size);
+
 	if ((size & 0xFFF) != 0) {
 		//Round up to the next 4kb size, to ensure we have access to all the rom's data
 		//Memory mappings expect a multiple of 4kb to work properly
-		uint32_t orgPrgSize = size;
 		size = (size & ~0xFFF) + 0x1000;
-		uint8_t* expandedPrgRom = new uint8_t[size];
-		memset(expandedPrgRom, 0, size);
-		memcpy(expandedPrgRom, rom, orgPrgSize);
-		delete[] rom;
-		rom = expandedPrgRom;
+		rom.resize(size, 0);
 	}
 }
 
@@ -477,43 +606,57 @@ static void RegisterHandlerPrg(const uint8_t *_prgRom, uint32_t _prgRomSize, uin
 
 	startPageNumber %= handlersSize;
 	uint32_t pageNumber = startPageNumber;
-
-	bool no_mirrors = mirrors.empty();
 	uint32_t bank;
 
 	for (bank = startBank; bank <= endBank; bank++) {
 		pageNumber += pageIncrement;
 
-		uint32_t romOffset = pageNumber * 0x1000;
+		//Only the first address of a rom page becomes a segment, the wrapped and mirrored ones are mapped to it.
+		//A bank can mix both, so each run of new pages gets a segment of its own.
+		std::vector<uint32_t> pages;
+		std::vector<bool> isNew;
 
-		if (no_mirrors && romOffset < _prgRomSize) {
-			char bank_name[16];
-			qsnprintf(bank_name, sizeof(bank_name), BANK_PREFIX "%02X", bank);
-			create_segm(bank, startAddr, endAddr, bank_name, SEG_CODE, "CODE", SEGPERM_EXEC | SEGPERM_READ);
+		for (uint32_t j = startAddr, page = pageNumber; j <= endAddr; j += 0x1000, page++) {
+			page %= handlersSize;
+			bool seen = mirrors.find(page) != mirrors.end() || std::find(pages.begin(), pages.end(), page) != pages.end();
+			isNew.push_back(page * 0x1000 < _prgRomSize && !seen);
+			pages.push_back(page);
+		}
+
+		for (size_t i = 0; i < isNew.size();) {
+			size_t end = i;
+
+			while (end < isNew.size() && isNew[end] == isNew[i]) {
+				end++;
+			}
+
+			if (isNew[i]) {
+				char bank_name[16];
+				qsnprintf(bank_name, sizeof(bank_name), BANK_PREFIX "%02X", bank);
+				create_segm(bank, startAddr + (uint32_t)i * 0x1000, startAddr + (uint32_t)end * 0x1000 - 1, bank_name, SEG_CODE, "CODE", SEGPERM_EXEC | SEGPERM_READ);
+			}
+
+			i = end;
 		}
 
-		for (uint32_t j = startAddr; j <= endAddr; j += 0x1000) {
-			romOffset = pageNumber * 0x1000;
+		for (size_t i = 0; i < pages.size(); i++) {
+			uint32_t romOffset = pages[i] * 0x1000;
 
 			if (romOffset < _prgRomSize) {
-				ea_t start_ea = (ea_t)((bank << 16) + j);
+				ea_t start_ea = (ea_t)((bank << 16) + startAddr + i * 0x1000);
 				ea_t end_ea = start_ea + 0x1000;
 
-				if (no_mirrors) {
-					mirrors.emplace(pageNumber, start_ea);
+				if (isNew[i]) {
+					mirrors.emplace(pages[i], start_ea);
 					mem2base(&_prgRom[romOffset], start_ea, end_ea, romOffset);
 				}
 				else {
-					add_mapping(start_ea, mirrors[pageNumber], end_ea - start_ea);
+					add_mapping(start_ea, mirrors[pages[i]], end_ea - start_ea);
 				}
 			}
-
-			pageNumber++;
-
-			if (pageNumber >= handlersSize) {
-				pageNumber = 0;
-			}
 		}
+
+		pageNumber += (endAddr - startAddr + 1) / 0x1000;
 	}
 }
 
@@ -537,13 +680,13 @@ static void RegisterHandlerSram(uint8_t startBank, uint8_t endBank, uint16_t sta
 			create_segm(bank, startAddr, endAddr, bank_name, SEG_DATA, "DATA", SEGPERM_READ | SEGPERM_WRITE);
 			mirrors.emplace(pageNumber, start_ea);
 		}
-		else {
+		else if (mirrors.find(pageNumber) != mirrors.end()) {
 			add_mapping(start_ea, mirrors[pageNumber], end_ea - start_ea);
 		}
 	}
 }
 
-static void RegisterHandlerWram(uint8_t startBank, uint8_t endBank, uint16_t startAddr, uint16_t endAddr, std::map<uint32_t, ea_t>& mirrors) {
+static void RegisterHandlerWram(uint8_t startBank, uint8_t endBank, uint16_t startAddr, uint16_t endAddr, const char* ramName, std::map<uint32_t, ea_t>& mirrors) {
 	if ((startAddr & 0xFFF) != 0 || (endAddr & 0xFFF) != 0xFFF || startBank > endBank || startAddr > endAddr) {
 		loader_failure("invalid start/end address\n");
 	}
@@ -558,12 +701,12 @@ static void RegisterHandlerWram(uint8_t startBank, uint8_t endBank, uint16_t sta
 
 		if (no_mirrors) {
 			char bank_name[16];
-			qsnprintf(bank_name, sizeof(bank_name), "WRAM%02X", bank);
+			qsnprintf(bank_name, sizeof(bank_name), "%s%02X", ramName, bank);
 
 			create_segm(bank, startAddr, endAddr, bank_name, SEG_DATA, "DATA", SEGPERM_READ | SEGPERM_WRITE | SEGPERM_EXEC);
 			mirrors.emplace(pageNumber, start_ea);
 		}
-		else {
+		else if (mirrors.find(pageNumber) != mirrors.end()) {
 			add_mapping(start_ea, mirrors[pageNumber], end_ea - start_ea);
 		}
 	}
@@ -589,119 +732,167 @@ static void RegisterHandlerRegs(uint8_t startBank, uint8_t endBank, uint16_t sta
 			create_segm(bank, startAddr, endAddr, bank_name, SEG_XTRN, "XTRN", SEGPERM_READ | SEGPERM_WRITE);
 			mirrors.emplace(pageNumber, start_ea);
 		}
-		else {
+		else if (mirrors.find(pageNumber) != mirrors.end()) {
 			add_mapping(start_ea, mirrors[pageNumber], end_ea - start_ea);
 		}
 	}
 }
 
-static bool MapSpecificCarts(const uint8_t* _prgRom, uint32_t _prgRomSize, const SnesCartInformation& _cartInfo, uint32_t _saveRamSize, uint32_t handlersSize) {
-	std::string name = GetCartName(_cartInfo);
-	std::string code = GetGameCode(_cartInfo);
+static canon_banks_t ResolveCanonBanks(canon_banks_t _canon, CartFlags::CartFlags _flags) {
+	if (_canon != CANON_AUTO) {
+		return _canon;
+	}
 
-	std::map<uint32_t, ea_t> mirrors = {};
+	//FastROM speed is only available through the upper mirror, so that's where the code runs
+	if (_flags & CartFlags::LoRom) {
+		return (_flags & CartFlags::FastRom) ? CANON_HIGH : CANON_LOW;
+	}
 
-	//if (_sufamiTurbo) {
-	//	_sufamiTurbo->InitializeMappings(mm, _prgRomHandlers, _saveRamHandlers);
-	//	return true;
-	//}
-	//else
-	if (GetCartName(_cartInfo) == "DEZAEMON") {
-		//LOROM with mirrored SRAM?
-		mirrors.clear();
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0x00, 0x7D, 0x8000, 0xFFFF, 0, 0, handlersSize, mirrors);
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0x80, 0xFF, 0x8000, 0xFFFF, 0, 0, handlersSize, mirrors);
+	return CANON_HIGH;
+}
 
-		mirrors.clear();
-		RegisterHandlerSram(0x70, 0x7D, 0x0000, 0x7FFF, mirrors);
-		RegisterHandlerSram(0x70, 0x7D, 0x8000, 0xFFFF, mirrors);
+//Only the rom pages that aren't in the mirrors yet get a place, in ascending order
+static void RegisterHandlerHome(const uint8_t* _prgRom, uint32_t _prgRomSize, uint8_t startBank, uint8_t endBank, uint16_t startAddr, uint16_t endAddr, std::map<uint32_t, ea_t>& mirrors) {
+	if ((startAddr & 0xFFF) != 0 || (endAddr & 0xFFF) != 0xFFF || startBank > endBank || startAddr > endAddr) {
+		loader_failure("invalid start/end address\n");
+	}
 
-		mirrors.clear();
-		RegisterHandlerSram(0xF0, 0xFF, 0x8000, 0xFFFF, mirrors);
-		RegisterHandlerSram(0xF0, 0xFF, 0x0000, 0x7FFF, mirrors);
+	std::vector<uint32_t> pages;
 
-		return true;
+	for (uint32_t page = 0; page * 0x1000 < _prgRomSize; page++) {
+		if (mirrors.find(page) == mirrors.end()) {
+			pages.push_back(page);
+		}
 	}
-	else if (code == "ZDBJ" || code == "ZR2J" || code == "ZSNJ") {
-		//BSC-1A5M-02, BSC-1A7M-01
-		//Games: Sound Novel Tsukuuru, RPG Tsukuuru, Derby Stallion 96
-		mirrors.clear();
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0x00, 0x3F, 0x8000, 0xFFFF, 0, 0, handlersSize, mirrors);
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0x80, 0x9F, 0x8000, 0xFFFF, 0, 0x200, handlersSize, mirrors);
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0xA0, 0xBF, 0x8000, 0xFFFF, 0, 0x100, handlersSize, mirrors);
 
-		if (_saveRamSize > 0) {
-			mirrors.clear();
-			RegisterHandlerSram(0x70, 0x7D, 0x0000, 0x7FFF, mirrors);
-			RegisterHandlerSram(0xF0, 0xFF, 0x0000, 0x7FFF, mirrors);
+	size_t next = 0;
+
+	for (uint32_t bank = startBank; bank <= endBank && next < pages.size(); bank++) {
+		size_t count = std::min<size_t>(pages.size() - next, (endAddr - startAddr + 1) / 0x1000);
+
+		char bank_name[16];
+		qsnprintf(bank_name, sizeof(bank_name), BANK_PREFIX "%02X", bank);
+		create_segm(bank, startAddr, startAddr + (uint32_t)count * 0x1000 - 1, bank_name, SEG_CODE, "CODE", SEGPERM_EXEC | SEGPERM_READ);
+
+		for (size_t i = 0; i < count; i++, next++) {
+			uint32_t romOffset = pages[next] * 0x1000;
+			ea_t start_ea = calc_start_addr(bank, startAddr) + (ea_t)i * 0x1000;
+
+			mirrors.emplace(pages[next], start_ea);
+			mem2base(&_prgRom[romOffset], start_ea, start_ea + 0x1000, romOffset);
 		}
-		return true;
 	}
-	return false;
 }
 
-static void RegisterHandlers(const uint8_t* _prgRom, const SnesCartInformation& _cartInfo, CoprocessorType _coprocessorType, CartFlags::CartFlags _flags, uint32_t _prgRomSize, uint32_t _saveRamSize, uint32_t handlersSize) {
-	if (MapSpecificCarts(_prgRom, _prgRomSize, _cartInfo, _saveRamSize, handlersSize) || _coprocessorType == CoprocessorType::GSU || _coprocessorType == CoprocessorType::SDD1 || _coprocessorType == CoprocessorType::SPC7110 || _coprocessorType == CoprocessorType::CX4) {
-		// MapBsxMemoryPack(mm);
+static void RegisterHandlerWindow(uint8_t startBank, uint8_t endBank, uint16_t startAddr, uint16_t endAddr, uint8_t targetBank) {
+	ea_t target = calc_start_addr(targetBank, 0);
+
+	if (getseg(target) == nullptr) {
 		return;
 	}
 
-	bool mapSram = _coprocessorType != CoprocessorType::SA1;
+	for (uint32_t bank = startBank; bank <= endBank; bank++) {
+		add_mapping(calc_start_addr(bank, startAddr), target, calc_end_addr(bank, endAddr) - calc_start_addr(bank, startAddr));
+	}
+}
 
-	std::map<uint32_t, ea_t> mirrors = {};
+static const Board& SelectBoard(const BoardQuirk* _quirk, CoprocessorType _coprocessorType, CartFlags::CartFlags _flags) {
+	BoardId id;
 
-	if (_flags & CartFlags::LoRom) {
-		mirrors.clear();
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0x00, 0x7D, 0x8000, 0xFFFF, 0, 0, handlersSize, mirrors);
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0x80, 0xFF, 0x8000, 0xFFFF, 0, 0, handlersSize, mirrors);
-
-		if (mapSram && _saveRamSize > 0) {
-			if (_prgRomSize >= 1024 * 1024 * 2) {
-				//For games >= 2mb in size, put ROM at 70-7D/F0-FF:0000-7FFF (e.g: Fire Emblem: Thracia 776) 
-				mirrors.clear();
-				RegisterHandlerSram(0x70, 0x7D, 0x0000, 0x7FFF, mirrors);
-				RegisterHandlerSram(0xF0, 0xFF, 0x0000, 0x7FFF, mirrors);
+	if (_quirk != nullptr && _quirk->hasBoard) {
+		id = _quirk->board;
+	}
+	else {
+		switch (_coprocessorType) {
+		case CoprocessorType::SA1: id = BoardId::Sa1; break;
+		case CoprocessorType::SDD1: id = BoardId::Sdd1; break;
+		case CoprocessorType::SPC7110: id = BoardId::Spc7110; break;
+		case CoprocessorType::GSU: id = BoardId::Gsu; break;
+		case CoprocessorType::CX4: id = BoardId::Cx4; break;
+		default:
+			if (_flags & CartFlags::ExLoRom) {
+				id = BoardId::ExLoRom;
+			}
+			else if (_flags & CartFlags::LoRom) {
+				id = BoardId::LoRom;
+			}
+			else if (_flags & CartFlags::HiRom) {
+				id = BoardId::HiRom;
 			}
 			else {
-				//For games < 2mb in size, put save RAM at 70-7D/F0-FF:0000-FFFF (e.g: Wanderers from Ys)
-				mirrors.clear();
-				RegisterHandlerSram(0x70, 0x7D, 0x0000, 0xFFFF, mirrors);
-				RegisterHandlerSram(0xF0, 0xFF, 0x0000, 0xFFFF, mirrors);
+				id = BoardId::ExHiRom;
 			}
+			break;
 		}
 	}
-	else if (_flags & CartFlags::HiRom) {
-		mirrors.clear();
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0xC0, 0xFF, 0x0000, 0xFFFF, 0, 0, handlersSize, mirrors);
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0x40, 0x7D, 0x0000, 0xFFFF, 0, 0, handlersSize, mirrors);
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0x00, 0x3F, 0x8000, 0xFFFF, 8, 0, handlersSize, mirrors);
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0x80, 0xBF, 0x8000, 0xFFFF, 8, 0, handlersSize, mirrors);
 
-		if (mapSram) {
-			mirrors.clear();
-			RegisterHandlerSram(0x20, 0x3F, 0x6000, 0x7FFF, mirrors);
-			RegisterHandlerSram(0xA0, 0xBF, 0x6000, 0x7FFF, mirrors);
-		}
+	return BOARDS[(size_t)id];
+}
+
+static bool IsBoardRangeMapped(const BoardRange& range, uint32_t _prgRomSize, uint32_t _saveRamSize) {
+	switch (range.cond) {
+	case BoardCond::SramPresent: return _saveRamSize > 0;
+	case BoardCond::RomBelow2M: return _saveRamSize > 0 && _prgRomSize < 1024 * 1024 * 2;
+	case BoardCond::RomFrom2M: return _saveRamSize > 0 && _prgRomSize >= 1024 * 1024 * 2;
+	default: return true;
+	}
+}
+
+static void RegisterHandlers(const uint8_t* _prgRom, const Board& _board, canon_banks_t _canon, uint32_t _prgRomSize, uint32_t _saveRamSize, uint32_t handlersSize) {
+	BoardSide canonSide = (_canon == CANON_LOW) ? BoardSide::Low : BoardSide::High;
+	uint8_t groups = 0;
+
+	for (size_t i = 0; i < _board.count; i++) {
+		groups = std::max<uint8_t>(groups, (uint8_t)(_board.ranges[i].group + 1));
 	}
-	else if (_flags & CartFlags::ExHiRom) {
-		//First half is at the end
-		mirrors.clear();
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0xC0, 0xFF, 0x0000, 0xFFFF, 0, 0, handlersSize, mirrors);
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0x80, 0xBF, 0x8000, 0xFFFF, 8, 0, handlersSize, mirrors); //mirror
 
-		//Last part of the ROM is at the start
+	std::map<uint32_t, ea_t> mirrors = {};
+
+	for (uint8_t group = 0; group < groups; group++) {
 		mirrors.clear();
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0x40, 0x7D, 0x0000, 0xFFFF, 0, 0x400, handlersSize, mirrors);
-		RegisterHandlerPrg(_prgRom, _prgRomSize, 0x00, 0x3F, 0x8000, 0xFFFF, 8, 0x400, handlersSize, mirrors); //mirror
+		bool home = false;
+
+		//The first registered range gets the segments: the canon side, then the rest in the table order
+		for (int pass = 0; pass < 2; pass++) {
+			for (size_t i = 0; i < _board.count; i++) {
+				const BoardRange& r = _board.ranges[i];
+
+				if (r.group != group || (r.side == canonSide) != (pass == 0) || !IsBoardRangeMapped(r, _prgRomSize, _saveRamSize)) {
+					continue;
+				}
 
-		//Save RAM
-		if (mapSram) {
-			//if (!_emu->GetSettings()->GetSnesConfig().EnableStrictBoardMappings) {
-				//This shouldn't be mapped on ExHiROM boards, but some old romhacks seem to depend on this
-			mirrors.clear();
-			RegisterHandlerSram(0x20, 0x3F, 0x6000, 0x7FFF, mirrors);
-			//}
-			RegisterHandlerSram(0x80, 0xBF, 0x6000, 0x7FFF, mirrors);
+				switch (r.region) {
+				case BoardRegion::Prg:
+					RegisterHandlerPrg(_prgRom, _prgRomSize, r.startBank, r.endBank, r.startAddr, r.endAddr, r.pageIncrement, r.startPage, handlersSize, mirrors);
+					break;
+				case BoardRegion::Sram:
+					RegisterHandlerSram(r.startBank, r.endBank, r.startAddr, r.endAddr, mirrors);
+					break;
+				case BoardRegion::Ram:
+					RegisterHandlerWram(r.startBank, r.endBank, r.startAddr, r.endAddr, r.name, mirrors);
+					break;
+				case BoardRegion::Regs:
+					RegisterHandlerRegs(r.startBank, r.endBank, r.startAddr, r.endAddr, r.name, mirrors);
+					break;
+				case BoardRegion::Window:
+					RegisterHandlerWindow(r.startBank, r.endBank, r.startAddr, r.endAddr, (uint8_t)r.startPage);
+					break;
+				case BoardRegion::Home:
+					RegisterHandlerHome(_prgRom, _prgRomSize, r.startBank, r.endBank, r.startAddr, r.endAddr, mirrors);
+					home = true;
+					break;
+				}
+			}
+		}
+
+		//The homes only cover the rom sizes the board was made for, a bigger rom loses its last pages
+		uint32_t homeless = 0;
+		for (uint32_t page = 0; home && page * 0x1000 < _prgRomSize; page++) {
+			homeless += mirrors.find(page) == mirrors.end() ? 1 : 0;
+		}
+
+		if (homeless != 0) {
+			msg("%s: %u ROM pages have no place in the address space\n", _board.name, homeless);
 		}
 	}
 
@@ -711,12 +902,12 @@ static void RegisterHandlers(const uint8_t* _prgRom, const SnesCartInformation&
 static void RegisterHandlerWrams() {
 	std::map<uint32_t, ea_t> mirrors = {};
 
-	RegisterHandlerWram(0x7E, 0x7F, 0x0000, 0xFFFF, mirrors);
-	RegisterHandlerWram(0x00, 0x3F, 0x0000, 0x0FFF, mirrors);
-	RegisterHandlerWram(0x80, 0xBF, 0x0000, 0x0FFF, mirrors);
+	RegisterHandlerWram(0x7E, 0x7F, 0x0000, 0xFFFF, "WRAM", mirrors);
+	RegisterHandlerWram(0x00, 0x3F, 0x0000, 0x0FFF, "WRAM", mirrors);
+	RegisterHandlerWram(0x80, 0xBF, 0x0000, 0x0FFF, "WRAM", mirrors);
 
-	RegisterHandlerWram(0x00, 0x3F, 0x1000, 0x1FFF, mirrors);
-	RegisterHandlerWram(0x80, 0xBF, 0x1000, 0x1FFF, mirrors);
+	RegisterHandlerWram(0x00, 0x3F, 0x1000, 0x1FFF, "WRAM", mirrors);
+	RegisterHandlerWram(0x80, 0xBF, 0x1000, 0x1FFF, "WRAM", mirrors);
 
 	mirrors.clear();
 	RegisterHandlerRegs(0x00, 0x3F, 0x2000, 0x2FFF, "REGB", mirrors);
@@ -751,12 +942,139 @@ static uint32_t CalcHandlersSize(uint32_t _prgRomSize) {
 	return handlersSize;
 }
 
-static void AddRegsLabels() {
+static void AddRegsLabels(CoprocessorType _coprocessorType) {
 	for (auto& reg : SNES_REGS) {
 		ea_t ea = std::get<0>(reg);
 		set_name(ea, std::get<1>(reg));
 		set_cmt(ea, std::get<2>(reg), false);
 	}
+
+	const std::vector<std::tuple<uint16_t, const char*, const char*>>* coprocessorRegs = nullptr;
+
+	if (_coprocessorType == CoprocessorType::SA1) {
+		coprocessorRegs = &SA1_REGS;
+	}
+	else if (_coprocessorType == CoprocessorType::GSU) {
+		coprocessorRegs = &GSU_REGS;
+	}
+
+	if (coprocessorRegs != nullptr) {
+		for (auto& reg : *coprocessorRegs) {
+			ea_t ea = std::get<0>(reg);
+			set_name(ea, std::get<1>(reg));
+			set_cmt(ea, std::get<2>(reg), false);
+		}
+	}
+}
+
+static void SaveCartFlags(CartFlags::CartFlags _flags, canon_banks_t _canon, CoprocessorType _coprocessorType, uint32_t _saveRamSize, BoardId _board) {
+	//The proc module uses them for the memory speed (FastROM) of the cycle model
+	netnode node;
+	node.create("$ 65816");
+	node.altset(CART_FLAGS_IDX, _flags);
+	node.altset(CANON_BANKS_IDX, _canon);
+	node.altset(COPROCESSOR_IDX, (nodeidx_t)_coprocessorType);
+	node.altset(SRAM_SIZE_IDX, _saveRamSize);
+	node.altset(BOARD_IDX, (nodeidx_t)_board);
+}
+
+static void SaveRomHash(const uint8_t* _sha1) {
+	netnode node;
+	node.create("$ 65816");
+	node.supset(ROM_SHA1_IDX, _sha1, SHA1_SIZE);
+}
+
+static uint64_t HashPage(const uint8_t* _data) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+		hash = (hash ^ _data[i]) * 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+static void SavePageHashes(const uint8_t* _prgRom, uint32_t _prgRomSize) {
+	std::vector<uint64_t> hashes(_prgRomSize / PAGE_SIZE);
+
+	for (uint32_t i = 0; i < hashes.size(); i++) {
+		hashes[i] = HashPage(&_prgRom[i * PAGE_SIZE]);
+	}
+
+	netnode node;
+	node.create("$ 65816");
+	node.setblob(hashes.data(), hashes.size() * sizeof(uint64_t), 0, PAGE_HASH_TAG);
+}
+
+//A sibling "<rom>.srm" battery save of the header's SRAM size is loaded into the SRAM segments in address order,
+//the part of a segment past the save ram's size mirrors it like the cart does
+static bool LoadBatterySave(uint32_t _saveRamSize) {
+	char input[QMAXPATH];
+	char path[QMAXPATH];
+
+	if (_saveRamSize == 0 || get_input_file_path(input, sizeof(input)) <= 0) {
+		return false;
+	}
+
+	set_file_ext(path, sizeof(path), input, "srm");
+	linput_t* srm = open_linput(path, false);
+
+	if (srm == nullptr) {
+		return false;
+	}
+
+	int64 size = qlsize(srm);
+
+	if (size != _saveRamSize) {
+		close_linput(srm);
+		msg("%s: %" FMT_64 "d bytes, the cart has %u bytes of SRAM, not loaded\n", path, size, _saveRamSize);
+		return false;
+	}
+
+	//Save ram offset -> where it was loaded and how much of it
+	std::map<uint32_t, std::pair<ea_t, uint32_t>> loaded;
+	uint32_t offset = 0;
+
+	for (segment_t* seg = get_first_seg(); seg != nullptr; seg = get_next_seg(seg->start_ea)) {
+		qstring name;
+
+		if (get_segm_name(&name, seg) <= 0 || strncmp(name.c_str(), "SRAM", 4) != 0) {
+			continue;
+		}
+
+		for (ea_t ea = seg->start_ea; ea < seg->end_ea;) {
+			uint32_t pos = offset % _saveRamSize;
+			uint32_t chunk = (uint32_t)std::min<asize_t>(_saveRamSize - pos, seg->end_ea - ea);
+
+			if (offset < _saveRamSize) {
+				file2base(srm, pos, ea, ea + chunk, FILEREG_NOTPATCHABLE);
+				loaded.emplace(pos, std::make_pair(ea, chunk));
+			}
+			else {
+				//A mirror, it's mapped to the copy that was loaded, piece by piece if it was loaded in several
+				for (uint32_t done = 0; done < chunk;) {
+					auto it = std::prev(loaded.upper_bound(pos + done));
+					uint32_t skip = pos + done - it->first;
+					uint32_t length = std::min(chunk - done, it->second.second - skip);
+
+					add_mapping(ea + done, it->second.first + skip, length);
+					done += length;
+				}
+			}
+
+			ea += chunk;
+			offset += chunk;
+		}
+	}
+
+	close_linput(srm);
+
+	if (offset == 0) {
+		return false;
+	}
+
+	msg("SRAM: %s\n", path);
+	return true;
 }
 
 static void AddZeroPage() {
@@ -770,8 +1088,9 @@ static void AddZeroPage() {
 	add_segm_ex(&s, "ZERO", nullptr, ADDSEG_NOSREG | ADDSEG_OR_DIE);
 }
 
-static int check_or_load(linput_t* li, bool load) {
-	uint32_t _prgRomSize = (uint32_t)qlsize(li);
+//_image is a patched rom already in memory, it's taken over as the rom image
+static int check_or_load(linput_t* li, bytevec_t* _image, bool load, canon_banks_t _canon, uint8_t* _sha1) {
+	uint32_t _prgRomSize = _image != nullptr ? (uint32_t)_image->size() : (uint32_t)qlsize(li);
 
 	if (_prgRomSize < 0x8000) {
 		return 0;
@@ -787,7 +1106,7 @@ static int check_or_load(linput_t* li, bool load) {
 	uint32_t _headerOffset = 0;
 
 	for (uint32_t baseAddress : baseAddresses) {
-		int32_t score = GetHeaderScore(li, baseAddress, _prgRomSize);
+		int32_t score = GetHeaderScore(li, _image, baseAddress, _prgRomSize);
 
 		if (score >= 0 && score >= bestScore) {
 			bestScore = score;
@@ -796,8 +1115,7 @@ static int check_or_load(linput_t* li, bool load) {
 			hasHeader = (baseAddress & 0x200) != 0;
 
 			uint32_t headerOffset = std::min(baseAddress + 0x7FB0, (uint32_t)(_prgRomSize - sizeof(SnesCartInformation)));
-			qlseek(li, headerOffset, SEEK_SET);
-			qlread(li, &_cartInfo, sizeof(SnesCartInformation));
+			ReadRom(li, _image, headerOffset, &_cartInfo, sizeof(SnesCartInformation));
 			_headerOffset = headerOffset;
 		}
 	}
@@ -810,9 +1128,16 @@ static int check_or_load(linput_t* li, bool load) {
 		return 1;
 	}
 
-	uint8_t* _prgRom = new uint8_t[_prgRomSize];
-	qlseek(li, 0, SEEK_SET);
-	qlread(li, _prgRom, _prgRomSize);
+	bytevec_t _prgRom;
+
+	if (_image != nullptr) {
+		_prgRom.swap(*_image);
+	}
+	else {
+		_prgRom.resize(_prgRomSize);
+		qlseek(li, 0, SEEK_SET);
+		qlread(li, &_prgRom[0], _prgRomSize);
+	}
 
 	bool corruptedHeader = IsCorruptedHeader(_cartInfo);
 
@@ -830,11 +1155,14 @@ static int check_or_load(linput_t* li, bool load) {
 
 	if (flags & CartFlags::CopierHeader) {
 		//Remove the copier header
-		memmove(_prgRom, _prgRom + 512, _prgRomSize - 512);
+		memmove(&_prgRom[0], &_prgRom[512], _prgRomSize - 512);
 		_prgRomSize -= 512;
 		_headerOffset -= 512;
 	}
 
+	//Before the size fixup, so it's the hash of the dump
+	sha1_digest(&_prgRom[0], _prgRomSize, _sha1);
+
 	if ((flags & CartFlags::HiRom) && (_cartInfo.MapMode & 0x27) == 0x25) {
 		flags |= CartFlags::ExHiRom;
 	}
@@ -846,19 +1174,22 @@ static int check_or_load(linput_t* li, bool load) {
 		flags |= CartFlags::FastRom;
 	}
 	CartFlags::CartFlags _flags = (CartFlags::CartFlags)flags;
+	_canon = ResolveCanonBanks(_canon, _flags);
 
 	bool _hasBattery = (_cartInfo.RomType & 0x0F) == 0x02 || (_cartInfo.RomType & 0x0F) == 0x05 || (_cartInfo.RomType & 0x0F) == 0x06 || (_cartInfo.RomType & 0x0F) == 0x09 || (_cartInfo.RomType & 0x0F) == 0x0A;
 	bool _hasRtc = false;
 
+	const BoardQuirk* _quirk = FindCartQuirk(_cartInfo);
 	CoprocessorType _coprocessorType;
 	uint32_t _coprocessorRamSize = 0;
-	std::vector<uint8_t> _embeddedFirmware;
+	uint32_t _firmwareSize = 0;
+	uint32_t _firmwareOffset = 0;
 
 	if (corruptedHeader) {
 		_coprocessorType = CoprocessorType::None;
 	}
 	else {
-		_coprocessorType = GetCoprocessorType(_cartInfo, &_hasBattery, &_hasRtc);
+		_coprocessorType = GetCoprocessorType(_cartInfo, _quirk, &_hasBattery, &_hasRtc);
 
 		if (_coprocessorType == CoprocessorType::SGB) {
 			//Only allow SGB when a game boy rom is loaded
@@ -874,32 +1205,302 @@ static int check_or_load(linput_t* li, bool load) {
 			_coprocessorRamSize = 0x10000;
 		}
 
-		LoadEmbeddedFirmware(_coprocessorType, _prgRom, _prgRomSize, _embeddedFirmware);
+		_firmwareSize = GetEmbeddedFirmwareSize(_coprocessorType, _prgRomSize);
+		_firmwareOffset = _prgRomSize - _firmwareSize;
 	}
 
 	uint8_t rawSramSize = std::min(_cartInfo.SramSize & 0x0F, 8);
 	uint32_t _saveRamSize = rawSramSize > 0 ? 1024 * (1 << rawSramSize) : 0;
-	uint8_t* _saveRam = new uint8_t[_saveRamSize];
 
 	EnsureValidPrgRomSize(_prgRomSize, _prgRom);
 
 	// add rom mappings
 	uint32_t handlersSize = CalcHandlersSize(_prgRomSize);
-	RegisterHandlers(_prgRom, _cartInfo, _coprocessorType, _flags, _prgRomSize, _saveRamSize, handlersSize);
+	const Board& _board = SelectBoard(_quirk, _coprocessorType, _flags);
+	RegisterHandlers(&_prgRom[0], _board, _canon, _prgRomSize, _saveRamSize, handlersSize);
+	msg("Board: %s\n", _board.name);
 
 	RegisterHandlerWrams();
+	LoadBatterySave(_saveRamSize);
 
-	AddRegsLabels();
-	AddZeroPage();
+	//The firmware stays in the rom image (and its page hashes), it's only mapped a second time
+	if (_firmwareSize != 0) {
+		MapEmbeddedFirmware(&_prgRom[0], _firmwareOffset, _firmwareSize);
+	}
 
-	delete[] _prgRom;
-	delete[] _saveRam;
+	AddRegsLabels(_coprocessorType);
+	AddZeroPage();
+	SaveCartFlags(_flags, _canon, _coprocessorType, _saveRamSize, _board.id);
+	SaveRomHash(_sha1);
+	SavePageHashes(&_prgRom[0], _prgRomSize);
 
 	return 1;
 }
 
+//A sibling "<rom>.bps/.ups/.ips" is applied automatically, a manual load can pick any patch
+static bool FindRomPatch(ushort neflags, qstring* _path) {
+	static const char* const exts[] = { "bps", "ups", "ips" };
+	char input[QMAXPATH];
+	char sibling[QMAXPATH] = "";
+
+	if (get_input_file_path(input, sizeof(input)) > 0) {
+		for (const char* ext : exts) {
+			char path[QMAXPATH];
+			set_file_ext(path, sizeof(path), input, ext);
+
+			if (qfileexist(path)) {
+				qstrncpy(sibling, path, sizeof(sibling));
+				break;
+			}
+		}
+	}
+
+	if (neflags & NEF_MAN) {
+		const char* path = ask_file(false, sibling[0] != '\0' ? sibling : "*.ips;*.bps;*.ups", "Select IPS/BPS/UPS patch to apply (Cancel for none)");
+
+		if (path == nullptr) {
+			return false;
+		}
+
+		*_path = path;
+		return true;
+	}
+
+	if (sibling[0] == '\0') {
+		return false;
+	}
+
+	*_path = sibling;
+	return true;
+}
+
+//The patch is applied to the one image the rom is read into, which then becomes the loader's rom image
+static bool ReadPatchedRom(linput_t* li, const char* _patchPath, bytevec_t& _image, rom_patch_ranges_t& _ranges) {
+	FILE* fp = fopenRB(_patchPath);
+
+	if (fp == nullptr) {
+		warning("Can't open patch %s, the ROM is loaded unpatched", _patchPath);
+		return false;
+	}
+
+	bytevec_t patch;
+	patch.resize((size_t)qfsize(fp));
+	bool ok = patch.empty() || qfread(fp, &patch[0], patch.size()) == (ssize_t)patch.size();
+	qfclose(fp);
+
+	_image.resize((size_t)qlsize(li));
+	qlseek(li, 0, SEEK_SET);
+	ok = ok && qlread(li, &_image[0], _image.size()) == (ssize_t)_image.size();
+
+	qstring error = "read error";
+
+	if (!ok || !apply_rom_patch(patch, _image, _ranges, &error)) {
+		warning("Can't apply patch %s: %s, the ROM is loaded unpatched", _patchPath, error.c_str());
+		_ranges.clear();
+		_image.clear();
+		return false;
+	}
+
+	msg("Patch %s applied, %u ranges changed\n", _patchPath, (uint32_t)_ranges.size());
+	return true;
+}
+
+//Ranges are in file offsets, they are stored by ea for the proc module to highlight them
+static void SavePatchRanges(const char* _patchPath, const rom_patch_ranges_t& _ranges) {
+	netnode node;
+	node.create(PATCHES_NODE_NAME);
+	node.altdel_all(PATCH_RANGE_TAG);
+
+	helper.supset(ROM_PATCH_IDX, _patchPath);
+
+	uint32_t headerSize = (helper.altval(CART_FLAGS_IDX) & CartFlags::CopierHeader) ? 512 : 0;
+
+	for (const rom_patch_range_t& r : _ranges) {
+		uint32_t end = r.offset + r.size;
+
+		if (end <= headerSize) {
+			continue;
+		}
+
+		end -= headerSize;
+
+		for (uint32_t offset = std::max(r.offset, headerSize) - headerSize; offset < end;) {
+			uint32_t chunkEnd = std::min(end, (offset / PAGE_SIZE + 1) * PAGE_SIZE);
+			ea_t ea = get_fileregion_ea(offset);
+
+			if (ea != BADADDR) {
+				node.altset(ea, ea + (chunkEnd - offset), PATCH_RANGE_TAG);
+			}
+
+			offset = chunkEnd;
+		}
+	}
+}
+
+//The DSP words are all the same size, so the firmware code is only reanalyzed
+static void ReloadEmbeddedFirmware(const uint8_t* _prgRom, uint32_t _firmwareOffset, uint32_t _firmwareSize, const std::vector<bool>& _changed) {
+	segment_t* prg = getseg(UPD_PROGRAM_EA);
+	segment_t* data = getseg(UPD_DATA_EA);
+
+	if (prg == nullptr || data == nullptr) {
+		return;
+	}
+
+	bool changed = false;
+
+	for (uint32_t i = _firmwareOffset / PAGE_SIZE; i < (_firmwareOffset + _firmwareSize) / PAGE_SIZE; i++) {
+		changed = changed || _changed[i];
+	}
+
+	if (!changed) {
+		return;
+	}
+
+	uint32_t programSize = (uint32_t)prg->size();
+	mem2base(&_prgRom[_firmwareOffset], prg->start_ea, prg->end_ea, _firmwareOffset);
+	mem2base(&_prgRom[_firmwareOffset + programSize], data->start_ea, data->end_ea, _firmwareOffset + programSize);
+	plan_range(prg->start_ea, prg->end_ea);
+}
+
+//Only the code items over the changed bytes are undefined, names, comments, data and M/X overrides stay
+static uint32_t ReloadPage(ea_t _ea, const uint8_t* _data, uint32_t _romOffset) {
+	uint8_t old[PAGE_SIZE];
+
+	if (get_bytes(old, PAGE_SIZE, _ea) != PAGE_SIZE) {
+		memset(old, 0, sizeof(old));
+	}
+
+	int32_t first = -1;
+	int32_t last = -1;
+
+	for (int32_t i = 0; i < PAGE_SIZE; i++) {
+		if (old[i] != _data[i]) {
+			if (first < 0) {
+				first = i;
+			}
+
+			last = i;
+		}
+	}
+
+	if (first < 0) {
+		return 0;
+	}
+
+	ea_t start = get_item_head(_ea + first);
+	ea_t end = _ea + last + 1;
+	eavec_t code;
+
+	for (ea_t head = is_head(get_flags(start)) ? start : next_head(start, end); head != BADADDR && head < end; head = next_head(head, end)) {
+		if (is_code(get_flags(head))) {
+			code.push_back(head);
+		}
+	}
+
+	for (ea_t head : code) {
+		del_items(head, DELIT_SIMPLE);
+	}
+
+	mem2base(_data, _ea, _ea + PAGE_SIZE, _romOffset);
+
+	for (ea_t head : code) {
+		auto_make_code(head);
+	}
+
+	plan_range(start, end);
+	return (uint32_t)code.size();
+}
+
+static void ReloadChangedPages(linput_t* li) {
+	helper.create("$ 65816");
+
+	bytevec_t blob;
+
+	if (helper.getblob(&blob, 0, PAGE_HASH_TAG) <= 0) {
+		loader_failure("The database has no ROM page hashes, load the ROM into a new database\n");
+	}
+
+	//The same patch as at the first load, if it's still there
+	qstring patchPath;
+	rom_patch_ranges_t patchRanges;
+	bytevec_t _prgRom;
+	bool isPatched = helper.supstr(&patchPath, ROM_PATCH_IDX) > 0 && qfileexist(patchPath.c_str()) && ReadPatchedRom(li, patchPath.c_str(), _prgRom, patchRanges);
+
+	if (!isPatched) {
+		_prgRom.resize((size_t)qlsize(li));
+		qlseek(li, 0, SEEK_SET);
+		qlread(li, &_prgRom[0], _prgRom.size());
+	}
+
+	uint32_t _prgRomSize = (uint32_t)_prgRom.size();
+
+	if ((helper.altval(CART_FLAGS_IDX) & CartFlags::CopierHeader) && _prgRomSize > 512) {
+		memmove(&_prgRom[0], &_prgRom[512], _prgRomSize - 512);
+		_prgRomSize -= 512;
+	}
+
+	uint8_t sha1[SHA1_SIZE];
+	sha1_digest(&_prgRom[0], _prgRomSize, sha1);
+
+	uint32_t firmwareSize = GetEmbeddedFirmwareSize((CoprocessorType)get_coprocessor_type(), _prgRomSize);
+	uint32_t firmwareOffset = _prgRomSize - firmwareSize;
+
+	EnsureValidPrgRomSize(_prgRomSize, _prgRom);
+
+	uint32_t pageCount = _prgRomSize / PAGE_SIZE;
+	const uint64_t* oldHashes = (const uint64_t*)&blob[0];
+
+	if (blob.size() != pageCount * sizeof(uint64_t)) {
+		loader_failure("The ROM size has changed, load it into a new database\n");
+	}
+
+	std::vector<bool> changed(pageCount);
+	uint32_t changedCount = 0;
+
+	for (uint32_t i = 0; i < pageCount; i++) {
+		changed[i] = HashPage(&_prgRom[i * PAGE_SIZE]) != oldHashes[i];
+		changedCount += changed[i] ? 1 : 0;
+	}
+
+	//A page may be in several segments when the banks wrap, so every mapped copy gets patched
+	uint32_t replanned = 0;
+
+	for (segment_t* seg = get_first_seg(); seg != nullptr && changedCount != 0; seg = get_next_seg(seg->start_ea)) {
+		//The firmware segments don't hold whole pages, they're reloaded in one go
+		if (seg->start_ea >= UPD_PROGRAM_EA) {
+			continue;
+		}
+
+		for (ea_t ea = seg->start_ea; ea + PAGE_SIZE <= seg->end_ea; ea += PAGE_SIZE) {
+			int64 romOffset = get_fileregion_offset(ea);
+
+			if (romOffset < 0 || (romOffset % PAGE_SIZE) != 0 || !changed[(uint32_t)(romOffset / PAGE_SIZE)]) {
+				continue;
+			}
+
+			replanned += ReloadPage(ea, &_prgRom[romOffset], (uint32_t)romOffset);
+		}
+	}
+
+	if (firmwareSize != 0 && changedCount != 0) {
+		ReloadEmbeddedFirmware(&_prgRom[0], firmwareOffset, firmwareSize, changed);
+	}
+
+	SaveRomHash(sha1);
+	SavePageHashes(&_prgRom[0], _prgRomSize);
+
+	if (!patchRanges.empty()) {
+		SavePatchRanges(patchPath.c_str(), patchRanges);
+	}
+
+	//The proc module caches the decoded instructions
+	processor_t::notify((processor_t::event_t)EV_ROM_RELOADED);
+
+	msg("Reload: %u of %u ROM pages changed, %u instructions to reanalyze\n", changedCount, pageCount, replanned);
+}
+
 int idaapi accept_file(qstring* fileformatname, qstring* processor, linput_t* li, const char* filename) {
-	int res = check_or_load(li, false);
+	int res = check_or_load(li, nullptr, false, CANON_AUTO, nullptr);
 
 	if (res) {
 		*fileformatname = "SNES ROM";
@@ -911,7 +1512,85 @@ int idaapi accept_file(qstring* fileformatname, qstring* processor, linput_t* li
 	return 0;
 }
 
+//The SNES CPU sets the SA-1 vectors before it starts the SA-1: LDA/LDX/LDY #imm16 and a store to the register,
+//or two 8-bit LDA/STA pairs. The first value that points to the rom wins.
+static uint16_t FindSa1Vector(const bytevec_t& _code, uint16_t _reg) {
+	static const uint8_t stores[][2] = { { 0xA9, 0x8D }, { 0xA2, 0x8E }, { 0xA0, 0x8C } };
+	uint8_t lo = (uint8_t)_reg;
+	uint8_t hi = (uint8_t)(_reg >> 8);
+
+	for (size_t i = 0; i + 10 <= _code.size(); i++) {
+		const uint8_t* p = &_code[i];
+		uint16_t value = 0;
+
+		for (auto& st : stores) {
+			if (p[0] == st[0] && (p[3] == st[1] || (st[0] == 0xA9 && p[3] == 0x8F && p[6] == 0x00)) && p[4] == lo && p[5] == hi) {
+				value = p[1] | (p[2] << 8);
+			}
+		}
+
+		if (p[0] == 0xA9 && p[2] == 0x8D && p[3] == lo && p[4] == hi && p[5] == 0xA9 && p[7] == 0x8D && p[8] == (uint8_t)(lo + 1) && p[9] == hi) {
+			value = p[1] | (p[6] << 8);
+		}
+
+		if (value >= 0x8000) {
+			return value;
+		}
+	}
+
+	return 0;
+}
+
+static void SeedVector(ea_t _vector, const char* _name) {
+	ea_t ea = canon_ea(_vector);
+
+	if (!is_mapped(ea)) {
+		return;
+	}
+
+	set_name(ea, _name, SN_PUBLIC | SN_NOWARN);
+	auto_make_proc(ea);
+}
+
+//Both CPUs of a SA-1 cart run from the rom: the native NMI/IRQ of the SNES CPU and the SA-1 vectors it writes
+static void SeedSa1Vectors() {
+	bytevec_t code;
+
+	for (segment_t* seg = get_first_seg(); seg != nullptr; seg = get_next_seg(seg->start_ea)) {
+		if (seg->type == SEG_CODE) {
+			size_t pos = code.size();
+			code.resize(pos + (size_t)seg->size());
+			get_bytes(&code[pos], seg->size(), seg->start_ea);
+		}
+	}
+
+	SeedVector(get_16bit(canon_ea(0xFFEA)), "vector_nmi");
+	SeedVector(get_16bit(canon_ea(0xFFEE)), "vector_irq");
+
+	static const std::tuple<uint16_t, const char*> vectors[] = {
+		{ 0x2203, "sa1_vector_reset" },
+		{ 0x2205, "sa1_vector_nmi" },
+		{ 0x2207, "sa1_vector_irq" },
+	};
+
+	for (auto& vector : vectors) {
+		uint16_t addr = FindSa1Vector(code, std::get<0>(vector));
+
+		if (addr != 0) {
+			SeedVector(addr, std::get<1>(vector));
+		}
+		else {
+			msg("SA-1: no write to %04X found, %s isn't known\n", std::get<0>(vector), std::get<1>(vector));
+		}
+	}
+}
+
 void idaapi load_file(linput_t* li, ushort neflags, const char* fileformatname) {
+	if (neflags & NEF_RELOAD) {
+		ReloadChangedPages(li);
+		return;
+	}
+
 	set_processor_type("m65816", SETPROC_LOADER);
 	inf_set_app_bitness(32);
 
@@ -943,13 +1622,55 @@ void idaapi load_file(linput_t* li, ushort neflags, const char* fileformatname)
 	);
 	inf_set_af2(0);
 
-	int res = check_or_load(li, true);
+	ushort canon = CANON_AUTO;
+
+	if (neflags & NEF_MAN) {
+		static const char form[] =
+			"Mirrored ROM banks\n"
+			"\n"
+			"Code and data of the mirrored banks are analyzed only at the selected ones\n"
+			"<~A~uto (LoROM: 80+ if FastROM; HiROM: C0+):R>\n"
+			"<~L~ow banks (LoROM: 00+; HiROM: 40+):R>\n"
+			"<~H~igh banks (LoROM: 80+; HiROM: C0+):R>>\n"
+			"\n";
+
+		if (ask_form(form, &canon) <= 0) {
+			canon = CANON_AUTO;
+		}
+	}
+
+	qstring patchPath;
+	bytevec_t patched;
+	rom_patch_ranges_t patchRanges;
+	bool isPatched = FindRomPatch(neflags, &patchPath) && ReadPatchedRom(li, patchPath.c_str(), patched, patchRanges);
 
-	ea_t ea = use_mapping(0xFFFC);
+	uint8_t sha1[SHA1_SIZE];
+	int res = check_or_load(li, isPatched ? &patched : nullptr, true, (canon_banks_t)canon, sha1);
+
+	ea_t ea = canon_ea(0xFFFC);
 	uint32_t reset_vector = get_16bit(ea);
-	reset_vector = use_mapping(reset_vector);
+	reset_vector = canon_ea(reset_vector);
 	set_name(reset_vector, "vector_reset", SN_PUBLIC);
-	auto_make_proc(reset_vector);
+
+	//A known ROM gets the code of its previous analysis instead of tracing it from the reset vector again
+	helper.create("$ 65816");
+
+	if (!patchRanges.empty()) {
+		SavePatchRanges(patchPath.c_str(), patchRanges);
+	}
+
+	uint32_t cached = apply_analysis_cache(sha1);
+
+	if (cached != 0) {
+		msg("Analysis cache: %u instructions applied\n", cached);
+	}
+	else {
+		auto_make_proc(reset_vector);
+	}
+
+	if ((CoprocessorType)helper.altval(COPROCESSOR_IDX) == CoprocessorType::SA1) {
+		SeedSa1Vectors();
+	}
 
 	jumpto(reset_vector);
 }
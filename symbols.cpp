@@ -0,0 +1,364 @@
+#include "65816.hpp"
+#include "mapped_file.hpp"
+#include <kernwin.hpp>
+#include <name.hpp>
+#include <algorithm>
+
+// Symbol files of the assemblers (WLA-DX, ca65 debug info, bass/asar nocash style) are parsed
+// in one pass over the mapped file, names are kept as references into it until applied
+
+#define SYM_BAD_ADDR 0xFFFFFFFF
+#define SYM_NAME_MAX 0xFFFF
+
+enum class sym_format_t : uint8_t {
+  Plain, // "bb:aaaa name" or "bbaaaa name" (bass, asar nocash, no$sns)
+  Wla, // plain lines inside of the [labels] section
+  Ca65, // sym id=..,name="..",val=0x..,type=lab
+};
+
+struct sym_entry_t {
+  ea_t ea;
+  uint32_t name_off;
+  uint16_t name_len;
+};
+
+struct sym_stats_t {
+  uint32_t parsed;
+  uint32_t unmapped;
+  uint32_t names;
+  uint32_t aliases;
+};
+
+static inline int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+
+  return -1;
+}
+
+static int parse_hex(const char*& p, const char* end, uint32_t* value) {
+  int digits = 0;
+  uint32_t res = 0;
+
+  while (p < end && digits < 8) {
+    int v = hex_value(*p);
+
+    if (v < 0) {
+      break;
+    }
+
+    res = (res << 4) | v;
+    digits++;
+    p++;
+  }
+
+  *value = res;
+  return digits;
+}
+
+static inline bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skip_spaces(const char* p, const char* end) {
+  while (p < end && is_space(*p)) {
+    p++;
+  }
+
+  return p;
+}
+
+static inline bool starts_with(const char* p, const char* end, const char* str, size_t len) {
+  return (size_t)(end - p) >= len && memcmp(p, str, len) == 0;
+}
+
+#define STARTS_WITH(p, end, str) starts_with(p, end, str, sizeof(str) - 1)
+
+// "bb:aaaa name", "bbaaaa name" or "aaaa name"
+static bool parse_plain_line(const char* p, const char* end, uint32_t* addr, const char** name, const char** name_end) {
+  uint32_t value;
+  int digits = parse_hex(p, end, &value);
+
+  if (digits == 0) {
+    return false;
+  }
+
+  if (p < end && *p == ':') {
+    uint32_t low;
+    p++;
+
+    if (parse_hex(p, end, &low) == 0) {
+      return false;
+    }
+
+    value = (value << 16) | (low & 0xFFFF);
+  }
+
+  if (p == end || !is_space(*p)) {
+    return false;
+  }
+
+  p = skip_spaces(p, end);
+  const char* start = p;
+
+  while (p < end && !is_space(*p) && *p != ';') {
+    p++;
+  }
+
+  if (p == start) {
+    return false;
+  }
+
+  *addr = value & 0xFFFFFF;
+  *name = start;
+  *name_end = p;
+  return true;
+}
+
+// sym	id=0,name="reset",addrsize=absolute,scope=0,def=1,ref=5,val=0x8000,seg=0,type=lab
+static bool parse_ca65_line(const char* p, const char* end, uint32_t* addr, const char** name, const char** name_end) {
+  if (!STARTS_WITH(p, end, "sym\t")) {
+    return false;
+  }
+
+  p += 4;
+
+  const char* n = nullptr;
+  const char* n_end = nullptr;
+  bool has_val = false;
+  bool is_label = false;
+
+  while (p < end) {
+    if (STARTS_WITH(p, end, "name=\"")) {
+      p += 6;
+      n = p;
+
+      while (p < end && *p != '"') {
+        p++;
+      }
+
+      n_end = p;
+    }
+    else if (STARTS_WITH(p, end, "val=0x")) {
+      p += 6;
+      has_val = parse_hex(p, end, addr) != 0;
+    }
+    else if (STARTS_WITH(p, end, "type=lab")) {
+      is_label = true;
+    }
+
+    while (p < end && *p != ',') {
+      p++;
+    }
+
+    if (p < end) {
+      p++;
+    }
+  }
+
+  if (n == nullptr || n_end == n || !has_val || !is_label) {
+    return false;
+  }
+
+  *addr &= 0xFFFFFF;
+  *name = n;
+  *name_end = n_end;
+  return true;
+}
+
+static sym_format_t detect_format(const char* p, const char* end) {
+  // both formats say so in the first lines, don't scan the whole file
+  const char* limit = p + std::min<size_t>(end - p, 0x1000);
+
+  if (STARTS_WITH(p, limit, "version\tmajor=")) {
+    return sym_format_t::Ca65;
+  }
+
+  for (const char* s = p; s < limit; ++s) {
+    if (*s == '[' && STARTS_WITH(s, limit, "[labels]")) {
+      return sym_format_t::Wla;
+    }
+  }
+
+  return sym_format_t::Plain;
+}
+
+static void parse_symbols(const mapped_file_t& file, sym_format_t format, qvector<sym_entry_t>& entries, sym_stats_t* stats) {
+  const char* base = (const char*)file.data();
+  const char* end = base + file.size();
+  const char* p = base;
+
+  // WLA-DX has other sections with constants and breakpoints
+  bool in_labels = (format != sym_format_t::Wla);
+
+  entries.reserve((size_t)(file.size() / 24));
+
+  while (p < end) {
+    const char* line_end = (const char*)memchr(p, '\n', end - p);
+
+    if (line_end == nullptr) {
+      line_end = end;
+    }
+
+    const char* s = skip_spaces(p, line_end);
+    p = line_end + 1;
+
+    if (s == line_end || *s == ';' || *s == '#') {
+      continue;
+    }
+
+    if (format == sym_format_t::Wla && *s == '[') {
+      in_labels = STARTS_WITH(s, line_end, "[labels]");
+      continue;
+    }
+
+    if (!in_labels) {
+      continue;
+    }
+
+    uint32_t addr = SYM_BAD_ADDR;
+    const char* name = nullptr;
+    const char* name_end = nullptr;
+    bool ok = (format == sym_format_t::Ca65) ? parse_ca65_line(s, line_end, &addr, &name, &name_end) : parse_plain_line(s, line_end, &addr, &name, &name_end);
+
+    if (!ok || name_end - name > SYM_NAME_MAX) {
+      continue;
+    }
+
+    stats->parsed++;
+
+    // the same mirror rules as for the operands
+    ea_t ea = canon_ea(addr);
+
+    if (!is_mapped(ea)) {
+      stats->unmapped++;
+      continue;
+    }
+
+    sym_entry_t entry = { ea, (uint32_t)(name - base), (uint16_t)(name_end - name) };
+    entries.push_back(entry);
+  }
+}
+
+// an "aka" line of an earlier import has the alias already
+static bool has_alias(const qstring& cmt, const char* name, size_t len) {
+  for (const char* line = cmt.c_str(); *line != '\0';) {
+    const char* end = strchr(line, '\n');
+
+    if (end == nullptr) {
+      end = line + strlen(line);
+    }
+
+    if (strncmp(line, "aka ", 4) == 0) {
+      for (const char* s = line + 4; s < end;) {
+        const char* e = s;
+
+        while (e < end && *e != ',') {
+          ++e;
+        }
+
+        if ((size_t)(e - s) == len && memcmp(s, name, len) == 0) {
+          return true;
+        }
+
+        s = (e < end) ? e + 1 : end;
+
+        while (s < end && *s == ' ') {
+          ++s;
+        }
+      }
+    }
+
+    line = (*end == '\n') ? end + 1 : end;
+  }
+
+  return false;
+}
+
+static void apply_symbols(const mapped_file_t& file, qvector<sym_entry_t>& entries, sym_stats_t* stats) {
+  const char* base = (const char*)file.data();
+
+  // ascending addresses keep the name index updates local, the file order is kept for the aliases
+  std::stable_sort(entries.begin(), entries.end(), [](const sym_entry_t& a, const sym_entry_t& b) {
+    return a.ea < b.ea;
+  });
+
+  qstring name;
+  qstring aliases;
+  qstring cmt;
+  uint32_t groups = 0;
+
+  for (size_t i = 0; i < entries.size();) {
+    ea_t ea = entries[i].ea;
+    name.qclear();
+    name.append(base + entries[i].name_off, entries[i].name_len);
+
+    if (get_name(ea) != name && set_name(ea, name.c_str(), SN_NOCHECK | SN_NOWARN | SN_FORCE)) {
+      stats->names++;
+    }
+
+    // the other labels of the same address go to one repeatable comment
+    aliases.qclear();
+    cmt.qclear();
+
+    if (i + 1 < entries.size() && entries[i + 1].ea == ea) {
+      get_cmt(&cmt, ea, true);
+    }
+
+    for (++i; i < entries.size() && entries[i].ea == ea; ++i) {
+      if (has_alias(cmt, base + entries[i].name_off, entries[i].name_len) || has_alias(aliases, base + entries[i].name_off, entries[i].name_len)) {
+        continue;
+      }
+
+      aliases += aliases.empty() ? "aka " : ", ";
+
+      aliases.append(base + entries[i].name_off, entries[i].name_len);
+      stats->aliases++;
+    }
+
+    if (!aliases.empty()) {
+      append_cmt(ea, aliases.c_str(), true);
+    }
+
+    if ((++groups & 0x3FF) == 0 && user_cancelled()) {
+      break;
+    }
+  }
+}
+
+int idaapi import_symbols_action_t::activate(action_activation_ctx_t* ctx) {
+  const char* path = ask_file(false, "*.sym;*.dbg", "Select WLA-DX/ca65/bass/asar symbol file");
+
+  if (path == nullptr) {
+    return 1;
+  }
+
+  mapped_file_t file;
+
+  if (!file.open(path)) {
+    warning("Can't open symbol file %s", path);
+    return 1;
+  }
+
+  show_wait_box("Importing symbols...");
+
+  const char* data = (const char*)file.data();
+  sym_format_t format = detect_format(data, data + file.size());
+
+  sym_stats_t stats = {};
+  qvector<sym_entry_t> entries;
+  parse_symbols(file, format, entries, &stats);
+  apply_symbols(file, entries, &stats);
+
+  hide_wait_box();
+
+  msg("Symbols: %u parsed, %u names set, %u aliases, %u unmapped\n", stats.parsed, stats.names, stats.aliases, stats.unmapped);
+  return 1;
+}
@@ -0,0 +1,466 @@
+#include "65816.hpp"
+#include "mapped_file.hpp"
+#include "trace.hpp"
+#include <kernwin.hpp>
+#include <auto.hpp>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+// Emulator trace logs (bsnes, bsnes-plus, Mesen, snes9x) are parsed in parallel chunks
+// and reduced to one record per executed address before touching the database
+
+#define TRACE_MIN_CHUNK (16 * 1024 * 1024)
+#define TRACE_PROGRESS_STEP (1024 * 1024)
+
+struct trace_line_t {
+  uint32_t pc;
+  uint16_t d;
+  uint8_t db;
+  uint8_t p;
+  uint8_t indirect;
+  bool has_p;
+  bool has_db;
+  bool has_d;
+};
+
+static inline int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+
+  return -1;
+}
+
+static int parse_hex(const char*& p, const char* end, int max_digits, uint32_t* value) {
+  int digits = 0;
+  uint32_t res = 0;
+
+  while (p < end && digits < max_digits) {
+    int v = hex_value(*p);
+
+    if (v < 0) {
+      break;
+    }
+
+    res = (res << 4) | v;
+    digits++;
+    p++;
+  }
+
+  *value = res;
+  return digits;
+}
+
+static inline bool is_alpha(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline char to_lower(char c) {
+  return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+// "nvmxdizc" where upper case letters are set flags, snes9x prefixes it with "e"
+static bool parse_flags(const char* p, const char* end, uint8_t* flags) {
+  static const char letters[] = "nvmxdizc";
+
+  if (end - p == 9 && to_lower(*p) == 'e') {
+    p++;
+  }
+
+  if (end - p != 8) {
+    return false;
+  }
+
+  uint8_t res = 0;
+
+  for (int i = 0; i < 8; ++i) {
+    if (to_lower(p[i]) != letters[i]) {
+      return false;
+    }
+
+    if (p[i] >= 'A' && p[i] <= 'Z') {
+      res |= 0x80 >> i;
+    }
+  }
+
+  *flags = res;
+  return true;
+}
+
+static bool parse_trace_line(const char* p, const char* end, trace_line_t* line) {
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+
+  if (p < end && *p == '$') {
+    p++;
+  }
+
+  uint32_t pc;
+  int digits = parse_hex(p, end, 6, &pc);
+
+  if (p < end && (*p == ':' || *p == '/') && digits <= 2) {
+    p++;
+
+    uint32_t offset;
+
+    if (parse_hex(p, end, 4, &offset) != 4) {
+      return false;
+    }
+
+    pc = (pc << 16) | offset;
+  }
+  else if (digits != 6) {
+    return false;
+  }
+
+  if (p < end && *p != ' ' && *p != '\t') {
+    return false;
+  }
+
+  *line = {};
+  line->pc = pc;
+
+  bool has_mnem = false;
+
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+      p++;
+    }
+
+    const char* tok = p;
+
+    while (p < end && *p != ' ' && *p != '\t') {
+      p++;
+    }
+
+    size_t len = p - tok;
+
+    if (len == 0) {
+      break;
+    }
+
+    if (!has_mnem && len == 3 && is_alpha(tok[0]) && is_alpha(tok[1]) && is_alpha(tok[2])) {
+      has_mnem = true;
+
+      char m0 = to_lower(tok[0]), m1 = to_lower(tok[1]), m2 = to_lower(tok[2]);
+      bool is_jmp = (m0 == 'j' && m1 == 'm' && (m2 == 'p' || m2 == 'l'));
+      bool is_jsr = (m0 == 'j' && m1 == 's' && m2 == 'r');
+
+      if (is_jmp || is_jsr) {
+        const char* op = p;
+
+        while (op < end && (*op == ' ' || *op == '\t')) {
+          op++;
+        }
+
+        if (op < end && (*op == '(' || *op == '[')) {
+          line->indirect = is_jsr ? TRACE_IND_CALL : TRACE_IND_JUMP;
+        }
+      }
+    }
+    else if (len > 3 && tok[0] == 'D' && tok[1] == 'B' && tok[2] == ':') {
+      const char* v = tok + 3;
+      uint32_t db;
+      line->has_db = parse_hex(v, p, 2, &db) == 2;
+      line->db = (uint8_t)db;
+    }
+    else if (len > 2 && (tok[0] == 'D' || tok[0] == 'B') && tok[1] == ':') {
+      const char* v = tok + 2;
+      uint32_t value;
+      int n = parse_hex(v, p, 4, &value);
+
+      if (tok[0] == 'D') {
+        line->has_d = (n == 4);
+        line->d = (uint16_t)value;
+      }
+      else {
+        line->has_db = (n == 2);
+        line->db = (uint8_t)value;
+      }
+    }
+    else if (len > 2 && tok[0] == 'P' && tok[1] == ':') {
+      const char* v = tok + 2;
+      uint32_t value;
+
+      if (len == 4 && parse_hex(v, p, 2, &value) == 2) {
+        line->p = (uint8_t)value;
+        line->has_p = true;
+      }
+      else {
+        line->has_p = parse_flags(tok + 2, p, &line->p);
+      }
+    }
+    else if ((len == 8 || len == 9) && !line->has_p) {
+      line->has_p = parse_flags(tok, p, &line->p);
+    }
+  }
+
+  return true;
+}
+
+static void parse_trace_chunk(const char* start, const char* end, trace_chunk_t* chunk, std::atomic<uint64_t>* progress, const std::atomic<bool>* cancel) {
+  const char* p = start;
+  const char* reported = start;
+  trace_rec_t* rec = nullptr;
+  uint32_t rec_pc = TRACE_BAD_PC;
+
+  while (p < end) {
+    const char* eol = (const char*)memchr(p, '\n', end - p);
+
+    if (eol == nullptr) {
+      eol = end;
+    }
+
+    trace_line_t line;
+
+    if (parse_trace_line(p, eol, &line)) {
+      chunk->lines++;
+
+      if (chunk->first_pc == TRACE_BAD_PC) {
+        chunk->first_pc = line.pc;
+      }
+
+      if (chunk->pending_from != TRACE_BAD_PC) {
+        chunk->targets.insert(((uint64_t)chunk->pending_from << 24) | line.pc);
+      }
+
+      chunk->pending_from = line.indirect ? line.pc : TRACE_BAD_PC;
+
+      if (line.pc != rec_pc) {
+        rec = &chunk->recs[line.pc];
+        rec_pc = line.pc;
+      }
+
+      rec->modes |= line.indirect;
+
+      if (line.has_p) {
+        rec->modes |= (line.p & m65816_flags::MemoryMode8) ? TRACE_M8 : TRACE_M16;
+        rec->modes |= (line.p & m65816_flags::IndexMode8) ? TRACE_X8 : TRACE_X16;
+      }
+
+      if (line.has_db) {
+        rec->set_db(line.db);
+      }
+
+      if (line.has_d) {
+        rec->set_d(line.d);
+      }
+    }
+
+    p = eol + 1;
+
+    if (p - reported >= TRACE_PROGRESS_STEP) {
+      progress->fetch_add(p - reported);
+      reported = p;
+
+      if (cancel->load()) {
+        return;
+      }
+    }
+  }
+
+  progress->fetch_add(end - reported);
+}
+
+static void merge_trace_chunks(qvector<trace_chunk_t>& chunks, trace_chunk_t* res) {
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    trace_chunk_t& chunk = chunks[i];
+
+    if (i > 0 && chunks[i - 1].pending_from != TRACE_BAD_PC && chunk.first_pc != TRACE_BAD_PC) {
+      res->targets.insert(((uint64_t)chunks[i - 1].pending_from << 24) | chunk.first_pc);
+    }
+
+    if (res->recs.empty()) {
+      res->recs.swap(chunk.recs);
+    }
+    else {
+      for (auto& kv : chunk.recs) {
+        auto it = res->recs.find(kv.first);
+
+        if (it == res->recs.end()) {
+          res->recs.emplace(kv.first, kv.second);
+        }
+        else {
+          it->second.merge(kv.second);
+        }
+      }
+    }
+
+    res->targets.insert(chunk.targets.begin(), chunk.targets.end());
+    res->lines += chunk.lines;
+
+    chunk.recs.clear();
+    chunk.targets.clear();
+  }
+}
+
+static bool parse_trace(const mapped_file_t& file, trace_chunk_t* res) {
+  const char* data = (const char*)file.data();
+  const char* data_end = data + file.size();
+
+  size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  size_t chunks_count = std::max<size_t>(1, std::min<size_t>(threads, (size_t)(file.size() / TRACE_MIN_CHUNK)));
+  uint64_t chunk_size = file.size() / chunks_count;
+
+  qvector<trace_chunk_t> chunks;
+  chunks.resize(chunks_count);
+
+  std::atomic<uint64_t> progress(0);
+  std::atomic<bool> cancel(false);
+  std::atomic<size_t> finished(0);
+  std::vector<std::thread> workers;
+
+  const char* start = data;
+
+  for (size_t i = 0; i < chunks_count; ++i) {
+    const char* end = (i + 1 == chunks_count) ? data_end : data + chunk_size * (i + 1);
+
+    // chunks always end on a line boundary
+    const char* eol = (const char*)memchr(end, '\n', data_end - end);
+    end = (eol == nullptr) ? data_end : eol + 1;
+
+    if (start >= end) {
+      break;
+    }
+
+    trace_chunk_t* chunk = &chunks[i];
+    workers.emplace_back([start, end, chunk, &progress, &cancel, &finished]() {
+      parse_trace_chunk(start, end, chunk, &progress, &cancel);
+      finished.fetch_add(1);
+    });
+
+    start = end;
+  }
+
+  while (finished.load() < workers.size()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    if (user_cancelled()) {
+      cancel.store(true);
+    }
+
+    replace_wait_box("Parsing trace log: %u%%", (uint32_t)(progress.load() * 100 / file.size()));
+  }
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  if (cancel.load()) {
+    return false;
+  }
+
+  replace_wait_box("Merging trace records...");
+  merge_trace_chunks(chunks, res);
+
+  return true;
+}
+
+size_t apply_trace(const trace_chunk_t& res) {
+  size_t applied = 0;
+
+  for (const auto& kv : res.recs) {
+    ea_t ea = canon_ea(kv.first);
+
+    if (!is_mapped(ea)) {
+      continue;
+    }
+
+    const trace_rec_t& rec = kv.second;
+    bool changed = false;
+    uint8_t m = rec.modes & (TRACE_M8 | TRACE_M16);
+    uint8_t x = rec.modes & (TRACE_X8 | TRACE_X16);
+
+    if (!ea_is_manual_bitmode(ea) && (m == TRACE_M8 || m == TRACE_M16) && (x == TRACE_X8 || x == TRACE_X16)) {
+      uint8_t flags = ea_get_flags(ea);
+      setflag(flags, (uint8_t)m65816_flags::MemoryMode8, m == TRACE_M8);
+      setflag(flags, (uint8_t)m65816_flags::IndexMode8, x == TRACE_X8);
+
+      // seen at runtime, don't let the flow propagation in ana override it
+      changed = flags != ea_get_flags(ea);
+      ea_set_flags(ea, flags);
+      ea_set_observed_bitmode(ea, true);
+    }
+
+    if ((rec.regs & (TRACE_D_SEEN | TRACE_D_MULTI)) == TRACE_D_SEEN && ea_get_dpage(ea) != rec.d) {
+      ea_set_dpage(ea, rec.d);
+      changed = true;
+    }
+
+    if ((rec.regs & (TRACE_DB_SEEN | TRACE_DB_MULTI)) == TRACE_DB_SEEN && ea_get_bank(ea) == BADADDR && is_data_bank_mode(get_byte(ea))) {
+      ea_set_bank(ea, (ea_t)rec.db << 16);
+      changed = true;
+    }
+
+    // an insn that is already code keeps its old size and operands until it's decoded again
+    if (changed && is_code(get_flags(ea))) {
+      plan_ea(ea);
+    }
+    else {
+      auto_make_code(ea);
+    }
+    applied++;
+  }
+
+  for (uint64_t key : res.targets) {
+    uint32_t from_pc = (uint32_t)(key >> 24);
+    ea_t from = canon_ea(from_pc);
+    ea_t to = canon_ea((ea_t)(key & 0xFFFFFF));
+
+    if (!is_mapped(from) || !is_mapped(to)) {
+      continue;
+    }
+
+    auto it = res.recs.find(from_pc);
+    bool is_call = (it != res.recs.end()) && (it->second.modes & TRACE_IND_CALL);
+
+    add_cref(from, to, is_call ? fl_CN : fl_JN);
+
+    if (is_call) {
+      auto_make_proc(to);
+    }
+    else {
+      auto_make_code(to);
+    }
+  }
+
+  return applied;
+}
+
+int idaapi import_trace_action_t::activate(action_activation_ctx_t* ctx) {
+  const char* path = ask_file(false, "*.log;*.txt", "Select bsnes/Mesen CPU trace log");
+
+  if (path == nullptr) {
+    return 1;
+  }
+
+  mapped_file_t file;
+
+  if (!file.open(path)) {
+    warning("Can't open trace log %s", path);
+    return 1;
+  }
+
+  show_wait_box("Parsing trace log...");
+
+  trace_chunk_t res;
+  bool ok = parse_trace(file, &res);
+  file.close();
+
+  if (ok) {
+    replace_wait_box("Applying trace records...");
+    size_t applied = apply_trace(res);
+    msg("Trace: %" FMT_64 "u lines, %u executed addresses, %u indirect targets\n", res.lines, (uint32_t)applied, (uint32_t)res.targets.size());
+  }
+
+  hide_wait_box();
+  return 1;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include <unordered_set>
+
+// Per address records of executed code, from the trace log importer and the micro emulator,
+// applied to the database in one batch
+
+#define TRACE_M8 0x01
+#define TRACE_M16 0x02
+#define TRACE_X8 0x04
+#define TRACE_X16 0x08
+#define TRACE_IND_JUMP 0x10
+#define TRACE_IND_CALL 0x20
+
+#define TRACE_DB_SEEN 0x01
+#define TRACE_DB_MULTI 0x02
+#define TRACE_D_SEEN 0x04
+#define TRACE_D_MULTI 0x08
+
+#define TRACE_BAD_PC 0xFFFFFFFF
+
+struct trace_rec_t {
+	uint8_t modes;
+	uint8_t regs;
+	uint8_t db;
+	uint16_t d;
+
+	void set_db(uint8_t value) {
+		if ((regs & TRACE_DB_SEEN) && db != value) {
+			regs |= TRACE_DB_MULTI;
+		}
+
+		regs |= TRACE_DB_SEEN;
+		db = value;
+	}
+
+	void set_d(uint16_t value) {
+		if ((regs & TRACE_D_SEEN) && d != value) {
+			regs |= TRACE_D_MULTI;
+		}
+
+		regs |= TRACE_D_SEEN;
+		d = value;
+	}
+
+	void merge(const trace_rec_t& other) {
+		modes |= other.modes;
+		regs |= other.regs & (TRACE_DB_MULTI | TRACE_D_MULTI);
+
+		if (other.regs & TRACE_DB_SEEN) {
+			set_db(other.db);
+		}
+
+		if (other.regs & TRACE_D_SEEN) {
+			set_d(other.d);
+		}
+	}
+};
+
+struct trace_chunk_t {
+	std::unordered_map<uint32_t, trace_rec_t> recs;
+	std::unordered_set<uint64_t> targets; // (from << 24) | to
+	uint32_t first_pc = TRACE_BAD_PC;
+	uint32_t pending_from = TRACE_BAD_PC; // the last line is an indirect jump
+	uint64_t lines = 0;
+};
+
+// M/X, D and DB of the records seen with one value, crefs of the indirect targets; returns the applied records
+size_t apply_trace(const trace_chunk_t& res);
@@ -0,0 +1,302 @@
+#include "65816.hpp"
+#include "snes_cart.hpp"
+
+// The DSP-n carts have a uPD77C25, the ST010/ST011 ones a uPD96050 with the same instruction set
+// and 14-bit program addresses. An instruction is a little endian 24-bit word, its top 2 bits select the format:
+//   OP/RT: 00/01 PPAAAA BDDMMMMR SSSSDDDD (P pselect, A alu, B asl, D dpl, M dphm, R rpdcr, S src, D dst)
+//   JP:    10 CCCCCCCCC NNNNNNNNNNN BB (C branch condition, N next address, B bank on the uPD96050)
+//   LD:    11 IIIIIIIIIIIIIIII -- DDDD (I immediate, D dst)
+
+#define UPD_INSN_SIZE 3
+
+enum upd_format_t : uint8_t {
+  UPD_FMT_OP,
+  UPD_FMT_RT,
+  UPD_FMT_JP,
+  UPD_FMT_LD,
+};
+
+struct upd_branch_t {
+  uint16_t brch;
+  uint16_t itype;
+  const char* name;
+  bool upd96050; // the high/low 8KB program halves only exist there
+};
+
+static const upd_branch_t upd_branches[] = {
+  { 0x000, UPD_jmpso, "JMPSO",  false },
+  { 0x080, UPD_jcc,   "JNCA",   false },
+  { 0x082, UPD_jcc,   "JCA",    false },
+  { 0x084, UPD_jcc,   "JNCB",   false },
+  { 0x086, UPD_jcc,   "JCB",    false },
+  { 0x088, UPD_jcc,   "JNZA",   false },
+  { 0x08A, UPD_jcc,   "JZA",    false },
+  { 0x08C, UPD_jcc,   "JNZB",   false },
+  { 0x08E, UPD_jcc,   "JZB",    false },
+  { 0x090, UPD_jcc,   "JNOVA0", false },
+  { 0x092, UPD_jcc,   "JOVA0",  false },
+  { 0x094, UPD_jcc,   "JNOVB0", false },
+  { 0x096, UPD_jcc,   "JOVB0",  false },
+  { 0x098, UPD_jcc,   "JNOVA1", false },
+  { 0x09A, UPD_jcc,   "JOVA1",  false },
+  { 0x09C, UPD_jcc,   "JNOVB1", false },
+  { 0x09E, UPD_jcc,   "JOVB1",  false },
+  { 0x0A0, UPD_jcc,   "JNSA0",  false },
+  { 0x0A2, UPD_jcc,   "JSA0",   false },
+  { 0x0A4, UPD_jcc,   "JNSB0",  false },
+  { 0x0A6, UPD_jcc,   "JSB0",   false },
+  { 0x0A8, UPD_jcc,   "JNSA1",  false },
+  { 0x0AA, UPD_jcc,   "JSA1",   false },
+  { 0x0AC, UPD_jcc,   "JNSB1",  false },
+  { 0x0AE, UPD_jcc,   "JSB1",   false },
+  { 0x0B0, UPD_jcc,   "JDPL0",  false },
+  { 0x0B1, UPD_jcc,   "JDPLN0", false },
+  { 0x0B2, UPD_jcc,   "JDPLF",  false },
+  { 0x0B3, UPD_jcc,   "JDPLNF", false },
+  { 0x0B4, UPD_jcc,   "JNSIAK", false },
+  { 0x0B6, UPD_jcc,   "JSIAK",  false },
+  { 0x0B8, UPD_jcc,   "JNSOAK", false },
+  { 0x0BA, UPD_jcc,   "JSOAK",  false },
+  { 0x0BC, UPD_jcc,   "JNRQM",  false },
+  { 0x0BE, UPD_jcc,   "JRQM",   false },
+  { 0x100, UPD_jmp,   "JMP",    false }, // LJMP on the uPD96050
+  { 0x101, UPD_jmp,   "HJMP",   true  },
+  { 0x140, UPD_call,  "CALL",   false }, // LCALL on the uPD96050
+  { 0x141, UPD_call,  "HCALL",  true  },
+};
+
+static const char* const upd_alu_ops[16] = {
+  "NOP", "OR", "AND", "XOR", "SUB", "ADD", "SBB", "ADC", "DEC", "INC", "CMP", "SHR1", "SHL1", "SHL2", "SHL4", "XCHG",
+};
+
+static const char* const upd_pselects[4] = { "RAM", "IDB", "M", "N" };
+static const char* const upd_dpls[4] = { "DPNOP", "DPINC", "DPDEC", "DPCLR" };
+
+static const char* const upd_srcs[16] = {
+  "TRB", "A", "B", "TR", "DP", "RP", "RO", "SGN", "DR", "DRNF", "SR", "SIM", "SIL", "K", "L", "MEM",
+};
+
+static const char* const upd_dsts[16] = {
+  "NON", "A", "B", "TR", "DP", "RP", "DR", "SR", "SOL", "SOM", "K", "KLR", "KLM", "L", "TRB", "MEM",
+};
+
+static bool is_upd96050() {
+  uint32_t chip = get_coprocessor_type();
+  return chip == (uint32_t)CoprocessorType::ST010 || chip == (uint32_t)CoprocessorType::ST011;
+}
+
+static const upd_branch_t* find_upd_branch(uint16_t brch) {
+  for (const upd_branch_t& branch : upd_branches) {
+    if (branch.brch == brch) {
+      return &branch;
+    }
+  }
+
+  return nullptr;
+}
+
+int upd_ana(insn_t& insn) {
+  uint32_t word = insn.get_next_byte();
+  word |= insn.get_next_byte() << 8;
+  word |= insn.get_next_byte() << 16;
+
+  insn.insnpref = static_cast<char>(word >> 22);
+
+  switch (insn.insnpref) {
+  case UPD_FMT_OP:
+  case UPD_FMT_RT: {
+    insn.itype = (insn.insnpref == UPD_FMT_OP) ? UPD_op : UPD_rt;
+
+    // the fields are printed from the word, there's no addressing to analyze
+    insn.Op1.type = o_idpspec0;
+    insn.Op1.value = word;
+    insn.Op1.dtype = dt_dword;
+  } break;
+  case UPD_FMT_JP: {
+    bool upd96050 = is_upd96050();
+    const upd_branch_t* branch = find_upd_branch((word >> 13) & 0x1FF);
+
+    if (branch == nullptr || (branch->upd96050 && !upd96050)) {
+      return 0;
+    }
+
+    insn.itype = branch->itype;
+    insn.Op1.specval = (uval_t)(branch - upd_branches);
+
+    if (branch->itype == UPD_jmpso) {
+      break;
+    }
+
+    uint32_t pc = (uint32_t)((insn.ea - UPD_PROGRAM_EA) / UPD_INSN_SIZE);
+    uint32_t target = (word >> 2) & 0x7FF;
+
+    if (upd96050) {
+      target |= ((word & 3) << 11) | (pc & 0x2000);
+
+      if (branch->brch == 0x100 || branch->brch == 0x140) {
+        target &= ~0x2000;
+      }
+      else if (branch->brch == 0x101 || branch->brch == 0x141) {
+        target |= 0x2000;
+      }
+    }
+
+    insn.Op1.type = o_near;
+    insn.Op1.addr = insn.Op1.value = UPD_PROGRAM_EA + target * UPD_INSN_SIZE;
+    insn.Op1.dtype = dt_word;
+
+    if (!is_mapped(insn.Op1.addr)) {
+      return 0;
+    }
+  } break;
+  case UPD_FMT_LD: {
+    insn.itype = UPD_ld;
+
+    insn.Op1.type = o_imm;
+    insn.Op1.value = (word >> 6) & 0xFFFF;
+    insn.Op1.dtype = dt_word;
+
+    insn.Op2.type = o_reg;
+    insn.Op2.reg = word & 0xF;
+    insn.Op2.dtype = dt_word;
+  } break;
+  }
+
+  return insn.size;
+}
+
+int upd_emu(const insn_t& insn) {
+  switch (insn.itype) {
+  case UPD_jmp: {
+    insn.add_cref(insn.Op1.addr, 0, fl_JN);
+  } break;
+  case UPD_jcc: {
+    insn.add_cref(insn.Op1.addr, 0, fl_JN);
+    add_cref(insn.ea, insn.ea + insn.size, fl_F);
+  } break;
+  case UPD_call: {
+    insn.add_cref(insn.Op1.addr, 0, fl_CN);
+    add_cref(insn.ea, insn.ea + insn.size, fl_F);
+  } break;
+  case UPD_rt:
+  case UPD_jmpso: {
+    // returns and SO jumps end the flow
+  } break;
+  default: {
+    add_cref(insn.ea, insn.ea + insn.size, fl_F);
+  } break;
+  }
+
+  return 1;
+}
+
+void upd_out_mnem(outctx_t& ctx) {
+  switch (ctx.insn.itype) {
+  case UPD_jmp:
+  case UPD_call:
+  case UPD_jmpso:
+  case UPD_jcc: {
+    ctx.out_custom_mnem(upd_branches[ctx.insn.Op1.specval].name, 8);
+  } break;
+  default: {
+    ctx.out_mnem(8, nullptr);
+  } break;
+  }
+}
+
+// ALU op, move and the DP/RP updates of an OP/RT word, the parts that do nothing are left out
+static void out_upd_op(outctx_t& ctx, uint32_t word) {
+  uint8_t pselect = (word >> 20) & 0x3;
+  uint8_t alu = (word >> 16) & 0xF;
+  uint8_t asl = (word >> 15) & 0x1;
+  uint8_t dpl = (word >> 13) & 0x3;
+  uint8_t dphm = (word >> 9) & 0xF;
+  uint8_t rpdcr = (word >> 8) & 0x1;
+  uint8_t src = (word >> 4) & 0xF;
+  uint8_t dst = (word >> 0) & 0xF;
+  bool first = true;
+
+  auto separate = [&]() {
+    if (!first) {
+      ctx.out_char(' ');
+    }
+    first = false;
+  };
+
+  if (alu != 0) {
+    separate();
+    ctx.out_keyword(upd_alu_ops[alu]);
+    ctx.out_char(' ');
+    ctx.out_register(asl ? "B" : "A");
+    ctx.out_symbol(',');
+    ctx.out_register(upd_pselects[pselect]);
+  }
+
+  if (dst != 0) {
+    separate();
+    ctx.out_keyword("MOV");
+    ctx.out_char(' ');
+    ctx.out_register(upd_dsts[dst]);
+    ctx.out_symbol(',');
+    ctx.out_register(upd_srcs[src]);
+  }
+
+  if (dpl != 0) {
+    separate();
+    ctx.out_keyword(upd_dpls[dpl]);
+  }
+
+  if (dphm != 0) {
+    separate();
+    ctx.out_keyword("M");
+    ctx.out_long(dphm, 16);
+  }
+
+  if (rpdcr != 0) {
+    separate();
+    ctx.out_keyword("RPDEC");
+  }
+
+  if (first) {
+    ctx.out_keyword("NOP");
+  }
+}
+
+bool upd_out_operand(outctx_t& ctx, const op_t& x) {
+  switch (x.type) {
+  case o_idpspec0: {
+    out_upd_op(ctx, (uint32_t)x.value);
+  } break;
+  case o_imm: {
+    ctx.out_symbol('#');
+    ctx.out_value(x, OOFW_16);
+  } break;
+  case o_reg: {
+    ctx.out_register(upd_dsts[x.reg & 0xF]);
+  } break;
+  case o_near: {
+    if (!ctx.out_name_expr(x, x.addr)) {
+      ctx.out_value(x, OOFW_32);
+    }
+  } break;
+  default:
+    return false;
+  }
+
+  return true;
+}
+
+void upd_out_insn(outctx_t& ctx) {
+  ctx.out_mnemonic();
+
+  if (ctx.insn.Op1.type != o_void) {
+    ctx.out_one_operand(0);
+  }
+
+  if (ctx.insn.Op2.type != o_void) {
+    ctx.out_symbol(',');
+    ctx.out_one_operand(1);
+  }
+
+  ctx.flush_outbuf();
+}